@@ -9,14 +9,33 @@
 #include <unistd.h>
 #include <stdbool.h>
 #include <stdbool.h>
+#include <poll.h>
+#include <time.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <sys/ioctl.h>
 
 #include "dma-api.h"
 #include "helper.h"
 
+// u-dma-buf per-range cache maintenance, see the U_DMA_BUF_IOCTL_H section of u-dma-buf.c.
+// The argument packs offset << 32 | size (16 B granular) | direction << 2 | 1.
+#define U_DMA_BUF_IOCTL_MAGIC 'U'
+#define U_DMA_BUF_IOCTL_SET_SYNC_FOR_CPU _IOW(U_DMA_BUF_IOCTL_MAGIC, 5, uint64_t)
+#define U_DMA_BUF_IOCTL_SET_SYNC_FOR_DEVICE _IOW(U_DMA_BUF_IOCTL_MAGIC, 6, uint64_t)
+#define U_DMA_BUF_SYNC_MODE_NONCACHED 1
+#define U_DMA_BUF_SYNC_ALWAYS 4
+#define DMA_CACHE_LINE 64
+
 // Private helper functions
 static inline void reg_write32(volatile const uint8_t *regs, uint32_t off, uint32_t val)
 {
+#ifdef DMA_SIM
+    (void)regs;
+    simDmaRegWrite(off, val);
+#else
     *(volatile uint32_t *)(regs + off) = val;
+#endif
 }
 
 static inline uint32_t reg_read32(volatile uint8_t *regs, uint32_t off)
@@ -24,6 +43,27 @@ static inline uint32_t reg_read32(volatile uint8_t *regs, uint32_t off)
     return *(volatile uint32_t *)(regs + off);
 }
 
+static int64_t elapsed_ms(const struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)(now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+static uint64_t raw_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static int64_t elapsed_us(const struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)(now.tv_sec - since->tv_sec) * 1000000 + (now.tv_nsec - since->tv_nsec) / 1000;
+}
+
 static int read_file_u64(const char *path, uint64_t *out)
 {
     int fd = open(path, O_RDONLY);
@@ -84,13 +124,233 @@ static int read_file_u32(const char *path, uint32_t *content, const char *format
     return 0;
 }
 
+// Completion is the channel going idle in simple mode, or the descriptor's Cmplt bit in SG mode
+static bool transfer_done(uint32_t sr, const volatile struct DmaSgDescriptor *desc)
+{
+    if (desc != NULL)
+    {
+        return (desc->status & DMA_SG_STATUS_CMPLT) != 0;
+    }
+    return (sr & DMA_STATUS_IDLE) != 0;
+}
+
+static int wait_poll(volatile uint8_t *regs, size_t buffer_index, uint8_t timeout_ms,
+                     const volatile struct DmaSgDescriptor *desc)
+{
+    uint32_t sr_off = DMA_CHANNEL_REG(buffer_index, MM2S_STATUS);
+    for (;;)
+    {
+        uint32_t sr = reg_read32(regs, sr_off);
+
+        if (transfer_done(sr, desc))
+        {
+            return DMA_RECEIVED;
+        }
+        if (sr & DMA_STATUS_ERR_IRQ)
+        {
+            fprintf(stderr, "DMA error: status @ 0x%08x = 0x%08x\n", sr_off, sr);
+            return DMA_FAILED;
+        }
+        if (timeout_ms == 0)
+        {
+            // fprintf(stderr, "Timeout waiting for DMA idle: status @ 0x%08x = 0x%08x\n", sr_off, sr);
+            return DMA_TIMEOUT;
+        }
+        // ~1ms poll interval
+        timeout_ms--;
+        sleep_ms(1);
+    }
+}
+
+// wait_poll for what is left of timeout_ms since start
+static int wait_poll_rest(volatile uint8_t *regs, size_t buffer_index, uint8_t timeout_ms, const struct timespec *start,
+                          const volatile struct DmaSgDescriptor *desc)
+{
+    int64_t remaining = (int64_t)timeout_ms - elapsed_ms(start);
+
+    return wait_poll(regs, buffer_index, (remaining > 0) ? (uint8_t)remaining : 0, desc);
+}
+
+static int wait_irq(int fd_uio, volatile uint8_t *regs, size_t buffer_index, uint8_t timeout_ms,
+                    const volatile struct DmaSgDescriptor *desc)
+{
+    uint32_t sr_off = DMA_CHANNEL_REG(buffer_index, MM2S_STATUS);
+    size_t other_index = (buffer_index == SRC_BUF_ID) ? DEST_BUF_ID : SRC_BUF_ID;
+    struct pollfd pfd = {.fd = fd_uio, .events = POLLIN};
+    struct timespec start;
+    bool rearm = false;
+
+    if (fd_uio < 0)
+    {
+        return wait_poll(regs, buffer_index, timeout_ms, desc);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (;;)
+    {
+        uint32_t sr = reg_read32(regs, sr_off);
+        int result = -1;
+
+        if (sr & DMA_STATUS_ERR_IRQ)
+        {
+            fprintf(stderr, "DMA error: status @ 0x%08x = 0x%08x\n", sr_off, sr);
+            ackDmaInterrupt(regs, buffer_index, DMA_STATUS_IRQ_MASK);
+            result = DMA_FAILED;
+        }
+        else if (transfer_done(sr, desc))
+        {
+            ackDmaInterrupt(regs, buffer_index, DMA_STATUS_IOC_IRQ | DMA_STATUS_DLY_IRQ);
+            result = DMA_RECEIVED;
+        }
+
+        // Done before ever blocking: the interrupt of this completion may already be
+        // pending and the line masked. Take it now, or the next wait wakes up for it.
+        uint32_t irq_count;
+        if (result >= 0 && !rearm && poll(&pfd, 1, 0) == 1 && read(fd_uio, &irq_count, sizeof(irq_count)) == (ssize_t)sizeof(irq_count))
+        {
+            rearm = true;
+        }
+
+        if (rearm)
+        {
+            // Both channels may share the UIO line. Clear the other channel's completion
+            // bits so the level interrupt drops before unmasking, but leave its error bit
+            // for its own waiter to report.
+            ackDmaInterrupt(regs, other_index, DMA_STATUS_IOC_IRQ | DMA_STATUS_DLY_IRQ);
+            if (result < 0)
+            {
+                ackDmaInterrupt(regs, buffer_index, DMA_STATUS_IOC_IRQ | DMA_STATUS_DLY_IRQ);
+            }
+            enableDmaInterrupt(fd_uio);
+            rearm = false;
+        }
+        if (result >= 0)
+        {
+            return result;
+        }
+
+        int64_t remaining = (int64_t)timeout_ms - elapsed_ms(&start);
+        if (remaining <= 0)
+        {
+            return DMA_TIMEOUT;
+        }
+
+        int r = poll(&pfd, 1, (int)remaining);
+        if (r < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "poll(uio): %s, falling back to polling\n", strerror(errno));
+            return wait_poll_rest(regs, buffer_index, timeout_ms, &start, desc);
+        }
+        if (r == 0)
+        {
+            // Re-check the status once more before giving up, the line may not be routed to UIO
+            continue;
+        }
+
+        if (read(fd_uio, &irq_count, sizeof(irq_count)) != (ssize_t)sizeof(irq_count))
+        {
+            fprintf(stderr, "read(uio): %s, falling back to polling\n", strerror(errno));
+            return wait_poll_rest(regs, buffer_index, timeout_ms, &start, desc);
+        }
+        rearm = true;
+    }
+}
+
+static int wait_adaptive(struct DmaWaitStrategy *wait, int fd_uio, volatile uint8_t *regs, size_t buffer_index,
+                         uint8_t timeout_ms, const volatile struct DmaSgDescriptor *desc)
+{
+    uint32_t sr_off = DMA_CHANNEL_REG(buffer_index, MM2S_STATUS);
+    int64_t budget_us = (int64_t)wait->spin_us + wait->yield_us;
+    uint64_t *phase_hits = NULL;
+    struct timespec start;
+    int result;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (budget_us > (int64_t)timeout_ms * 1000)
+    {
+        budget_us = (int64_t)timeout_ms * 1000;
+    }
+
+    for (;;)
+    {
+        int64_t spent_us = elapsed_us(&start);
+        uint32_t sr = reg_read32(regs, sr_off);
+
+        if (transfer_done(sr, desc) || (sr & DMA_STATUS_ERR_IRQ))
+        {
+            phase_hits = getDmaWaitPhaseHits(wait, spent_us);
+            break;
+        }
+        if (spent_us >= budget_us)
+        {
+            break;
+        }
+        if (spent_us >= wait->spin_us)
+        {
+            sched_yield();
+        }
+    }
+
+    // The fallback does the acking and error reporting. With the transfer already
+    // finished it returns on its first status read.
+    int64_t remaining = (phase_hits != NULL) ? 0 : (int64_t)timeout_ms - elapsed_ms(&start);
+    if (remaining < 0)
+    {
+        remaining = 0;
+    }
+    if (wait->fallback == DMA_WAIT_IRQ)
+    {
+        result = wait_irq(fd_uio, regs, buffer_index, (uint8_t)remaining, desc);
+    }
+    else
+    {
+        result = wait_poll(regs, buffer_index, (uint8_t)remaining, desc);
+    }
+
+    if (result == DMA_RECEIVED)
+    {
+        (*((phase_hits != NULL) ? phase_hits : &wait->fallback_hits))++;
+    }
+    else if (result == DMA_TIMEOUT)
+    {
+        wait->timeouts++;
+    }
+    return result;
+}
+
 // Public methods
 int DmaInit();
 
+int openDmaDevice(const char *path, int flags)
+{
+#ifdef DMA_SIM
+    (void)flags;
+    return simDmaOpen(path);
+#else
+    return open(path, flags);
+#endif
+}
+
+void *mapDmaDevice(int fd, size_t length)
+{
+#ifdef DMA_SIM
+    return simDmaMap(fd, length);
+#else
+    return mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+#endif
+}
+
 int getPhyAddr(size_t buffer_index, uint64_t *phy_src_addr)
 {
     char path[128];
 
+#ifdef DMA_SIM
+    snprintf(path, sizeof(path), "udmabuf%zu", buffer_index);
+    return simDmaBufferInfo(path, phy_src_addr, NULL);
+#endif
+
     snprintf(path, sizeof(path), "/sys/class/u-dma-buf/udmabuf%d/phys_addr", buffer_index);
     read_file_u64(path, phy_src_addr);
     return (phy_src_addr == NULL) ? -1 : 0;
@@ -100,67 +360,1046 @@ int getBufSize(size_t buffer_index, uint32_t *size_src_buf)
 {
     char path[128];
 
+#ifdef DMA_SIM
+    snprintf(path, sizeof(path), "udmabuf%zu", buffer_index);
+    return simDmaBufferInfo(path, NULL, size_src_buf);
+#endif
+
     snprintf(path, sizeof(path), "/sys/class/u-dma-buf/udmabuf%d/size", buffer_index);
     read_file_u32(path, size_src_buf, "%d");
     return (size_src_buf == NULL) ? -1 : 0;
 }
 
+int getPhyAddrByName(const char *device_name, uint64_t *phy_addr)
+{
+    char path[128];
+
+#ifdef DMA_SIM
+    return simDmaBufferInfo(device_name, phy_addr, NULL);
+#endif
+
+    snprintf(path, sizeof(path), "/sys/class/u-dma-buf/%s/phys_addr", device_name);
+    return read_file_u64(path, phy_addr);
+}
+
+int getBufSizeByName(const char *device_name, uint32_t *size)
+{
+    char path[128];
+    uint64_t value;
+
+#ifdef DMA_SIM
+    return simDmaBufferInfo(device_name, NULL, size);
+#endif
+
+    snprintf(path, sizeof(path), "/sys/class/u-dma-buf/%s/size", device_name);
+    if (read_file_u64(path, &value) != 0)
+    {
+        return -1;
+    }
+    *size = (uint32_t)value;
+    return 0;
+}
+
+int setDmaBufferCached(size_t buffer_index, bool cached)
+{
+    char name[32];
+
+    snprintf(name, sizeof(name), "udmabuf%zu", buffer_index);
+    return setDmaBufferCachedByName(name, cached);
+}
+
+int setDmaBufferCachedByName(const char *device_name, bool cached)
+{
+#ifdef DMA_SIM
+    // memfds are coherent, there is nothing to switch
+    (void)device_name;
+    (void)cached;
+    return 0;
+#else
+    char path[128];
+    int mode = U_DMA_BUF_SYNC_MODE_NONCACHED | (cached ? 0 : U_DMA_BUF_SYNC_ALWAYS);
+
+    // Without sync-always a mapping opened without O_SYNC is cacheable. The overlays set
+    // sync-always, which is what switching back restores.
+    snprintf(path, sizeof(path), "/sys/class/u-dma-buf/%s/sync_mode", device_name);
+    int fd = open(path, O_WRONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    char buf[4];
+    int len = snprintf(buf, sizeof(buf), "%d", mode);
+    ssize_t n = write(fd, buf, (size_t)len);
+    close(fd);
+    if (n != len)
+    {
+        fprintf(stderr, "Failed to write %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+#endif
+}
+
+static int sync_dma_buffer(int fd_buf, unsigned long request, uint64_t offset, uint32_t size, enum DmaSyncDirection direction)
+{
+#ifdef DMA_SIM
+    (void)fd_buf;
+    (void)request;
+    (void)offset;
+    (void)size;
+    (void)direction;
+    return 0;
+#else
+    // Whole cache lines, the buffers are sized in multiples of them
+    uint64_t start = offset & ~(uint64_t)(DMA_CACHE_LINE - 1);
+    uint64_t end = (offset + size + DMA_CACHE_LINE - 1) & ~(uint64_t)(DMA_CACHE_LINE - 1);
+    uint64_t command = (start << 32) | ((end - start) & 0xFFFFFFF0) | ((uint64_t)direction << 2) | 1;
+
+    if (ioctl(fd_buf, request, &command) != 0)
+    {
+        fprintf(stderr, "u-dma-buf sync of 0x%" PRIx64 "+%u failed: %s\n", offset, size, strerror(errno));
+        return -1;
+    }
+    return 0;
+#endif
+}
+
+int syncDmaBufferForCpu(int fd_buf, uint64_t offset, uint32_t size, enum DmaSyncDirection direction)
+{
+    return sync_dma_buffer(fd_buf, U_DMA_BUF_IOCTL_SET_SYNC_FOR_CPU, offset, size, direction);
+}
+
+int syncDmaBufferForDevice(int fd_buf, uint64_t offset, uint32_t size, enum DmaSyncDirection direction)
+{
+    return sync_dma_buffer(fd_buf, U_DMA_BUF_IOCTL_SET_SYNC_FOR_DEVICE, offset, size, direction);
+}
+
 void resetDmaChannel(volatile uint8_t const *reg_map, size_t buffer_index)
 {
-    uint32_t offset;
-    offset = (buffer_index == SRC_BUF_ID) ? MM2S_CRTL : S2MM_CRTL;
-    reg_write32(reg_map, offset, DMA_CRTL_RESET);
+    reg_write32(reg_map, DMA_CHANNEL_REG(buffer_index, MM2S_CRTL), DMA_CRTL_RESET);
 }
 
 void startDmaChannel(volatile uint8_t const *reg_map, size_t buffer_index)
 {
-    uint32_t offset;
-    offset = (buffer_index == SRC_BUF_ID) ? MM2S_CRTL : S2MM_CRTL;
-    reg_write32(reg_map, offset, DMA_CRTL_RUN_STOP | DMA_CTRL_EN_IRQ);
+    reg_write32(reg_map, DMA_CHANNEL_REG(buffer_index, MM2S_CRTL), DMA_CRTL_RUN_STOP | DMA_CTRL_EN_IRQ);
+}
+
+int waitDmaTransmissionDone(volatile uint8_t *regs, size_t buffer_index, uint8_t timeout_ms)
+{
+    return wait_poll(regs, buffer_index, timeout_ms, NULL);
 }
 
-void setDmaChannelAddress(volatile uint8_t const *reg_map, size_t buffer_index, uint64_t phy_address)
+int enableDmaInterrupt(int fd_uio)
 {
-    uint32_t offset, address_lsb, address_msb;
-    address_lsb = (uint32_t)(phy_address & 0xFFFFFFFF);
-    address_msb = (uint32_t)(phy_address >> 32);
+    // uio_pdrv_genirq masks the line in its handler, writing 1 unmasks it again
+    uint32_t unmask = 1;
 
-    offset = (buffer_index == SRC_BUF_ID) ? MM2S_SRC_ADDR : S2MM_DEST_ADDR;
-    reg_write32(reg_map, offset, address_lsb);
-    offset = (buffer_index == SRC_BUF_ID) ? MM2S_SRC_ADDR_MSB : S2MM_DEST_ADDR_MSB;
-    reg_write32(reg_map, offset, address_msb);
+    if (fd_uio < 0)
+    {
+        return -1;
+    }
+    if (write(fd_uio, &unmask, sizeof(unmask)) != (ssize_t)sizeof(unmask))
+    {
+        fprintf(stderr, "Failed to enable UIO interrupt: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
 }
 
-void setDmaTransmissionLength(volatile uint8_t const *reg_map, size_t buffer_index, uint32_t transmission_bytes)
+uint32_t getDmaStatus(volatile uint8_t *regs, size_t buffer_index)
 {
-    uint32_t offset;
-    offset = (buffer_index == SRC_BUF_ID) ? MM2S_LENGTH : S2MM_LENGTH;
-    reg_write32(reg_map, offset, transmission_bytes);
+    return reg_read32(regs, DMA_CHANNEL_REG(buffer_index, MM2S_STATUS));
 }
 
-int waitDmaTransmissionDone(volatile uint8_t *regs, size_t buffer_index, uint8_t timeout_ms)
+uint32_t ackDmaInterrupt(volatile uint8_t *regs, size_t buffer_index, uint32_t mask)
 {
-    uint32_t sr_off = (buffer_index == SRC_BUF_ID) ? MM2S_STATUS : S2MM_STATUS;
-    for (;;)
+    uint32_t sr_off = DMA_CHANNEL_REG(buffer_index, MM2S_STATUS);
+    uint32_t sr = reg_read32(regs, sr_off);
+
+    // Interrupt bits are write-1-to-clear, the rest of the register is read only
+    if (sr & mask & DMA_STATUS_IRQ_MASK)
     {
-        uint32_t sr = reg_read32(regs, sr_off);
+        reg_write32(regs, sr_off, sr & mask & DMA_STATUS_IRQ_MASK);
+    }
+    return sr;
+}
 
-        if (sr & DMA_STATUS_IDLE)
-        {
-            return DMA_RECEIVED;
-        }
-        if (sr & DMA_STATUS_ERR_IRQ)
-        {
-            fprintf(stderr, "DMA error: status @ 0x%08x = 0x%08x\n", sr_off, sr);
-            return DMA_FAILED;
-        }
-        if (timeout_ms == 0)
-        {
-            // fprintf(stderr, "Timeout waiting for DMA idle: status @ 0x%08x = 0x%08x\n", sr_off, sr);
-            return DMA_TIMEOUT;
-        }
-        // ~1ms poll interval
-        timeout_ms--;
-        sleep_ms(1);
+int waitDmaTransmissionDoneIrq(int fd_uio, volatile uint8_t *regs, size_t buffer_index, uint8_t timeout_ms)
+{
+    return wait_irq(fd_uio, regs, buffer_index, timeout_ms, NULL);
+}
+
+int waitDmaTransmission(enum DmaWaitMode mode, int fd_uio, volatile uint8_t *regs, size_t buffer_index, uint8_t timeout_ms)
+{
+    if (mode == DMA_WAIT_IRQ)
+    {
+        return waitDmaTransmissionDoneIrq(fd_uio, regs, buffer_index, timeout_ms);
+    }
+    return waitDmaTransmissionDone(regs, buffer_index, timeout_ms);
+}
+
+void initDmaWaitStrategy(struct DmaWaitStrategy *wait, enum DmaWaitMode fallback, uint32_t spin_us, uint32_t yield_us)
+{
+    memset(wait, 0, sizeof(*wait));
+    wait->fallback = fallback;
+    wait->spin_us = spin_us;
+    wait->yield_us = yield_us;
+}
+
+// Counter for a completion found spent_us into the busy-poll: the first phase with a
+// budget that had not run out yet, the fallback when both budgets are 0 or used up
+uint64_t *getDmaWaitPhaseHits(struct DmaWaitStrategy *wait, int64_t spent_us)
+{
+    if (wait->spin_us > 0 && spent_us < (int64_t)wait->spin_us)
+    {
+        return &wait->spin_hits;
+    }
+    if (wait->yield_us > 0 && spent_us < (int64_t)wait->spin_us + wait->yield_us)
+    {
+        return &wait->yield_hits;
+    }
+    return &wait->fallback_hits;
+}
+
+int waitDmaTransmissionAdaptive(struct DmaWaitStrategy *wait, int fd_uio, volatile uint8_t *regs, size_t buffer_index, uint8_t timeout_ms)
+{
+    return wait_adaptive(wait, fd_uio, regs, buffer_index, timeout_ms, NULL);
+}
+
+void printDmaWaitStats(const struct DmaWaitStrategy *wait)
+{
+    printf("DMA wait: spin %" PRIu64 ", yield %" PRIu64 ", %s %" PRIu64 ", timeouts %" PRIu64 " (spin %u us, yield %u us)\n",
+           wait->spin_hits, wait->yield_hits, (wait->fallback == DMA_WAIT_IRQ) ? "irq" : "sleep", wait->fallback_hits,
+           wait->timeouts, wait->spin_us, wait->yield_us);
+}
+
+int initDmaSgRing(struct DmaSgRing *ring, size_t buffer_index, void *desc_mem, uint64_t phy_desc_mem, size_t desc_mem_bytes)
+{
+    size_t count = desc_mem_bytes / sizeof(struct DmaSgDescriptor);
+
+    if ((phy_desc_mem % DMA_SG_DESC_ALIGN) != 0 || ((uintptr_t)desc_mem % DMA_SG_DESC_ALIGN) != 0)
+    {
+        fprintf(stderr, "SG descriptors must be %d byte aligned (phys 0x%016" PRIx64 ")\n", DMA_SG_DESC_ALIGN, phy_desc_mem);
+        return -1;
+    }
+    if (count < 2)
+    {
+        fprintf(stderr, "SG ring needs at least 2 descriptors, got %zu B\n", desc_mem_bytes);
+        return -1;
+    }
+
+    ring->desc = (volatile struct DmaSgDescriptor *)desc_mem;
+    ring->phy_desc = phy_desc_mem;
+    ring->count = count;
+    ring->buffer_index = buffer_index;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->in_flight = 0;
+    ring->pending = 0;
+    ring->trace = NULL;
+
+    // Chain the descriptors into a ring, the engine follows NXTDESC and stops at TAILDESC
+    for (size_t i = 0; i < count; i++)
+    {
+        uint64_t next = phy_desc_mem + ((i + 1) % count) * sizeof(struct DmaSgDescriptor);
+
+        memset((void *)&ring->desc[i], 0, sizeof(struct DmaSgDescriptor));
+        ring->desc[i].next_desc = (uint32_t)(next & 0xFFFFFFFF);
+        ring->desc[i].next_desc_msb = (uint32_t)(next >> 32);
+    }
+    return 0;
+}
+
+int startDmaSgChannel(volatile uint8_t *regs, struct DmaSgRing *ring, uint8_t irq_threshold)
+{
+    uint32_t cr_off = DMA_CHANNEL_REG(ring->buffer_index, MM2S_CRTL);
+    uint32_t sr_off = DMA_CHANNEL_REG(ring->buffer_index, MM2S_STATUS);
+    uint32_t cd_off = DMA_CHANNEL_REG(ring->buffer_index, MM2S_CURDESC);
+    uint64_t first = ring->phy_desc + ring->tail * sizeof(struct DmaSgDescriptor);
+
+    if (!(reg_read32(regs, sr_off) & DMA_STATUS_SG_INCLD))
+    {
+        fprintf(stderr, "AXI DMA was built without scatter-gather support\n");
+        return -1;
+    }
+    if (irq_threshold == 0)
+    {
+        irq_threshold = 1;
     }
+
+    // CURDESC is only writable while the channel is halted
+    reg_write32(regs, cd_off, (uint32_t)(first & 0xFFFFFFFF));
+    reg_write32(regs, cd_off + 4, (uint32_t)(first >> 32));
+    reg_write32(regs, cr_off, DMA_CRTL_RUN_STOP | DMA_CTRL_EN_IRQ | ((uint32_t)irq_threshold << DMA_CRTL_IRQ_THRESHOLD_SHIFT));
+    return 0;
+}
+
+// `packet` is SOF/EOF for MM2S, S2MM ignores these bits
+static int queue_sg_descriptor(struct DmaSgRing *ring, uint64_t phy_address, uint32_t transmission_bytes, uint32_t packet)
+{
+    volatile struct DmaSgDescriptor *d;
+
+    if (ring->in_flight + ring->pending >= ring->count)
+    {
+        return -1;
+    }
+    if (transmission_bytes == 0 || transmission_bytes > DMA_SG_LENGTH_MASK)
+    {
+        fprintf(stderr, "SG transfer of %u B does not fit a descriptor\n", transmission_bytes);
+        return -1;
+    }
+
+    d = &ring->desc[ring->head];
+    d->buffer_addr = (uint32_t)(phy_address & 0xFFFFFFFF);
+    d->buffer_addr_msb = (uint32_t)(phy_address >> 32);
+    d->control = transmission_bytes | ((ring->buffer_index == SRC_BUF_ID) ? packet : 0);
+    // A descriptor fetched with Cmplt still set is reported as an SG internal error
+    d->status = 0;
+
+    ring->head = (ring->head + 1) % ring->count;
+    ring->pending++;
+    return 0;
+}
+
+int queueDmaSgTransfer(struct DmaSgRing *ring, uint64_t phy_address, uint32_t transmission_bytes)
+{
+    // Every MM2S descriptor is a whole packet, like a simple mode transfer
+    return queue_sg_descriptor(ring, phy_address, transmission_bytes, DMA_SG_CTRL_SOF | DMA_SG_CTRL_EOF);
+}
+
+void submitDmaSgTransfers(volatile uint8_t *regs, struct DmaSgRing *ring)
+{
+    uint32_t td_off = DMA_CHANNEL_REG(ring->buffer_index, MM2S_TAILDESC);
+    size_t last = (ring->head + ring->count - 1) % ring->count;
+    uint64_t tail = ring->phy_desc + last * sizeof(struct DmaSgDescriptor);
+
+    if (ring->pending == 0)
+    {
+        return;
+    }
+    if (ring->trace != NULL)
+    {
+        for (size_t i = 0; i < ring->pending; i++)
+        {
+            size_t slot = (ring->head + ring->count - ring->pending + i) % ring->count;
+            traceDmaSubmit(ring->trace, ring->buffer_index, (uint16_t)slot, ring->desc[slot].control & DMA_SG_LENGTH_MASK);
+        }
+    }
+
+    // Writing the low word of TAILDESC is what kicks the engine, so the high word goes first
+    reg_write32(regs, td_off + 4, (uint32_t)(tail >> 32));
+    reg_write32(regs, td_off, (uint32_t)(tail & 0xFFFFFFFF));
+    ring->in_flight += ring->pending;
+    ring->pending = 0;
+}
+
+int reapDmaSgTransfers(struct DmaSgRing *ring, uint32_t *transferred_bytes, size_t max_transfers)
+{
+    size_t reaped = 0;
+
+    while (ring->in_flight > 0 && reaped < max_transfers)
+    {
+        volatile struct DmaSgDescriptor *d = &ring->desc[ring->tail];
+        uint32_t status = d->status;
+
+        if (!(status & DMA_SG_STATUS_CMPLT))
+        {
+            break;
+        }
+        if (status & DMA_SG_STATUS_ERR_MASK)
+        {
+            fprintf(stderr, "DMA SG error: descriptor %zu status = 0x%08x\n", ring->tail, status);
+            return -1;
+        }
+        if (transferred_bytes != NULL)
+        {
+            transferred_bytes[reaped] = status & DMA_SG_LENGTH_MASK;
+        }
+        traceDmaComplete(ring->trace, ring->buffer_index, (uint16_t)ring->tail, DMA_RECEIVED);
+
+        ring->tail = (ring->tail + 1) % ring->count;
+        ring->in_flight--;
+        reaped++;
+    }
+    return (int)reaped;
+}
+
+// Buffer a descriptor of the ring points at, e.g. to tell which slot a reaped one filled
+uint64_t getDmaSgBufferAddress(const struct DmaSgRing *ring, size_t desc)
+{
+    return ((uint64_t)ring->desc[desc].buffer_addr_msb << 32) | ring->desc[desc].buffer_addr;
+}
+
+int waitDmaSgTransfer(enum DmaWaitMode mode, int fd_uio, volatile uint8_t *regs, const struct DmaSgRing *ring, uint8_t timeout_ms)
+{
+    const volatile struct DmaSgDescriptor *desc = &ring->desc[ring->tail];
+
+    if (ring->in_flight == 0)
+    {
+        return DMA_TIMEOUT;
+    }
+    if (mode == DMA_WAIT_IRQ)
+    {
+        return wait_irq(fd_uio, regs, ring->buffer_index, timeout_ms, desc);
+    }
+    return wait_poll(regs, ring->buffer_index, timeout_ms, desc);
+}
+
+int waitDmaSgTransferAdaptive(struct DmaWaitStrategy *wait, int fd_uio, volatile uint8_t *regs, const struct DmaSgRing *ring, uint8_t timeout_ms)
+{
+    if (ring->in_flight == 0)
+    {
+        return DMA_TIMEOUT;
+    }
+    return wait_adaptive(wait, fd_uio, regs, ring->buffer_index, timeout_ms, &ring->desc[ring->tail]);
+}
+
+int startDmaCyclicReceive(volatile uint8_t *regs, struct DmaSgRing *ring, uint64_t phy_address, uint32_t slot_bytes, size_t slots)
+{
+    uint64_t outside_chain;
+
+    if (slots < 2 || slots > ring->count)
+    {
+        fprintf(stderr, "Cyclic ring needs between 2 and %zu slots, got %zu\n", ring->count, slots);
+        return -1;
+    }
+
+    // Shrink the chain to exactly one descriptor per slot
+    ring->count = slots;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->in_flight = 0;
+    ring->pending = 0;
+    ring->desc[slots - 1].next_desc = (uint32_t)(ring->phy_desc & 0xFFFFFFFF);
+    ring->desc[slots - 1].next_desc_msb = (uint32_t)(ring->phy_desc >> 32);
+    for (size_t i = 0; i < slots; i++)
+    {
+        if (queueDmaSgTransfer(ring, phy_address + i * slot_bytes, slot_bytes) != 0)
+        {
+            return -1;
+        }
+    }
+
+    if (startDmaSgChannel(regs, ring, 1) != 0)
+    {
+        return -1;
+    }
+    uint32_t cr_off = DMA_CHANNEL_REG(ring->buffer_index, MM2S_CRTL);
+    reg_write32(regs, cr_off, reg_read32(regs, cr_off) | DMA_CRTL_CYCLIC);
+
+    // In cyclic mode TAILDESC only starts the engine and must point outside the chain
+    outside_chain = ring->phy_desc + slots * sizeof(struct DmaSgDescriptor);
+    uint32_t td_off = DMA_CHANNEL_REG(ring->buffer_index, MM2S_TAILDESC);
+    reg_write32(regs, td_off + 4, (uint32_t)(outside_chain >> 32));
+    reg_write32(regs, td_off, (uint32_t)(outside_chain & 0xFFFFFFFF));
+    ring->in_flight = slots;
+    ring->pending = 0;
+    for (size_t slot = 0; slot < slots; slot++)
+    {
+        traceDmaSubmit(ring->trace, ring->buffer_index, (uint16_t)slot, slot_bytes);
+    }
+    return 0;
+}
+
+int nextDmaCyclicSlot(struct DmaSgRing *ring, uint32_t *transferred_bytes)
+{
+    volatile struct DmaSgDescriptor *d = &ring->desc[ring->tail];
+    uint32_t status = d->status;
+    int slot = (int)ring->tail;
+
+    if (!(status & DMA_SG_STATUS_CMPLT))
+    {
+        return -1;
+    }
+    if (transferred_bytes != NULL)
+    {
+        *transferred_bytes = status & DMA_SG_LENGTH_MASK;
+    }
+
+    // The engine ignores Cmplt on its next lap, clearing it lets us spot the next fill
+    d->status = 0;
+    ring->tail = (ring->tail + 1) % ring->count;
+    // From here on the slot is the hardware's again, that counts as its next submit
+    traceDmaComplete(ring->trace, ring->buffer_index, (uint16_t)slot,
+                     (status & DMA_SG_STATUS_ERR_MASK) ? DMA_FAILED : DMA_RECEIVED);
+    traceDmaSubmit(ring->trace, ring->buffer_index, (uint16_t)slot, d->control & DMA_SG_LENGTH_MASK);
+
+    if (status & DMA_SG_STATUS_ERR_MASK)
+    {
+        fprintf(stderr, "DMA cyclic error: slot %d status = 0x%08x\n", slot, status);
+        return -2;
+    }
+    return slot;
+}
+
+// Restart an SG ring after a reset at its first unfinished descriptor. Descriptors
+// that completed cleanly before the error are left for the caller to reap.
+static int rearm_sg_ring(volatile uint8_t *regs, struct DmaSgRing *ring)
+{
+    size_t done = 0;
+
+    while (done < ring->in_flight)
+    {
+        uint32_t status = ring->desc[(ring->tail + done) % ring->count].status;
+        if (!(status & DMA_SG_STATUS_CMPLT) || (status & DMA_SG_STATUS_ERR_MASK))
+        {
+            break;
+        }
+        done++;
+    }
+    for (size_t i = done; i < ring->in_flight + ring->pending; i++)
+    {
+        if (i < ring->in_flight)
+        {
+            traceDmaComplete(ring->trace, ring->buffer_index, (uint16_t)((ring->tail + i) % ring->count), DMA_FAILED);
+        }
+        ring->desc[(ring->tail + i) % ring->count].status = 0;
+    }
+
+    // Point CURDESC at the first unfinished descriptor, then let submit re-send the tail
+    size_t saved_tail = ring->tail;
+    size_t redo = ring->in_flight - done;
+    ring->tail = (ring->tail + done) % ring->count;
+    int r = startDmaSgChannel(regs, ring, 1);
+    ring->tail = saved_tail;
+    if (r != 0)
+    {
+        return -1;
+    }
+    if (redo > 0)
+    {
+        ring->in_flight -= redo;
+        ring->pending += redo;
+        // Hand the unfinished descriptors back, with any the caller queued but had not submitted
+        submitDmaSgTransfers(regs, ring);
+    }
+    return 0;
+}
+
+static void count_errors(struct DmaRecovery *recovery, size_t buffer_index)
+{
+    size_t ch = (buffer_index == SRC_BUF_ID) ? 0 : 1;
+    struct DmaRecoveryStats *stats = &recovery->stats;
+    uint32_t sr = getDmaStatus(recovery->regs, buffer_index);
+
+    // A channel that was never started reports halted as well, that is not a fault
+    if (!recovery->active[ch])
+    {
+        return;
+    }
+
+    if (sr & DMA_STATUS_INT_ERR)
+        stats->int_err[ch]++;
+    if (sr & DMA_STATUS_SLV_ERR)
+        stats->slv_err[ch]++;
+    if (sr & DMA_STATUS_DEC_ERR)
+        stats->dec_err[ch]++;
+    if (sr & (DMA_STATUS_SG_INT_ERR | DMA_STATUS_SG_SLV_ERR | DMA_STATUS_SG_DEC_ERR))
+        stats->sg_err[ch]++;
+    if (sr & DMA_STATUS_HALTED)
+        stats->halted[ch]++;
+
+    if (sr & (DMA_STATUS_ERR_MASK | DMA_STATUS_HALTED))
+    {
+        fprintf(stderr, "DMA %s status 0x%08x:%s%s%s%s%s%s%s\n", (ch == 0) ? "MM2S" : "S2MM", sr,
+                (sr & DMA_STATUS_HALTED) ? " halted" : "",
+                (sr & DMA_STATUS_INT_ERR) ? " DMAIntErr" : "",
+                (sr & DMA_STATUS_SLV_ERR) ? " DMASlvErr" : "",
+                (sr & DMA_STATUS_DEC_ERR) ? " DMADecErr" : "",
+                (sr & DMA_STATUS_SG_INT_ERR) ? " SGIntErr" : "",
+                (sr & DMA_STATUS_SG_SLV_ERR) ? " SGSlvErr" : "",
+                (sr & DMA_STATUS_SG_DEC_ERR) ? " SGDecErr" : "");
+    }
+}
+
+void initDmaRecovery(struct DmaRecovery *recovery, volatile uint8_t *regs)
+{
+    memset(recovery, 0, sizeof(*recovery));
+    recovery->regs = regs;
+}
+
+void attachDmaRecoveryRing(struct DmaRecovery *recovery, struct DmaSgRing *ring, bool cyclic)
+{
+    size_t ch = (ring->buffer_index == SRC_BUF_ID) ? 0 : 1;
+
+    recovery->ring[ch] = ring;
+    recovery->cyclic[ch] = cyclic;
+    recovery->active[ch] = true;
+}
+
+void issueDmaTransfer(struct DmaRecovery *recovery, size_t buffer_index, uint64_t phy_address, uint32_t transmission_bytes)
+{
+    size_t ch = (buffer_index == SRC_BUF_ID) ? 0 : 1;
+
+    recovery->address[ch] = phy_address;
+    recovery->length[ch] = transmission_bytes;
+    recovery->outstanding[ch] = true;
+    recovery->active[ch] = true;
+    traceDmaSubmit(recovery->trace, buffer_index, recovery->sequence[ch], transmission_bytes);
+    setDmaChannelAddress(recovery->regs, buffer_index, phy_address);
+    setDmaTransmissionLength(recovery->regs, buffer_index, transmission_bytes);
+}
+
+void completeDmaTransfer(struct DmaRecovery *recovery, size_t buffer_index)
+{
+    size_t ch = (buffer_index == SRC_BUF_ID) ? 0 : 1;
+
+    if (!recovery->outstanding[ch])
+    {
+        return;
+    }
+    traceDmaComplete(recovery->trace, buffer_index, recovery->sequence[ch]++, DMA_RECEIVED);
+    recovery->outstanding[ch] = false;
+}
+
+// The reset stops both channels, also one that was started but has nothing issued yet
+static void mark_running(struct DmaRecovery *recovery)
+{
+    for (size_t ch = 0; ch < 2; ch++)
+    {
+        if (reg_read32(recovery->regs, DMA_CHANNEL_REG(ch == 0 ? SRC_BUF_ID : DEST_BUF_ID, MM2S_CRTL)) & DMA_CRTL_RUN_STOP)
+        {
+            recovery->active[ch] = true;
+        }
+    }
+}
+
+// Soft reset the engine and restart the channels that were running, re-issuing what
+// they had outstanding
+static int restart_dma(struct DmaRecovery *recovery)
+{
+    volatile uint8_t *regs = recovery->regs;
+    int waited_ms;
+
+    mark_running(recovery);
+    // Soft reset clears the error state of both channels, the bit self-clears once done
+    resetDmaChannel(regs, SRC_BUF_ID);
+    for (waited_ms = 0; waited_ms < 10; waited_ms++)
+    {
+        if (!(reg_read32(regs, MM2S_CRTL) & DMA_CRTL_RESET) && !(reg_read32(regs, S2MM_CRTL) & DMA_CRTL_RESET))
+        {
+            break;
+        }
+        sleep_ms(1);
+    }
+    if (waited_ms == 10)
+    {
+        fprintf(stderr, "DMA reset did not complete, streams may be stalled\n");
+        recovery->stats.failed_recoveries++;
+        return -1;
+    }
+
+    // Receive side first so nothing the transmitter sends is lost
+    const size_t order[2] = {DEST_BUF_ID, SRC_BUF_ID};
+    for (size_t i = 0; i < 2; i++)
+    {
+        size_t buffer_index = order[i];
+        size_t ch = (buffer_index == SRC_BUF_ID) ? 0 : 1;
+        struct DmaSgRing *ring = recovery->ring[ch];
+        int r = 0;
+
+        if (!recovery->active[ch])
+        {
+            continue;
+        }
+        if (ring != NULL && recovery->cyclic[ch])
+        {
+            r = startDmaCyclicReceive(regs, ring, getDmaSgBufferAddress(ring, 0), ring->desc[0].control & DMA_SG_LENGTH_MASK, ring->count);
+        }
+        else if (ring != NULL)
+        {
+            r = rearm_sg_ring(regs, ring);
+        }
+        else
+        {
+            startDmaChannel(regs, buffer_index);
+            if (recovery->outstanding[ch])
+            {
+                traceDmaComplete(recovery->trace, buffer_index, recovery->sequence[ch]++, DMA_FAILED);
+                traceDmaSubmit(recovery->trace, buffer_index, recovery->sequence[ch], recovery->length[ch]);
+                setDmaChannelAddress(regs, buffer_index, recovery->address[ch]);
+                setDmaTransmissionLength(regs, buffer_index, recovery->length[ch]);
+            }
+        }
+        if (r != 0)
+        {
+            recovery->stats.failed_recoveries++;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int recoverDma(struct DmaRecovery *recovery)
+{
+    mark_running(recovery);
+    count_errors(recovery, SRC_BUF_ID);
+    count_errors(recovery, DEST_BUF_ID);
+
+    if (restart_dma(recovery) != 0)
+    {
+        return -1;
+    }
+    recovery->stats.recoveries++;
+    fprintf(stderr, "DMA recovered (%" PRIu64 " recoveries so far)\n", recovery->stats.recoveries);
+    return 0;
+}
+
+void printDmaRecoveryStats(const struct DmaRecovery *recovery)
+{
+    const struct DmaRecoveryStats *stats = &recovery->stats;
+
+    printf("DMA recoveries: %" PRIu64 " ok, %" PRIu64 " failed\n", stats->recoveries, stats->failed_recoveries);
+    for (size_t ch = 0; ch < 2; ch++)
+    {
+        printf("  %s: DMAIntErr %" PRIu64 ", DMASlvErr %" PRIu64 ", DMADecErr %" PRIu64 ", SG errors %" PRIu64 ", halted %" PRIu64 "\n",
+               (ch == 0) ? "MM2S" : "S2MM", stats->int_err[ch], stats->slv_err[ch], stats->dec_err[ch],
+               stats->sg_err[ch], stats->halted[ch]);
+    }
+}
+
+int getDmaLengthWidth(const char *uio_dev, uint8_t *width)
+{
+#ifdef DMA_SIM
+    (void)uio_dev;
+    *width = simDmaLengthWidth();
+    return 0;
+#else
+    char path[160];
+    const char *name = strrchr(uio_dev, '/');
+    uint8_t cell[4];
+    uint32_t value;
+
+    // Device tree cells are big endian, the property is xlnx,sg-length-width of the DMA node
+    snprintf(path, sizeof(path), "/sys/class/uio/%s/device/of_node/xlnx,sg-length-width", (name != NULL) ? name + 1 : uio_dev);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    ssize_t n = read(fd, cell, sizeof(cell));
+    close(fd);
+    if (n != (ssize_t)sizeof(cell))
+    {
+        return -1;
+    }
+    value = ((uint32_t)cell[0] << 24) | ((uint32_t)cell[1] << 16) | ((uint32_t)cell[2] << 8) | cell[3];
+    if (value < DMA_LENGTH_WIDTH_MIN || value > DMA_LENGTH_WIDTH_MAX)
+    {
+        fprintf(stderr, "%s: length width %u out of range\n", path, value);
+        return -1;
+    }
+    *width = (uint8_t)value;
+    return 0;
+#endif
+}
+
+uint32_t getDmaMaxSegment(uint8_t length_width)
+{
+    if (length_width < DMA_LENGTH_WIDTH_MIN)
+    {
+        length_width = DMA_LENGTH_WIDTH_MIN;
+    }
+    if (length_width > DMA_LENGTH_WIDTH_MAX)
+    {
+        length_width = DMA_LENGTH_WIDTH_MAX;
+    }
+    return ((1u << length_width) - 1) & ~(uint32_t)(DMA_SEGMENT_ALIGN - 1);
+}
+
+static uint32_t next_segment(const struct DmaLargeTransfer *xfer)
+{
+    uint64_t left = xfer->length - xfer->issued;
+    return (left > xfer->max_segment) ? xfer->max_segment : (uint32_t)left;
+}
+
+static void issue_segments(struct DmaLargeTransfer *xfer)
+{
+    struct DmaSgRing *ring = xfer->ring;
+
+    if (xfer->finished)
+    {
+        return;
+    }
+    if (ring == NULL)
+    {
+        if (xfer->segment_length == 0 && xfer->issued < xfer->length)
+        {
+            xfer->segment_length = next_segment(xfer);
+            issueDmaTransfer(xfer->recovery, xfer->buffer_index, xfer->phy_address + xfer->issued, xfer->segment_length);
+            xfer->issued += xfer->segment_length;
+        }
+        return;
+    }
+
+    while (xfer->issued < xfer->length)
+    {
+        uint32_t len = next_segment(xfer);
+        uint32_t packet = 0;
+
+        // One packet for the whole transfer, not one per segment
+        if (xfer->issued == 0)
+            packet |= DMA_SG_CTRL_SOF;
+        if (xfer->issued + len == xfer->length)
+            packet |= DMA_SG_CTRL_EOF;
+        if (queue_sg_descriptor(ring, xfer->phy_address + xfer->issued, len, packet) != 0)
+        {
+            break;
+        }
+        xfer->issued += len;
+    }
+    submitDmaSgTransfers(xfer->recovery->regs, ring);
+}
+
+// After an early TLAST the descriptors queued behind it are still the engine's, they
+// would take the start of the next packet. The only way to get them back is a reset,
+// which also restarts MM2S from its first unfinished transfer like after an error.
+static int drop_sg_segments(struct DmaLargeTransfer *xfer)
+{
+    struct DmaSgRing *ring = xfer->ring;
+
+    if (ring->in_flight == 0)
+    {
+        return 0;
+    }
+    for (size_t i = 0; i < ring->in_flight; i++)
+    {
+        size_t desc = (ring->tail + i) % ring->count;
+        traceDmaComplete(ring->trace, ring->buffer_index, (uint16_t)desc, DMA_FAILED);
+        ring->desc[desc].status = 0;
+    }
+    ring->head = ring->tail;
+    ring->in_flight = 0;
+    return restart_dma(xfer->recovery);
+}
+
+int startDmaLargeTransfer(struct DmaLargeTransfer *xfer, struct DmaRecovery *recovery, struct DmaSgRing *ring, size_t buffer_index,
+                          uint64_t phy_address, uint64_t length, uint32_t max_segment)
+{
+    memset(xfer, 0, sizeof(*xfer));
+    if (max_segment > DMA_SG_LENGTH_MASK)
+    {
+        max_segment = DMA_SG_LENGTH_MASK;
+    }
+    max_segment &= ~(uint32_t)(DMA_SEGMENT_ALIGN - 1);
+    if (length == 0 || max_segment == 0)
+    {
+        fprintf(stderr, "Large DMA transfer of %" PRIu64 " B with %u B segments is not possible\n", length, max_segment);
+        return -1;
+    }
+    if (ring != NULL && (ring->buffer_index != buffer_index || ring->in_flight + ring->pending > 0))
+    {
+        fprintf(stderr, "Large DMA transfer needs an idle descriptor ring of its own channel\n");
+        return -1;
+    }
+
+    // The ring has to be restarted after a reset, see drop_sg_segments()
+    if (ring != NULL)
+    {
+        attachDmaRecoveryRing(recovery, ring, false);
+    }
+    xfer->recovery = recovery;
+    xfer->ring = ring;
+    xfer->buffer_index = buffer_index;
+    xfer->max_segment = max_segment;
+    xfer->phy_address = phy_address;
+    xfer->length = length;
+    issue_segments(xfer);
+    return 0;
+}
+
+int advanceDmaLargeTransfer(struct DmaLargeTransfer *xfer)
+{
+    volatile uint8_t *regs = xfer->recovery->regs;
+
+    if (xfer->ring == NULL)
+    {
+        if (xfer->segment_length > 0)
+        {
+            uint32_t sr = getDmaStatus(regs, xfer->buffer_index);
+            uint32_t bytes = xfer->segment_length;
+
+            if (sr & DMA_STATUS_ERR_IRQ)
+            {
+                return DMA_FAILED;
+            }
+            if (!(sr & DMA_STATUS_IDLE))
+            {
+                return DMA_TIMEOUT;
+            }
+            // S2MM_LENGTH reads back what was written, less than asked for if TLAST came early
+            if (xfer->buffer_index != SRC_BUF_ID)
+            {
+                bytes = reg_read32(regs, S2MM_LENGTH);
+                xfer->finished = (bytes < xfer->segment_length);
+            }
+            completeDmaTransfer(xfer->recovery, xfer->buffer_index);
+            xfer->done += bytes;
+            xfer->segments++;
+            xfer->segment_length = 0;
+        }
+        issue_segments(xfer);
+        return (xfer->segment_length == 0) ? DMA_RECEIVED : DMA_TIMEOUT;
+    }
+
+    while (!xfer->finished)
+    {
+        size_t desc = xfer->ring->tail;
+        uint32_t bytes;
+        int reaped = reapDmaSgTransfers(xfer->ring, &bytes, 1);
+
+        if (reaped < 0)
+        {
+            return DMA_FAILED;
+        }
+        if (reaped == 0)
+        {
+            break;
+        }
+        xfer->done += bytes;
+        xfer->segments++;
+        // S2MM marks the descriptor TLAST arrived in, the packet is over even if segments are left
+        if (xfer->buffer_index != SRC_BUF_ID && (xfer->ring->desc[desc].status & DMA_SG_STATUS_RXEOF) && xfer->done < xfer->length)
+        {
+            xfer->finished = true;
+            if (drop_sg_segments(xfer) != 0)
+            {
+                return DMA_FAILED;
+            }
+        }
+    }
+    issue_segments(xfer);
+    return (xfer->ring->in_flight == 0) ? DMA_RECEIVED : DMA_TIMEOUT;
+}
+
+int waitDmaLargeTransfer(struct DmaWaitStrategy *wait, int fd_uio, struct DmaLargeTransfer *xfer, uint8_t timeout_ms)
+{
+    volatile uint8_t *regs = xfer->recovery->regs;
+
+    // The timeout applies to each segment, not to the whole transfer
+    for (;;)
+    {
+        int r = advanceDmaLargeTransfer(xfer);
+        if (r != DMA_TIMEOUT)
+        {
+            return r;
+        }
+        if (xfer->ring != NULL)
+        {
+            r = waitDmaSgTransferAdaptive(wait, fd_uio, regs, xfer->ring, timeout_ms);
+        }
+        else
+        {
+            r = waitDmaTransmissionAdaptive(wait, fd_uio, regs, xfer->buffer_index, timeout_ms);
+        }
+        if (r != DMA_RECEIVED)
+        {
+            return r;
+        }
+    }
+}
+
+int initDmaTrace(struct DmaTrace *trace, size_t depth)
+{
+    memset(trace, 0, sizeof(*trace));
+    if (depth == 0 || (depth & (depth - 1)) != 0)
+    {
+        fprintf(stderr, "DMA trace depth must be a power of two, got %zu\n", depth);
+        return -1;
+    }
+    trace->record = calloc(depth, sizeof(struct DmaTraceRecord));
+    if (trace->record == NULL)
+    {
+        fprintf(stderr, "Failed to allocate a DMA trace of %zu records\n", depth);
+        return -1;
+    }
+    trace->depth = depth;
+    return 0;
+}
+
+void freeDmaTrace(struct DmaTrace *trace)
+{
+    free(trace->record);
+    trace->record = NULL;
+    trace->depth = 0;
+}
+
+void traceDmaSubmit(struct DmaTrace *trace, size_t buffer_index, uint16_t slot, uint32_t length)
+{
+    size_t ch = (buffer_index == SRC_BUF_ID) ? 0 : 1;
+
+    if (trace == NULL)
+    {
+        return;
+    }
+    trace->submit_ns[ch][slot % DMA_TRACE_SLOTS] = raw_ns();
+    trace->length[ch][slot % DMA_TRACE_SLOTS] = length;
+}
+
+void traceDmaComplete(struct DmaTrace *trace, size_t buffer_index, uint16_t slot, int status)
+{
+    size_t ch = (buffer_index == SRC_BUF_ID) ? 0 : 1;
+
+    if (trace == NULL)
+    {
+        return;
+    }
+    struct DmaTraceRecord *r = &trace->record[trace->head & (trace->depth - 1)];
+
+    r->complete_ns = raw_ns();
+    r->submit_ns = trace->submit_ns[ch][slot % DMA_TRACE_SLOTS];
+    r->length = trace->length[ch][slot % DMA_TRACE_SLOTS];
+    r->slot = slot;
+    r->channel = (uint8_t)ch;
+    r->status = (uint8_t)status;
+    // A slot is only ever completed once per submit
+    trace->submit_ns[ch][slot % DMA_TRACE_SLOTS] = 0;
+    trace->head++;
+}
+
+int dumpDmaTrace(struct DmaTrace *trace, const char *path)
+{
+    struct DmaTraceFileHeader header = {.magic = DMA_TRACE_MAGIC,
+                                        .version = DMA_TRACE_VERSION,
+                                        .record_size = sizeof(struct DmaTraceRecord)};
+    uint64_t head = trace->head;
+    uint64_t first = (head > trace->depth) ? head - trace->depth : 0;
+    FILE *f;
+
+    header.records = head - first;
+    header.overwritten = first;
+
+    f = fopen(path, "wb");
+    if (f == NULL)
+    {
+        fprintf(stderr, "fopen(%s): %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (fwrite(&header, sizeof(header), 1, f) != 1)
+    {
+        fprintf(stderr, "Failed to write DMA trace header to %s\n", path);
+        fclose(f);
+        return -1;
+    }
+    // Oldest first. The ring may wrap, so this takes at most two writes.
+    for (uint64_t i = first; i < head;)
+    {
+        size_t start = i & (trace->depth - 1);
+        size_t n = trace->depth - start;
+        if (n > head - i)
+        {
+            n = head - i;
+        }
+        if (fwrite(&trace->record[start], sizeof(struct DmaTraceRecord), n, f) != n)
+        {
+            fprintf(stderr, "Failed to write DMA trace to %s\n", path);
+            fclose(f);
+            return -1;
+        }
+        i += n;
+    }
+    fclose(f);
+    printf("DMA trace: %" PRIu64 " records written to %s (%" PRIu64 " overwritten)\n", header.records, path, header.overwritten);
+    return 0;
 }
@@ -12,6 +12,10 @@
 #include <unistd.h>
 #include <stdbool.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#ifdef DMA_SIM
+#include "dma-sim.h"
+#endif
 
 // Simple mode register map (Xilinx AXI DMA)
 #define MM2S_CRTL 0x00         // MM2S DMA Control
@@ -26,22 +30,60 @@
 #define S2MM_DEST_ADDR_MSB 0x4C // S2MM Dest Address (high 32)
 #define S2MM_LENGTH 0x58        // S2MM Transfer Length
 
+// Every S2MM register sits at its MM2S offset plus one bank, so the channel can be
+// picked arithmetically instead of with a branch
+#define DMA_S2MM_BANK (S2MM_CRTL - MM2S_CRTL)
+#define DMA_CHANNEL_REG(buffer_index, mm2s_offset) ((uint32_t)(mm2s_offset) + (uint32_t)((buffer_index) != SRC_BUF_ID) * DMA_S2MM_BANK)
+
+// Scatter-gather mode register map
+#define MM2S_CURDESC 0x08       // MM2S Current Descriptor Pointer (low 32, high 32 at +4)
+#define MM2S_TAILDESC 0x10      // MM2S Tail Descriptor Pointer (low 32, high 32 at +4)
+#define S2MM_CURDESC 0x38       // S2MM Current Descriptor Pointer (low 32, high 32 at +4)
+#define S2MM_TAILDESC 0x40      // S2MM Tail Descriptor Pointer (low 32, high 32 at +4)
+
 // Control bits
 #define DMA_CRTL_RUN_STOP (1 << 0) // Run/Stop
 #define DMA_CRTL_RESET (1 << 2)    // Reset
+#define DMA_CRTL_CYCLIC (1 << 4)   // Cyclic BD enable, SG mode only
 #define DMA_CTRL_EN_IRQ (0x7000)
+#define DMA_CRTL_IRQ_THRESHOLD_SHIFT 16 // Completions per IOC interrupt in SG mode
 
 // Status bits (common ones)
 #define DMA_STATUS_HALTED (1 << 0)
 #define DMA_STATUS_IDLE (1 << 1)
+#define DMA_STATUS_SG_INCLD (1 << 3) // Engine was built with scatter-gather
+#define DMA_STATUS_INT_ERR (1 << 4)    // DMAIntErr: length/TLAST mismatch inside the engine
+#define DMA_STATUS_SLV_ERR (1 << 5)    // DMASlvErr: AXI slave error on a data access
+#define DMA_STATUS_DEC_ERR (1 << 6)    // DMADecErr: data address did not decode
+#define DMA_STATUS_SG_INT_ERR (1 << 8) // SGIntErr: descriptor fetched with Cmplt set
+#define DMA_STATUS_SG_SLV_ERR (1 << 9)
+#define DMA_STATUS_SG_DEC_ERR (1 << 10)
+#define DMA_STATUS_ERR_MASK (DMA_STATUS_INT_ERR | DMA_STATUS_SLV_ERR | DMA_STATUS_DEC_ERR | \
+                             DMA_STATUS_SG_INT_ERR | DMA_STATUS_SG_SLV_ERR | DMA_STATUS_SG_DEC_ERR)
+#define DMA_STATUS_IOC_IRQ (1 << 12) // Interrupt on complete, write 1 to clear
+#define DMA_STATUS_DLY_IRQ (1 << 13) // Interrupt on delay, write 1 to clear
 #define DMA_STATUS_ERR_IRQ (1 << 14) // not exhaustive; used for quick sanity
+#define DMA_STATUS_IRQ_MASK (DMA_STATUS_IOC_IRQ | DMA_STATUS_DLY_IRQ | DMA_STATUS_ERR_IRQ)
 
 // AXI DMA device-tree node
 #define REG_MAP_SIZE 0x10000
 
+// Scatter-gather descriptor bits
+#define DMA_SG_DESC_ALIGN 64
+#define DMA_SG_LENGTH_MASK 0x03FFFFFF
+#define DMA_SG_CTRL_EOF (1 << 26)
+#define DMA_SG_CTRL_SOF (1 << 27)
+#define DMA_SG_STATUS_RXEOF (1 << 26) // S2MM: TLAST arrived in this descriptor
+#define DMA_SG_STATUS_INT_ERR (1 << 28)
+#define DMA_SG_STATUS_SLV_ERR (1 << 29)
+#define DMA_SG_STATUS_DEC_ERR (1 << 30)
+#define DMA_SG_STATUS_CMPLT (1u << 31)
+#define DMA_SG_STATUS_ERR_MASK (DMA_SG_STATUS_INT_ERR | DMA_SG_STATUS_SLV_ERR | DMA_SG_STATUS_DEC_ERR)
+
 // App specific defines
 #define SRC_BUF_ID 0
 #define DEST_BUF_ID 1
+#define DESC_BUF_ID 2
 
 enum DmaReturnValue
 {
@@ -50,12 +92,243 @@ enum DmaReturnValue
     DMA_FAILED
 };
 
+// Buffer descriptor as laid out in memory by the AXI DMA (64 B aligned)
+struct DmaSgDescriptor
+{
+    uint32_t next_desc;
+    uint32_t next_desc_msb;
+    uint32_t buffer_addr;
+    uint32_t buffer_addr_msb;
+    uint32_t reserved[2];
+    uint32_t control;
+    uint32_t status;
+    uint32_t app[5];
+    uint32_t padding[3];
+} __attribute__((aligned(DMA_SG_DESC_ALIGN)));
+
+// Per-transfer trace, kept by the thread driving the channels. Records are overwritten
+// in place once the ring wraps, so dump it only after that thread stopped.
+// Timestamps are CLOCK_MONOTONIC_RAW in ns.
+#define DMA_TRACE_SLOTS 256 // Submit timestamps remembered per channel, by slot
+#define DMA_TRACE_DEFAULT_DEPTH 65536 // Records kept, ~1.5 MB
+#define DMA_TRACE_MAGIC "DMATRACE"
+#define DMA_TRACE_VERSION 1
+
+struct DmaTraceRecord
+{
+    uint64_t submit_ns;   // 0 when the submit was not seen
+    uint64_t complete_ns; // When the completion was picked up
+    uint32_t length;
+    uint16_t slot;   // Descriptor index in SG/cyclic mode, transfer number in simple mode
+    uint8_t channel; // 0 = MM2S, 1 = S2MM
+    uint8_t status;  // enum DmaReturnValue
+};
+
+// Dump file layout: this header followed by `records` DmaTraceRecord, oldest first,
+// both in host byte order
+struct DmaTraceFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t records;
+    uint64_t overwritten; // Records lost because the ring wrapped
+};
+
+struct DmaTrace
+{
+    struct DmaTraceRecord *record;
+    size_t depth; // Power of two
+    uint64_t head; // Records ever written
+    uint64_t submit_ns[2][DMA_TRACE_SLOTS];
+    uint32_t length[2][DMA_TRACE_SLOTS];
+};
+
+// Descriptor ring of one channel. Descriptors [tail, tail + in_flight) belong to
+// the hardware, the next `pending` ones are filled but not handed over yet.
+struct DmaSgRing
+{
+    volatile struct DmaSgDescriptor *desc;
+    uint64_t phy_desc;
+    size_t count;
+    size_t buffer_index;
+    size_t head;
+    size_t tail;
+    size_t in_flight;
+    size_t pending;
+    struct DmaTrace *trace; // Optional, NULL disables tracing
+};
+
+// Error counters per channel, indexed by buffer id
+struct DmaRecoveryStats
+{
+    uint64_t int_err[2];
+    uint64_t slv_err[2];
+    uint64_t dec_err[2];
+    uint64_t sg_err[2];
+    uint64_t halted[2];
+    uint64_t recoveries;
+    uint64_t failed_recoveries;
+};
+
+// What each channel has outstanding, so it can be re-issued after a reset.
+// A soft reset of either channel resets the whole engine, so both are tracked.
+struct DmaRecovery
+{
+    volatile uint8_t *regs;
+    struct DmaSgRing *ring[2]; // NULL while the channel runs in simple mode
+    bool cyclic[2];
+    bool active[2]; // Channel has been used, only those are restarted
+    bool outstanding[2];
+    uint64_t address[2];
+    uint32_t length[2];
+    uint16_t sequence[2];   // Simple mode transfer number, used as the trace slot
+    struct DmaTrace *trace; // Optional, traces the simple mode transfers issued through here
+    struct DmaRecoveryStats stats;
+};
+
+// How completions are waited for
+enum DmaWaitMode
+{
+    DMA_WAIT_POLL, // Read the status register every ~1ms
+    DMA_WAIT_IRQ   // Block on the UIO interrupt fd, fall back to polling
+};
+
+// Adaptive busy-poll: read the status register back to back for spin_us, then keep
+// reading with sched_yield() in between for yield_us, then fall back to the ~1ms sleep
+// or the interrupt. Both budgets at 0 behaves exactly like the fallback mode.
+// The hit counters tell which phase completions are actually picked up in.
+struct DmaWaitStrategy
+{
+    enum DmaWaitMode fallback;
+    uint32_t spin_us;
+    uint32_t yield_us;
+    uint64_t spin_hits;
+    uint64_t yield_hits;
+    uint64_t fallback_hits;
+    uint64_t timeouts;
+};
+
+// Transfers longer than the buffer length register, split into segments of at most
+// max_segment bytes that are issued back to back. In SG mode all segments that fit
+// the ring are queued at once and MM2S sends them as a single packet. In simple mode
+// the next segment is issued as soon as the previous one completes, each one ends
+// with TLAST on MM2S. An S2MM segment ends early if TLAST arrives, `done` counts what
+// was really written. In SG mode the segments still queued behind it are taken back
+// with an engine reset.
+#define DMA_LENGTH_WIDTH_MIN 8
+#define DMA_LENGTH_WIDTH_MAX 26
+#define DMA_LENGTH_WIDTH_DEFAULT 14 // Vivado default for "Width of Buffer Length Register"
+#define DMA_SEGMENT_ALIGN 64        // Keeps every segment aligned for streams up to 512 bit without DRE
+
+struct DmaLargeTransfer
+{
+    struct DmaRecovery *recovery; // Registers, and the simple mode re-issue after an error
+    struct DmaSgRing *ring;       // NULL for simple mode
+    size_t buffer_index;
+    uint32_t max_segment;
+    uint64_t phy_address;
+    uint64_t length;
+    uint64_t issued; // Bytes handed to the engine
+    uint64_t done;   // Bytes the engine reported back
+    uint32_t segment_length; // Simple mode segment in flight, 0 if none
+    uint32_t segments;       // Segments completed
+    bool finished;           // S2MM packet ended before `length`
+};
+
+// Cache maintenance direction, as in the kernel DMA API
+enum DmaSyncDirection
+{
+    DMA_SYNC_BIDIRECTIONAL,
+    DMA_SYNC_TO_DEVICE,
+    DMA_SYNC_FROM_DEVICE
+};
+
+// Open and map /dev/udmabufN and /dev/uioN, or their simulated stand-ins in a DMA_SIM build
+int openDmaDevice(const char *path, int flags);
+void *mapDmaDevice(int fd, size_t length);
 int getPhyAddr(size_t buffer_index, uint64_t *phy_src_addr);
 int getBufSize(size_t buffer_index, uint32_t *size_src_buf);
+int getPhyAddrByName(const char *device_name, uint64_t *phy_addr);
+int getBufSizeByName(const char *device_name, uint32_t *size);
+// Cacheable buffer mappings. Switch before mapping, then bracket every CPU access
+// with a sync of just the range touched: ForDevice after the CPU wrote what the DMA
+// will read, ForCpu after the DMA wrote what the CPU will read.
+int setDmaBufferCached(size_t buffer_index, bool cached);
+int setDmaBufferCachedByName(const char *device_name, bool cached);
+int syncDmaBufferForCpu(int fd_buf, uint64_t offset, uint32_t size, enum DmaSyncDirection direction);
+int syncDmaBufferForDevice(int fd_buf, uint64_t offset, uint32_t size, enum DmaSyncDirection direction);
 void resetDmaChannel(volatile uint8_t const *reg_map, size_t buffer_index);
 void startDmaChannel(volatile uint8_t const *reg_map, size_t buffer_index);
-void setDmaChannelAddress(volatile uint8_t const *reg_map, size_t buffer_index, uint64_t phy_address);
-void setDmaTransmissionLength(volatile uint8_t const *reg_map, size_t buffer_index, uint32_t transmission_bytes);
+
+// Per-transfer hot path. Inlined so a constant buffer index folds into the register
+// offset and each call is just the MMIO stores.
+static inline void setDmaChannelAddress(volatile uint8_t const *reg_map, size_t buffer_index, uint64_t phy_address)
+{
+    volatile uint32_t *addr = (volatile uint32_t *)(reg_map + DMA_CHANNEL_REG(buffer_index, MM2S_SRC_ADDR));
+
+    addr[0] = (uint32_t)(phy_address & 0xFFFFFFFF);
+    addr[1] = (uint32_t)(phy_address >> 32);
+}
+
+static inline void setDmaTransmissionLength(volatile uint8_t const *reg_map, size_t buffer_index, uint32_t transmission_bytes)
+{
+#ifdef DMA_SIM
+    // The length write starts the transfer, the simulated engine has to see it happen
+    (void)reg_map;
+    simDmaRegWrite(DMA_CHANNEL_REG(buffer_index, MM2S_LENGTH), transmission_bytes);
+#else
+    *(volatile uint32_t *)(reg_map + DMA_CHANNEL_REG(buffer_index, MM2S_LENGTH)) = transmission_bytes;
+#endif
+}
+
 int waitDmaTransmissionDone(volatile uint8_t *regs, size_t buffer_index, uint8_t timeout_ms);
+int enableDmaInterrupt(int fd_uio);
+uint32_t getDmaStatus(volatile uint8_t *regs, size_t buffer_index);
+uint32_t ackDmaInterrupt(volatile uint8_t *regs, size_t buffer_index, uint32_t mask);
+int waitDmaTransmissionDoneIrq(int fd_uio, volatile uint8_t *regs, size_t buffer_index, uint8_t timeout_ms);
+int waitDmaTransmission(enum DmaWaitMode mode, int fd_uio, volatile uint8_t *regs, size_t buffer_index, uint8_t timeout_ms);
+void initDmaWaitStrategy(struct DmaWaitStrategy *wait, enum DmaWaitMode fallback, uint32_t spin_us, uint32_t yield_us);
+int waitDmaTransmissionAdaptive(struct DmaWaitStrategy *wait, int fd_uio, volatile uint8_t *regs, size_t buffer_index, uint8_t timeout_ms);
+uint64_t *getDmaWaitPhaseHits(struct DmaWaitStrategy *wait, int64_t spent_us);
+void printDmaWaitStats(const struct DmaWaitStrategy *wait);
+
+// Scatter-gather mode
+int initDmaSgRing(struct DmaSgRing *ring, size_t buffer_index, void *desc_mem, uint64_t phy_desc_mem, size_t desc_mem_bytes);
+int startDmaSgChannel(volatile uint8_t *regs, struct DmaSgRing *ring, uint8_t irq_threshold);
+int queueDmaSgTransfer(struct DmaSgRing *ring, uint64_t phy_address, uint32_t transmission_bytes);
+void submitDmaSgTransfers(volatile uint8_t *regs, struct DmaSgRing *ring);
+int reapDmaSgTransfers(struct DmaSgRing *ring, uint32_t *transferred_bytes, size_t max_transfers);
+uint64_t getDmaSgBufferAddress(const struct DmaSgRing *ring, size_t desc);
+int waitDmaSgTransfer(enum DmaWaitMode mode, int fd_uio, volatile uint8_t *regs, const struct DmaSgRing *ring, uint8_t timeout_ms);
+int waitDmaSgTransferAdaptive(struct DmaWaitStrategy *wait, int fd_uio, volatile uint8_t *regs, const struct DmaSgRing *ring, uint8_t timeout_ms);
+
+// Error recovery
+void initDmaRecovery(struct DmaRecovery *recovery, volatile uint8_t *regs);
+void attachDmaRecoveryRing(struct DmaRecovery *recovery, struct DmaSgRing *ring, bool cyclic);
+void issueDmaTransfer(struct DmaRecovery *recovery, size_t buffer_index, uint64_t phy_address, uint32_t transmission_bytes);
+void completeDmaTransfer(struct DmaRecovery *recovery, size_t buffer_index);
+int recoverDma(struct DmaRecovery *recovery);
+void printDmaRecoveryStats(const struct DmaRecovery *recovery);
+
+// Large transfers
+int getDmaLengthWidth(const char *uio_dev, uint8_t *width);
+uint32_t getDmaMaxSegment(uint8_t length_width);
+int startDmaLargeTransfer(struct DmaLargeTransfer *xfer, struct DmaRecovery *recovery, struct DmaSgRing *ring, size_t buffer_index,
+                          uint64_t phy_address, uint64_t length, uint32_t max_segment);
+int advanceDmaLargeTransfer(struct DmaLargeTransfer *xfer);
+int waitDmaLargeTransfer(struct DmaWaitStrategy *wait, int fd_uio, struct DmaLargeTransfer *xfer, uint8_t timeout_ms);
+
+// Transfer trace
+int initDmaTrace(struct DmaTrace *trace, size_t depth);
+void freeDmaTrace(struct DmaTrace *trace);
+void traceDmaSubmit(struct DmaTrace *trace, size_t buffer_index, uint16_t slot, uint32_t length);
+void traceDmaComplete(struct DmaTrace *trace, size_t buffer_index, uint16_t slot, int status);
+int dumpDmaTrace(struct DmaTrace *trace, const char *path);
+
+// Cyclic receive mode, the engine keeps refilling the slots without being re-armed
+// nextDmaCyclicSlot returns the filled slot, -1 if none is ready yet, -2 if it completed with an error
+int startDmaCyclicReceive(volatile uint8_t *regs, struct DmaSgRing *ring, uint64_t phy_address, uint32_t slot_bytes, size_t slots);
+int nextDmaCyclicSlot(struct DmaSgRing *ring, uint32_t *transferred_bytes);
 
 #endif
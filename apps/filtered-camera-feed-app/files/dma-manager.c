@@ -0,0 +1,404 @@
+#include "dma-manager.h"
+#include "helper.h"
+
+#include <dirent.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <libgen.h>
+
+// Private helper functions
+static int read_sysfs_string(const char *path, char *out, size_t out_size)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    ssize_t n = read(fd, out, out_size - 1);
+    close(fd);
+    if (n <= 0)
+    {
+        return -1;
+    }
+    out[n] = '\0';
+    out[strcspn(out, "\n")] = '\0';
+    return 0;
+}
+
+// compatible is a list of NUL separated strings, any AXI DMA flavour counts
+static bool is_axi_dma(int uio_index)
+{
+    char path[128], buf[256];
+
+    snprintf(path, sizeof(path), "/sys/class/uio/uio%d/device/of_node/compatible", uio_index);
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0)
+    {
+        ssize_t n = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        for (ssize_t i = 0; i < n; i += (ssize_t)strlen(&buf[i]) + 1)
+        {
+            buf[n] = '\0';
+            if (strstr(&buf[i], "axi-dma") != NULL)
+            {
+                return true;
+            }
+        }
+    }
+
+    // Overlays that override compatible to generic-uio keep the node name
+    snprintf(path, sizeof(path), "/sys/class/uio/uio%d/name", uio_index);
+    return read_sysfs_string(path, buf, sizeof(buf)) == 0 && strcmp(buf, "dma") == 0;
+}
+
+// Receive buffers are matched by name: the overlay calls them dma-<base address>-rx,
+// e.g. dma-a0060000-rx for a0060000.dma
+static int find_rx_buffer(struct DmaEngine *engine, bool legacy)
+{
+    char path[160], base[DMA_ENGINE_NAME_LEN];
+
+    snprintf(base, sizeof(base), "%.*s", (int)strcspn(engine->name, "."), engine->name);
+    snprintf(engine->rx_buf_name, sizeof(engine->rx_buf_name), "dma-%s-rx", base);
+    snprintf(path, sizeof(path), "/sys/class/u-dma-buf/%s", engine->rx_buf_name);
+    if (access(path, F_OK) == 0)
+    {
+        return 0;
+    }
+
+    // Single engine overlays still use the plain udmabuf1 receive buffer, it belongs to
+    // the engine on /dev/uio4 that filtered-camera-feed-app drives without --all-engines
+    if (legacy)
+    {
+        snprintf(engine->rx_buf_name, sizeof(engine->rx_buf_name), "udmabuf%d", DEST_BUF_ID);
+        snprintf(path, sizeof(path), "/sys/class/u-dma-buf/%s", engine->rx_buf_name);
+        if (access(path, F_OK) == 0)
+        {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int open_engine(struct DmaEngine *engine)
+{
+    char dev[96];
+
+    if (getPhyAddrByName(engine->rx_buf_name, &engine->phy_rx_addr) != 0 ||
+        getBufSizeByName(engine->rx_buf_name, &engine->size_rx_buf) != 0)
+    {
+        return -1;
+    }
+    if (engine->size_rx_buf < FRAMES_PER_RECEIVE_BUFFER * BYTES_PER_RECEIVE_TRANSMISSION)
+    {
+        fprintf(stderr, "%s: %s holds %u B, need %d B\n", engine->name, engine->rx_buf_name, engine->size_rx_buf,
+                FRAMES_PER_RECEIVE_BUFFER * BYTES_PER_RECEIVE_TRANSMISSION);
+        return -1;
+    }
+
+    if (engine->cached && setDmaBufferCachedByName(engine->rx_buf_name, true) != 0)
+    {
+        fprintf(stderr, "WARNING: %s: could not make %s cacheable, keeping it uncached\n", engine->name, engine->rx_buf_name);
+        engine->cached = false;
+    }
+
+    snprintf(dev, sizeof(dev), "/dev/%s", engine->rx_buf_name);
+    engine->fd_rx_buf = openDmaDevice(dev, O_RDWR);
+    if (engine->fd_rx_buf < 0)
+    {
+        fprintf(stderr, "Failed to open %s: %s\n", dev, strerror(errno));
+        return -1;
+    }
+    engine->rx_buf = (uint8_t *)mapDmaDevice(engine->fd_rx_buf, engine->size_rx_buf);
+    if (engine->rx_buf == MAP_FAILED)
+    {
+        perror("mmap(rx)");
+        close(engine->fd_rx_buf);
+        return -1;
+    }
+
+    snprintf(dev, sizeof(dev), "/dev/uio%d", engine->uio_index);
+    engine->fd_uio = openDmaDevice(dev, O_RDWR | O_SYNC | O_CLOEXEC);
+    if (engine->fd_uio < 0)
+    {
+        fprintf(stderr, "Failed to open %s: %s\n", dev, strerror(errno));
+        munmap(engine->rx_buf, engine->size_rx_buf);
+        close(engine->fd_rx_buf);
+        return -1;
+    }
+    engine->regs = (volatile uint8_t *)mapDmaDevice(engine->fd_uio, REG_MAP_SIZE);
+    if (engine->regs == (void *)MAP_FAILED)
+    {
+        perror("mmap(regs)");
+        close(engine->fd_uio);
+        munmap(engine->rx_buf, engine->size_rx_buf);
+        close(engine->fd_rx_buf);
+        return -1;
+    }
+
+    engine->fd_event = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (engine->fd_event < 0)
+    {
+        perror("eventfd");
+        munmap((void *)engine->regs, REG_MAP_SIZE);
+        close(engine->fd_uio);
+        munmap(engine->rx_buf, engine->size_rx_buf);
+        close(engine->fd_rx_buf);
+        return -1;
+    }
+    return 0;
+}
+
+static void close_engine(struct DmaEngine *engine)
+{
+    close(engine->fd_event);
+    munmap((void *)engine->regs, REG_MAP_SIZE);
+    close(engine->fd_uio);
+    munmap(engine->rx_buf, engine->size_rx_buf);
+    close(engine->fd_rx_buf);
+    if (engine->cached)
+    {
+        setDmaBufferCachedByName(engine->rx_buf_name, false);
+    }
+}
+
+static void push_completion(struct DmaEngine *engine, const struct DmaCompletion *completion)
+{
+    size_t head = atomic_load_explicit(&engine->queue_head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&engine->queue_tail, memory_order_acquire);
+
+    if (head - tail >= DMA_COMPLETION_QUEUE_DEPTH)
+    {
+        // Consumer is behind, never stall the channel for it
+        atomic_fetch_add_explicit(&engine->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    engine->queue[head & (DMA_COMPLETION_QUEUE_DEPTH - 1)] = *completion;
+    atomic_store_explicit(&engine->queue_head, head + 1, memory_order_release);
+}
+
+static void *engine_thread(void *arg)
+{
+    struct DmaEngine *engine = (struct DmaEngine *)arg;
+    uint32_t slot = 0;
+    uint64_t one = 1;
+
+    resetDmaChannel(engine->regs, DEST_BUF_ID);
+    sleep_ms(10);
+    startDmaChannel(engine->regs, DEST_BUF_ID);
+    if (engine->wait.fallback == DMA_WAIT_IRQ && enableDmaInterrupt(engine->fd_uio) != 0)
+    {
+        fprintf(stderr, "WARNING: %s: UIO interrupt unavailable, falling back to polling\n", engine->name);
+        engine->wait.fallback = DMA_WAIT_POLL;
+    }
+    initDmaRecovery(&engine->recovery, engine->regs);
+    engine->recovery.trace = (engine->trace_path[0] != '\0') ? &engine->trace : NULL;
+    issueDmaTransfer(&engine->recovery, DEST_BUF_ID, engine->phy_rx_addr, BYTES_PER_RECEIVE_TRANSMISSION);
+
+    while (atomic_load(&engine->running))
+    {
+        int r = waitDmaTransmissionAdaptive(&engine->wait, engine->fd_uio, engine->regs, DEST_BUF_ID, 10);
+        if (r == DMA_TIMEOUT)
+        {
+            continue;
+        }
+        if (r == DMA_RECEIVED && engine->cached)
+        {
+            // Before the consumer hears about the slot
+            syncDmaBufferForCpu(engine->fd_rx_buf, (uint64_t)slot * BYTES_PER_RECEIVE_TRANSMISSION, BYTES_PER_RECEIVE_TRANSMISSION,
+                                DMA_SYNC_FROM_DEVICE);
+        }
+
+        struct DmaCompletion completion = {.slot = slot, .bytes = BYTES_PER_RECEIVE_TRANSMISSION, .result = r};
+        push_completion(engine, &completion);
+        if (write(engine->fd_event, &one, sizeof(one)) != (ssize_t)sizeof(one))
+        {
+            perror("write(eventfd)");
+        }
+        if (r != DMA_RECEIVED)
+        {
+            // A failed channel stays halted until reset, the same slot is re-issued afterwards
+            if (recoverDma(&engine->recovery) != 0)
+            {
+                fprintf(stderr, "%s: DMA recovery failed, stopping engine\n", engine->name);
+                break;
+            }
+            continue;
+        }
+
+        completeDmaTransfer(&engine->recovery, DEST_BUF_ID);
+        slot = (slot + 1) % FRAMES_PER_RECEIVE_BUFFER;
+        issueDmaTransfer(&engine->recovery, DEST_BUF_ID, engine->phy_rx_addr + (uint64_t)slot * BYTES_PER_RECEIVE_TRANSMISSION, BYTES_PER_RECEIVE_TRANSMISSION);
+    }
+    printf("%s: ", engine->name);
+    printDmaRecoveryStats(&engine->recovery);
+    printf("%s: ", engine->name);
+    printDmaWaitStats(&engine->wait);
+    return NULL;
+}
+
+// Public methods
+int discoverDmaEngines(struct DmaManager *manager)
+{
+    struct dirent **entries;
+    int n;
+
+    memset(manager, 0, sizeof(*manager));
+
+    n = scandir("/sys/class/uio", &entries, NULL, versionsort);
+    if (n < 0)
+    {
+        fprintf(stderr, "scandir(/sys/class/uio): %s\n", strerror(errno));
+        return -1;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        int uio_index;
+        char path[128], target[256];
+
+        if (sscanf(entries[i]->d_name, "uio%d", &uio_index) != 1 || !is_axi_dma(uio_index) ||
+            manager->count >= DMA_MANAGER_MAX_ENGINES)
+        {
+            free(entries[i]);
+            continue;
+        }
+        free(entries[i]);
+
+        struct DmaEngine *engine = &manager->engine[manager->count];
+        snprintf(path, sizeof(path), "/sys/class/uio/uio%d/device", uio_index);
+        ssize_t len = readlink(path, target, sizeof(target) - 1);
+        if (len <= 0)
+        {
+            continue;
+        }
+        target[len] = '\0';
+        snprintf(engine->name, sizeof(engine->name), "%s", basename(target));
+        engine->uio_index = uio_index;
+
+        if (find_rx_buffer(engine, uio_index == DMA_LEGACY_UIO_INDEX) != 0)
+        {
+            fprintf(stderr, "INFO: %s (uio%d) has no receive udmabuf, skipping\n", engine->name, uio_index);
+            continue;
+        }
+        printf("Found AXI DMA %s on uio%d, receive buffer %s\n", engine->name, uio_index, engine->rx_buf_name);
+        manager->count++;
+    }
+    free(entries);
+    return (int)manager->count;
+}
+
+int startDmaManager(struct DmaManager *manager, const struct DmaWaitStrategy *wait, const char *trace_path, bool cached)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (size_t i = 0; i < manager->count; i++)
+    {
+        struct DmaEngine *engine = &manager->engine[i];
+        pthread_attr_t attr;
+        cpu_set_t set;
+        sigset_t stop_signals, old_signals;
+        bool pinned;
+
+        engine->cached = cached;
+        if (open_engine(engine) != 0)
+        {
+            if (engine->cached)
+            {
+                setDmaBufferCachedByName(engine->rx_buf_name, false);
+            }
+            fprintf(stderr, "Failed to open %s\n", engine->name);
+            stopDmaManager(manager);
+            return -1;
+        }
+
+        // Core 0 is left to the consumer, engines are spread over the others
+        engine->cpu = (cpus > 1) ? (int)(1 + i % (size_t)(cpus - 1)) : 0;
+        // Each thread keeps its own hit counters and its own trace file
+        engine->wait = *wait;
+        engine->trace_path[0] = '\0';
+        if (trace_path != NULL)
+        {
+            if (initDmaTrace(&engine->trace, DMA_TRACE_DEFAULT_DEPTH) != 0)
+            {
+                close_engine(engine);
+                stopDmaManager(manager);
+                return -1;
+            }
+            snprintf(engine->trace_path, sizeof(engine->trace_path), "%s.%s", trace_path, engine->name);
+        }
+        atomic_init(&engine->running, true);
+        atomic_init(&engine->queue_head, 0);
+        atomic_init(&engine->queue_tail, 0);
+        atomic_init(&engine->dropped, 0);
+
+        // Engine threads block the stop signals, they interrupt the thread consuming completions
+        sigemptyset(&stop_signals);
+        sigaddset(&stop_signals, SIGINT);
+        sigaddset(&stop_signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &stop_signals, &old_signals);
+        // Pinned from its first instruction on, not moved there after it started
+        CPU_ZERO(&set);
+        CPU_SET(engine->cpu, &set);
+        pthread_attr_init(&attr);
+        pinned = (pthread_attr_setaffinity_np(&attr, sizeof(set), &set) == 0);
+        int r = pthread_create(&engine->thread, pinned ? &attr : NULL, engine_thread, engine);
+        if (r != 0 && pinned)
+        {
+            // The CPU may not be in this process's cpuset, run unpinned then
+            pinned = false;
+            r = pthread_create(&engine->thread, NULL, engine_thread, engine);
+        }
+        pthread_attr_destroy(&attr);
+        pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+        if (!pinned)
+        {
+            fprintf(stderr, "WARNING: could not pin %s to CPU %d\n", engine->name, engine->cpu);
+        }
+        if (r != 0)
+        {
+            fprintf(stderr, "pthread_create(%s) failed\n", engine->name);
+            atomic_store(&engine->running, false);
+            freeDmaTrace(&engine->trace);
+            close_engine(engine);
+            stopDmaManager(manager);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void stopDmaManager(struct DmaManager *manager)
+{
+    for (size_t i = 0; i < manager->count; i++)
+    {
+        struct DmaEngine *engine = &manager->engine[i];
+
+        if (!atomic_exchange(&engine->running, false))
+        {
+            continue;
+        }
+        pthread_join(engine->thread, NULL);
+        resetDmaChannel(engine->regs, DEST_BUF_ID);
+        if (engine->trace_path[0] != '\0')
+        {
+            dumpDmaTrace(&engine->trace, engine->trace_path);
+            freeDmaTrace(&engine->trace);
+        }
+        close_engine(engine);
+    }
+}
+
+bool popDmaCompletion(struct DmaEngine *engine, struct DmaCompletion *completion)
+{
+    size_t tail = atomic_load_explicit(&engine->queue_tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&engine->queue_head, memory_order_acquire);
+
+    if (tail == head)
+    {
+        return false;
+    }
+    *completion = engine->queue[tail & (DMA_COMPLETION_QUEUE_DEPTH - 1)];
+    atomic_store_explicit(&engine->queue_tail, tail + 1, memory_order_release);
+    return true;
+}
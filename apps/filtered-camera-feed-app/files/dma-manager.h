@@ -0,0 +1,64 @@
+#ifndef _DMA_MANAGER_H
+#define _DMA_MANAGER_H 1
+
+#include "dma-api.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define DMA_MANAGER_MAX_ENGINES 4
+#define DMA_COMPLETION_QUEUE_DEPTH 64 // power of two
+#define DMA_ENGINE_NAME_LEN 64
+#define DMA_ENGINE_RX_BUF_NAME_LEN (DMA_ENGINE_NAME_LEN + 7) // dma-<base address>-rx
+#define DMA_LEGACY_UIO_INDEX 4                               // /dev/uio4, the engine udmabuf1 belongs to
+#define DMA_ENGINE_TRACE_PATH_LEN 256
+
+struct DmaCompletion
+{
+    uint32_t slot;
+    uint32_t bytes;
+    int result;
+};
+
+// One AXI DMA bound to uio_pdrv_genirq together with its receive udmabuf.
+// Each engine is serviced by its own thread, pinned to its own core.
+struct DmaEngine
+{
+    char name[DMA_ENGINE_NAME_LEN];   // Platform device, e.g. a0060000.dma
+    char rx_buf_name[DMA_ENGINE_RX_BUF_NAME_LEN];
+    int uio_index;
+    int fd_uio;
+    int fd_rx_buf;
+    int fd_event; // eventfd the engine thread signals after queueing completions
+    volatile uint8_t *regs;
+    uint8_t *rx_buf;
+    uint64_t phy_rx_addr;
+    uint32_t size_rx_buf;
+    int cpu;
+    bool cached; // rx_buf is mapped cacheable, completed slots are synced for the CPU
+    struct DmaWaitStrategy wait;
+    pthread_t thread;
+    atomic_bool running;
+    struct DmaRecovery recovery; // Owned by the engine thread
+    struct DmaTrace trace;
+    char trace_path[DMA_ENGINE_TRACE_PATH_LEN]; // Empty when tracing is off
+
+    // Single producer (engine thread), single consumer (caller of popDmaCompletion)
+    struct DmaCompletion queue[DMA_COMPLETION_QUEUE_DEPTH];
+    atomic_size_t queue_head;
+    atomic_size_t queue_tail;
+    atomic_uint_fast64_t dropped;
+};
+
+struct DmaManager
+{
+    struct DmaEngine engine[DMA_MANAGER_MAX_ENGINES];
+    size_t count;
+};
+
+int discoverDmaEngines(struct DmaManager *manager);
+int startDmaManager(struct DmaManager *manager, const struct DmaWaitStrategy *wait, const char *trace_path, bool cached);
+void stopDmaManager(struct DmaManager *manager);
+bool popDmaCompletion(struct DmaEngine *engine, struct DmaCompletion *completion);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef _DMA_SIM_H
+#define _DMA_SIM_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Software stand-in for the AXI DMA and the u-dma-buf buffers, compiled in with
+// `make SIM=1` (-DDMA_SIM). dma-api routes device access and every register write
+// through here, a worker thread plays the PL side.
+//
+// Only simple mode is emulated. The status register reports no SG engine, so
+// --sg and --cyclic fail to start like on a bitstream built without it.
+//
+// Environment:
+//   DMA_SIM_MODE=loopback|source  MM2S data comes back on S2MM (default), or
+//                                 S2MM is fed frames and MM2S is a sink
+//   DMA_SIM_FRAME_US=N            Source mode, one frame every N us (0 = flat out)
+//   DMA_SIM_ERROR_EVERY=N         Fail every Nth S2MM transfer with DMASlvErr
+//   DMA_SIM_UDMABUF<n>_SIZE=N     Size of udmabuf<n>
+//   DMA_SIM_LENGTH_WIDTH=N        Bits of the length registers (default 26), higher bits are dropped
+
+#define DMA_SIM_BUFFERS 3
+#define DMA_SIM_PHY_BASE 0x70000000u
+#define DMA_SIM_PHY_STRIDE 0x01000000u
+
+int simDmaOpen(const char *path);
+void *simDmaMap(int fd, size_t length);
+int simDmaBufferInfo(const char *device_name, uint64_t *phy_addr, uint32_t *size);
+void simDmaRegWrite(uint32_t offset, uint32_t value);
+uint8_t simDmaLengthWidth(void);
+
+#endif
@@ -1,48 +1,192 @@
 #include "dma-api.h"
+#include "dma-manager.h"
 #include "helper.h"
 
 #include <inttypes.h>
+#include <poll.h>
+
+// Receive from every AXI DMA found on the system, one pinned thread per engine
+static int runAllEngines(pid_t pid, const struct DmaWaitStrategy *wait, const char *trace_path, bool cached)
+{
+    struct DmaManager manager;
+    struct pollfd pfds[DMA_MANAGER_MAX_ENGINES];
+    uint64_t frames_received[DMA_MANAGER_MAX_ENGINES] = {0};
+
+    if (discoverDmaEngines(&manager) <= 0)
+    {
+        fprintf(stderr, "No AXI DMA with a receive buffer found\n");
+        return 1;
+    }
+    if (startDmaManager(&manager, wait, trace_path, cached) != 0)
+    {
+        return 1;
+    }
+
+    for (size_t i = 0; i < manager.count; i++)
+    {
+        pfds[i].fd = manager.engine[i].fd_event;
+        pfds[i].events = POLLIN;
+    }
+
+    int exit_code = 0;
+    // The engine threads block SIGINT and SIGTERM, so a stop signal interrupts this poll().
+    // One that lands just before it is seen at the next timeout.
+    while (!stop_requested)
+    {
+        if (poll(pfds, manager.count, 100) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("poll(engines)");
+            exit_code = 1;
+            break;
+        }
+
+        for (size_t i = 0; i < manager.count; i++)
+        {
+            struct DmaEngine *engine = &manager.engine[i];
+            struct DmaCompletion completion;
+            uint64_t wakeups;
+
+            if (!(pfds[i].revents & POLLIN))
+            {
+                continue;
+            }
+            // Only clears the eventfd, the queue itself says how many frames are ready
+            (void)read(engine->fd_event, &wakeups, sizeof(wakeups));
+
+            while (popDmaCompletion(engine, &completion))
+            {
+                if (completion.result != DMA_RECEIVED)
+                {
+                    fprintf(stderr, "%s: receive DMA failed on frame index %u\n", engine->name, completion.slot);
+                    continue;
+                }
+                frames_received[i]++;
+                printf("%s: receive DMA channel finished, frame index, total frames: %u, %" PRIu64 "\n",
+                       engine->name, completion.slot, frames_received[i]);
+
+                if (pid > 0 && kill(pid, SIGUSR1) != 0)
+                {
+                    perror("kill");
+                    stopDmaManager(&manager);
+                    return 1;
+                }
+            }
+        }
+    }
+
+    stopDmaManager(&manager);
+    return exit_code;
+}
 
 int main(int argc, char *argv[])
 {
     const char *udmabuf1_dev = "/dev/udmabuf1";
+    const char *udmabuf2_dev = "/dev/udmabuf2";
     const char *uio_dev = "/dev/uio4";
 
-    FILE *input_file_handle;
-
-    uint64_t phy_dest_addr;
-    uint32_t size_dest_buf;
-    int fd_buf1;
-    uint8_t *dest_buf;
+    uint64_t phy_dest_addr, phy_desc_addr;
+    uint32_t size_dest_buf, size_desc_buf = 0;
+    int fd_buf1, fd_buf2 = -1;
+    uint8_t *dest_buf, *desc_buf = NULL;
     volatile uint8_t *reg_map;
+    struct DmaSgRing rx_ring;
+    struct DmaRecovery recovery;
+    struct DmaWaitStrategy wait;
+    struct DmaTrace trace;
 
     size_t network_trigger_counter = 0;
 
     bool finished_operation = false;
+    int exit_code = 0;
     size_t frame_index = 0;
     uint64_t frames_received = 0;
 
-    if (argc > 2)
+    if (argc > 9)
     {
-        printf("Invalid use. Function expects: filtered-camera-feed [visualizer PID]\n");
+        printf("Invalid use. Function expects: filtered-camera-feed [visualizer PID] [--irq] [--sg] [--cyclic] [--all-engines] [--busy-poll=SPIN_US[,YIELD_US]] [--trace=FILE] [--cached]\n");
         exit(1);
     }
 
     pid_t pid = -1; // means "not provided"
+    enum DmaWaitMode wait_mode = DMA_WAIT_POLL;
+    bool use_sg = false;
+    bool use_cyclic = false;
+    bool all_engines = false;
+    uint32_t spin_us = 0, yield_us = 0;
+    const char *trace_path = NULL;
+    bool use_cached = false;
 
     for (int i = 1; i < argc; i++)
     {
+        if (strcmp(argv[i], "--irq") == 0)
+        {
+            wait_mode = DMA_WAIT_IRQ;
+            continue;
+        }
+        if (strcmp(argv[i], "--sg") == 0)
+        {
+            use_sg = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--cyclic") == 0)
+        {
+            use_cyclic = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--all-engines") == 0)
+        {
+            all_engines = true;
+            continue;
+        }
+        if (strncmp(argv[i], "--busy-poll=", 12) == 0)
+        {
+            // Yield budget defaults to the spin budget
+            int n = sscanf(argv[i] + 12, "%u,%u", &spin_us, &yield_us);
+            if (n < 1)
+            {
+                fprintf(stderr, "Invalid arg: %s (expected --busy-poll=SPIN_US[,YIELD_US])\n", argv[i]);
+                return 1;
+            }
+            if (n == 1)
+            {
+                yield_us = spin_us;
+            }
+            continue;
+        }
+        if (strncmp(argv[i], "--trace=", 8) == 0)
+        {
+            trace_path = argv[i] + 8;
+            continue;
+        }
+        if (strcmp(argv[i], "--cached") == 0)
+        {
+            use_cached = true;
+            continue;
+        }
         // otherwise treat it as PID
         char *end = NULL;
         long v = strtol(argv[i], &end, 10);
         if (end == argv[i] || *end != '\0' || v <= 0)
         {
-            fprintf(stderr, "Invalid arg: %s (expected PID)\n", argv[i]);
+            fprintf(stderr, "Invalid arg: %s (expected PID, --irq, --sg, --cyclic, --all-engines, --busy-poll=, --trace= or --cached)\n", argv[i]);
             return 1;
         }
         pid = (pid_t)v;
     }
 
+    // Ctrl-C or SIGTERM ends the stream through the statistics and the trace dump below
+    if (installStopHandler() != 0)
+    {
+        return 1;
+    }
+    if (all_engines)
+    {
+        initDmaWaitStrategy(&wait, wait_mode, spin_us, yield_us);
+        return runAllEngines(pid, &wait, trace_path, use_cached);
+    }
+
     getPhyAddr(DEST_BUF_ID, &phy_dest_addr);
     getBufSize(DEST_BUF_ID, &size_dest_buf);
 
@@ -55,14 +199,21 @@ int main(int argc, char *argv[])
         exit(1);
     }
 
-    fd_buf1 = open(udmabuf1_dev, O_RDWR);
+    // Has to happen before mapping, the caching attribute is fixed at mmap time
+    if (use_cached && setDmaBufferCached(DEST_BUF_ID, true) != 0)
+    {
+        fprintf(stderr, "WARNING: could not make the receive buffer cacheable, keeping it uncached\n");
+        use_cached = false;
+    }
+
+    fd_buf1 = openDmaDevice(udmabuf1_dev, O_RDWR);
     if (fd_buf1 < 0)
     {
         fprintf(stderr, "Failed to open %s: %s\n", udmabuf1_dev, strerror(errno));
         exit(1);
     }
 
-    dest_buf = (uint8_t *)mmap(NULL, (size_t)size_dest_buf, PROT_READ | PROT_WRITE, MAP_SHARED, fd_buf1, 0);
+    dest_buf = (uint8_t *)mapDmaDevice(fd_buf1, (size_t)size_dest_buf);
     if (dest_buf == MAP_FAILED)
     {
         perror("mmap(dst)");
@@ -70,7 +221,7 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    int fd_uio = open(uio_dev, O_RDWR | O_SYNC | O_CLOEXEC);
+    int fd_uio = openDmaDevice(uio_dev, O_RDWR | O_SYNC | O_CLOEXEC);
     if (fd_uio < 0)
     {
         perror("open(/dev/uio4)");
@@ -79,9 +230,7 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    reg_map = (volatile uint8_t *)mmap(NULL, REG_MAP_SIZE,
-                                       PROT_READ | PROT_WRITE,
-                                       MAP_SHARED, fd_uio, 0);
+    reg_map = (volatile uint8_t *)mapDmaDevice(fd_uio, REG_MAP_SIZE);
     if (reg_map == (void *)MAP_FAILED)
     {
         perror("mmap(regs)");
@@ -91,27 +240,191 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    if (use_sg && use_cyclic)
+    {
+        fprintf(stderr, "--sg and --cyclic are mutually exclusive\n");
+        exit(1);
+    }
+
+    if (use_sg || use_cyclic)
+    {
+        // Descriptor rings live in their own udmabuf, RX uses the second half
+        getPhyAddr(DESC_BUF_ID, &phy_desc_addr);
+        getBufSize(DESC_BUF_ID, &size_desc_buf);
+
+        fd_buf2 = openDmaDevice(udmabuf2_dev, O_RDWR);
+        if (fd_buf2 < 0)
+        {
+            fprintf(stderr, "Failed to open %s: %s\n", udmabuf2_dev, strerror(errno));
+            exit(1);
+        }
+
+        desc_buf = (uint8_t *)mapDmaDevice(fd_buf2, (size_t)size_desc_buf);
+        if (desc_buf == MAP_FAILED)
+        {
+            perror("mmap(desc)");
+            close(fd_buf2);
+            exit(1);
+        }
+
+        if (initDmaSgRing(&rx_ring, DEST_BUF_ID, desc_buf + size_desc_buf / 2, phy_desc_addr + size_desc_buf / 2, size_desc_buf / 2) != 0)
+        {
+            exit(1);
+        }
+    }
+
+    initDmaRecovery(&recovery, reg_map);
+    if (trace_path != NULL)
+    {
+        if (initDmaTrace(&trace, DMA_TRACE_DEFAULT_DEPTH) != 0)
+        {
+            exit(1);
+        }
+        recovery.trace = &trace;
+        rx_ring.trace = &trace;
+    }
+
     // Prepare DMAs
     // Reset DMA channels
     resetDmaChannel(reg_map, DEST_BUF_ID);
     // Give it a moment
     sleep_ms(10);
     // Start receive channel not to fill the buffer
-    startDmaChannel(reg_map, DEST_BUF_ID);
-    // Write destination address
-    setDmaChannelAddress(reg_map, DEST_BUF_ID, phy_dest_addr);
+    if (use_sg)
+    {
+        // Interrupt once per received frame
+        if (startDmaSgChannel(reg_map, &rx_ring, 1) != 0)
+        {
+            exit(1);
+        }
+        attachDmaRecoveryRing(&recovery, &rx_ring, false);
+    }
+    else if (!use_cyclic)
+    {
+        startDmaChannel(reg_map, DEST_BUF_ID);
+    }
+    // Unmask the UIO interrupt before the first transfer can complete
+    if (wait_mode == DMA_WAIT_IRQ && enableDmaInterrupt(fd_uio) != 0)
+    {
+        fprintf(stderr, "WARNING: UIO interrupt unavailable, falling back to polling\n");
+        wait_mode = DMA_WAIT_POLL;
+    }
+    initDmaWaitStrategy(&wait, wait_mode, spin_us, yield_us);
     // Trigger receive DMA
+    if (use_cyclic)
+    {
+        // The channel keeps cycling over every frame slot, only the cursor moves from here on
+        if (startDmaCyclicReceive(reg_map, &rx_ring, phy_dest_addr, BYTES_PER_RECEIVE_TRANSMISSION, FRAMES_PER_RECEIVE_BUFFER) != 0)
+        {
+            exit(1);
+        }
+        attachDmaRecoveryRing(&recovery, &rx_ring, true);
+    }
+    else if (use_sg)
+    {
+        // Hand every frame slot to the receive channel at once
+        for (size_t i = 0; i < FRAMES_PER_RECEIVE_BUFFER; i++)
+        {
+            queueDmaSgTransfer(&rx_ring, phy_dest_addr + i * BYTES_PER_RECEIVE_TRANSMISSION, BYTES_PER_RECEIVE_TRANSMISSION);
+        }
+        submitDmaSgTransfers(reg_map, &rx_ring);
+    }
+    else
+    {
+        // Write destination address and length
+        issueDmaTransfer(&recovery, DEST_BUF_ID, phy_dest_addr, BYTES_PER_RECEIVE_TRANSMISSION);
+    }
     printf("Receive DMA channel triggered\n");
-    setDmaTransmissionLength(reg_map, DEST_BUF_ID, BYTES_PER_RECEIVE_TRANSMISSION);
 
-    while (!finished_operation)
+    while (!finished_operation && !stop_requested)
     {
         // Poll DMA channels
-        if (waitDmaTransmissionDone(reg_map, DEST_BUF_ID, 10) == DMA_RECEIVED)
+        size_t frames_done = 0;
+        // Frame slots filled since the last pass, in the order the hardware completed them
+        size_t filled[FRAMES_PER_RECEIVE_BUFFER];
+        int rx_result;
+        if (use_cyclic || use_sg)
+        {
+            rx_result = waitDmaSgTransferAdaptive(&wait, fd_uio, reg_map, &rx_ring, 10);
+        }
+        else
         {
-            // Update destination address
-            frame_index++;
-            frame_index %= 8;
+            rx_result = waitDmaTransmissionAdaptive(&wait, fd_uio, reg_map, DEST_BUF_ID, 10);
+        }
+
+        // A bus error halts the engine, reset it and re-issue whatever was in flight
+        if (rx_result == DMA_FAILED)
+        {
+            if (recoverDma(&recovery) != 0)
+            {
+                fprintf(stderr, "DMA recovery failed, stopping\n");
+                exit_code = 1;
+                break;
+            }
+            if (use_cyclic)
+            {
+                // The cyclic ring starts over at slot 0
+                frame_index = 0;
+            }
+            continue;
+        }
+
+        if (use_cyclic)
+        {
+            // Consume every slot the hardware filled since the last pass
+            if (rx_result == DMA_RECEIVED)
+            {
+                int slot;
+                while (frames_done < FRAMES_PER_RECEIVE_BUFFER && (slot = nextDmaCyclicSlot(&rx_ring, NULL)) != -1)
+                {
+                    // -2 is a slot that completed with an error, it holds no frame
+                    if (slot >= 0)
+                    {
+                        filled[frames_done++] = (size_t)slot;
+                    }
+                }
+            }
+        }
+        else if (use_sg)
+        {
+            // Reap every frame the ring completed since the last pass
+            if (rx_result == DMA_RECEIVED)
+            {
+                size_t first = rx_ring.tail;
+                int reaped = reapDmaSgTransfers(&rx_ring, NULL, FRAMES_PER_RECEIVE_BUFFER);
+                frames_done = (reaped > 0) ? (size_t)reaped : 0;
+                // Descriptors and frame slots drift apart after a re-arm, the buffer says which slot it was
+                for (size_t f = 0; f < frames_done; f++)
+                {
+                    uint64_t address = getDmaSgBufferAddress(&rx_ring, (first + f) % rx_ring.count);
+                    filled[f] = (size_t)((address - phy_dest_addr) / BYTES_PER_RECEIVE_TRANSMISSION);
+                }
+            }
+        }
+        else if (rx_result == DMA_RECEIVED)
+        {
+            completeDmaTransfer(&recovery, DEST_BUF_ID);
+            filled[0] = frame_index;
+            frames_done = 1;
+        }
+
+        for (size_t f = 0; f < frames_done; f++)
+        {
+            size_t slot = filled[f];
+
+            // The slot just filled goes to the back of the descriptor ring
+            if (use_sg)
+            {
+                queueDmaSgTransfer(&rx_ring, phy_dest_addr + slot * BYTES_PER_RECEIVE_TRANSMISSION, BYTES_PER_RECEIVE_TRANSMISSION);
+            }
+            if (use_cached)
+            {
+                // Drop stale lines of the slot S2MM just wrote, before the viewer reads it. Nothing
+                // on the CPU side writes the receive ring, so re-arming the slot needs no clean.
+                syncDmaBufferForCpu(fd_buf1, slot * BYTES_PER_RECEIVE_TRANSMISSION, BYTES_PER_RECEIVE_TRANSMISSION, DMA_SYNC_FROM_DEVICE);
+            }
+            // Next slot the hardware fills, also the next destination address in simple mode
+            frame_index = (slot + 1) % FRAMES_PER_RECEIVE_BUFFER;
             frames_received++;
             printf("Receive DMA channel finished, frame index, total frames: %u, %" PRIu64 "\n", frame_index, frames_received);
 
@@ -119,8 +432,11 @@ int main(int argc, char *argv[])
             {
                 if (kill(pid, SIGUSR1) != 0)
                 {
+                    // Stop through the cleanup below
                     perror("kill");
-                    return 1;
+                    exit_code = 1;
+                    finished_operation = true;
+                    break;
                 }
             }
 
@@ -129,20 +445,46 @@ int main(int argc, char *argv[])
             {
                 network_trigger_counter++;
             }
-            // Update destination address
-            setDmaChannelAddress(reg_map, DEST_BUF_ID, (phy_dest_addr + frame_index * BYTES_PER_RECEIVE_TRANSMISSION));
-            setDmaTransmissionLength(reg_map, DEST_BUF_ID, BYTES_PER_RECEIVE_TRANSMISSION);
+            if (!use_sg && !use_cyclic)
+            {
+                // Update destination address
+                issueDmaTransfer(&recovery, DEST_BUF_ID, phy_dest_addr + frame_index * BYTES_PER_RECEIVE_TRANSMISSION, BYTES_PER_RECEIVE_TRANSMISSION);
+            }
+        }
+        if (use_sg && frames_done > 0)
+        {
+            submitDmaSgTransfers(reg_map, &rx_ring);
         }
     }
 
     // Trigger DMA channels
     // Wait for finished transaction
 
+    // Stop the engine before its buffers are let go
+    resetDmaChannel(reg_map, DEST_BUF_ID);
+
+    printDmaRecoveryStats(&recovery);
+    printDmaWaitStats(&wait);
+    if (trace_path != NULL)
+    {
+        dumpDmaTrace(&trace, trace_path);
+        freeDmaTrace(&trace);
+    }
+
     //  Close on exit
-    fclose(input_file_handle);
     munmap((void *)reg_map, REG_MAP_SIZE);
     close(fd_uio);
     munmap(dest_buf, (size_t)size_dest_buf);
     close(fd_buf1);
-    return 0;
+    if (use_cached)
+    {
+        // Back to the overlay's sync-always for the next user
+        setDmaBufferCached(DEST_BUF_ID, false);
+    }
+    if (desc_buf != NULL)
+    {
+        munmap(desc_buf, (size_t)size_desc_buf);
+        close(fd_buf2);
+    }
+    return exit_code;
 }
\ No newline at end of file
@@ -17,6 +17,7 @@
 
 #define FRAME_SIZE_IN_BYTES 2048
 #define BYTES_PER_RECEIVE_TRANSMISSION FRAME_SIZE_IN_BYTES * 2
+#define FRAMES_PER_RECEIVE_BUFFER 8
 #define LINES_PER_CHUNK 128
 #define BYTES_PER_LINE 8
 #define HEXCHARS_PER_LINE 16
@@ -26,4 +27,8 @@ int hexchar_to_uint8(char c, uint8_t *out);
 int parseLine(const char s[HEXCHARS_PER_LINE], uint8_t out[BYTES_PER_LINE]);
 int readNextLine(FILE *f, char hex16[HEXCHARS_PER_LINE], uint64_t *lineno);
 void sleep_ms(int milliseconds);
+
+// Set once SIGINT or SIGTERM arrived after installStopHandler(), the main loops stop on it
+extern volatile sig_atomic_t stop_requested;
+int installStopHandler(void);
 #endif
\ No newline at end of file
@@ -0,0 +1,152 @@
+#include "chunk-sizer.h"
+
+#include <inttypes.h>
+
+// Private helper functions
+static uint64_t now_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000u + (uint64_t)t.tv_nsec;
+}
+
+static struct ChunkSizeStats *size_stats(struct ChunkSizer *sizer)
+{
+    for (size_t i = 0; i < sizer->sizes; i++)
+    {
+        if (sizer->size[i].chunk_bytes == sizer->chunk_bytes)
+        {
+            return &sizer->size[i];
+        }
+    }
+    if (sizer->sizes == CHUNK_SIZER_MAX_SIZES)
+    {
+        return &sizer->size[CHUNK_SIZER_MAX_SIZES - 1];
+    }
+    struct ChunkSizeStats *stats = &sizer->size[sizer->sizes++];
+    stats->chunk_bytes = sizer->chunk_bytes;
+    return stats;
+}
+
+// Back down the min_bytes * 2^n steps growing takes, max_bytes need not be one
+static size_t step_down(const struct ChunkSizer *sizer)
+{
+    size_t next = sizer->min_bytes;
+
+    while (2 * next < sizer->chunk_bytes)
+    {
+        next *= 2;
+    }
+    return next;
+}
+
+// One decision per window, returns true when the chunk size changed
+static bool adapt(struct ChunkSizer *sizer)
+{
+    size_t next = sizer->chunk_bytes;
+
+    if (sizer->window_bytes == 0 || sizer->window_ns == 0)
+    {
+        return false;
+    }
+    // Time one chunk takes at the rate this window achieved
+    uint64_t chunk_ns = (uint64_t)sizer->chunk_bytes * sizer->window_ns / sizer->window_bytes;
+    double rate = (double)sizer->window_bytes / (double)sizer->window_ns;
+    bool slower = (sizer->grow_rate > 0 && rate < sizer->grow_rate * CHUNK_SIZER_SLOWER);
+
+    sizer->grow_rate = 0;
+    if (chunk_ns > CHUNK_SIZER_LATENCY_NS && sizer->chunk_bytes > sizer->min_bytes)
+    {
+        next = step_down(sizer);
+        sizer->shrinks++;
+    }
+    else if (slower)
+    {
+        // The last doubling lost throughput, go back and do not try it again
+        next = step_down(sizer);
+        sizer->ceiling = next;
+        sizer->shrinks++;
+    }
+    else if (sizer->window_starved > 0 && sizer->chunk_bytes < sizer->ceiling && 2 * chunk_ns <= CHUNK_SIZER_LATENCY_NS)
+    {
+        next = 2 * sizer->chunk_bytes;
+        sizer->grow_rate = rate;
+        sizer->grows++;
+    }
+    if (next > sizer->max_bytes)
+    {
+        next = sizer->max_bytes;
+    }
+
+    sizer->window_chunks = 0;
+    sizer->window_bytes = 0;
+    sizer->window_ns = 0;
+    sizer->window_starved = 0;
+    if (next == sizer->chunk_bytes)
+    {
+        return false;
+    }
+    sizer->chunk_bytes = next;
+    return true;
+}
+
+// Public methods
+void initChunkSizer(struct ChunkSizer *sizer, size_t chunk_bytes, size_t min_bytes, size_t max_bytes, bool adaptive)
+{
+    memset(sizer, 0, sizeof(*sizer));
+    sizer->adaptive = adaptive;
+    sizer->min_bytes = min_bytes;
+    sizer->max_bytes = max_bytes;
+    sizer->ceiling = max_bytes;
+    sizer->chunk_bytes = chunk_bytes;
+}
+
+// The first transfer was issued, its completion is timed from here
+void startChunkSizer(struct ChunkSizer *sizer)
+{
+    if (sizer->last_ns == 0)
+    {
+        sizer->last_ns = now_ns();
+    }
+}
+
+// Account one completed chunk. starved says the transfers did not keep up: MM2S had nothing
+// queued behind it although there is input left, or every slot was queued. Returns true
+// when the adaptive size changed.
+bool recordChunkSent(struct ChunkSizer *sizer, uint32_t bytes, bool starved)
+{
+    struct ChunkSizeStats *stats = size_stats(sizer);
+    uint64_t now = now_ns();
+    uint64_t ns = (sizer->last_ns != 0) ? now - sizer->last_ns : 0;
+
+    sizer->last_ns = now;
+    stats->chunks++;
+    stats->bytes += bytes;
+    stats->ns += ns;
+    if (!sizer->adaptive)
+    {
+        return false;
+    }
+    sizer->window_chunks++;
+    sizer->window_bytes += bytes;
+    sizer->window_ns += ns;
+    sizer->window_starved += starved ? 1 : 0;
+    return (sizer->window_chunks == CHUNK_SIZER_WINDOW) ? adapt(sizer) : false;
+}
+
+void printChunkSizerStats(const struct ChunkSizer *sizer)
+{
+    if (sizer->adaptive)
+    {
+        printf("TX chunk size adaptive between %zu B and %zu B: %" PRIu64 " grows, %" PRIu64 " shrinks, ended at %zu B\n",
+               sizer->min_bytes, sizer->max_bytes, sizer->grows, sizer->shrinks, sizer->chunk_bytes);
+    }
+    for (size_t i = 0; i < sizer->sizes; i++)
+    {
+        const struct ChunkSizeStats *stats = &sizer->size[i];
+        double seconds = (double)stats->ns / 1e9;
+
+        printf("TX chunks of %zu B: %" PRIu64 " chunks, %" PRIu64 " B in %.3f s, %.2f MB/s\n", stats->chunk_bytes, stats->chunks,
+               stats->bytes, seconds, (seconds > 0) ? (double)stats->bytes / seconds / 1e6 : 0.0);
+    }
+}
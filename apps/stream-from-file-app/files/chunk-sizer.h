@@ -0,0 +1,53 @@
+#ifndef _CHUNK_SIZER_H
+#define _CHUNK_SIZER_H 1
+
+#include "helper.h"
+
+#include <time.h>
+
+#define CHUNK_SIZER_WINDOW 32          // Completed chunks between two decisions
+#define CHUNK_SIZER_LATENCY_NS 1000000 // Largest time a chunk may take to go out in adaptive mode
+#define CHUNK_SIZER_MAX_SIZES 16
+#define CHUNK_SIZER_MIN_SLOTS 8 // Adaptive slots are sized so that at least this many fit the source buffer
+#define CHUNK_SIZER_SLOWER 0.9  // A doubling that leaves less than this of the rate before it is undone
+
+// Bytes and time sent while the chunk size was chunk_bytes
+struct ChunkSizeStats
+{
+    size_t chunk_bytes;
+    uint64_t chunks;
+    uint64_t bytes;
+    uint64_t ns;
+};
+
+// Picks the MM2S chunk size. Fixed, it only keeps the statistics. Adaptive, it doubles the
+// chunk while the transfers do not keep up (MM2S runs dry with input left, or the parser
+// waits with every slot queued), so fewer transfers and eventfd round trips carry the
+// stream. It halves it once a chunk takes longer than CHUNK_SIZER_LATENCY_NS to go out at
+// the measured rate (a paced or slow input), so events are not held back for a whole
+// large chunk. A doubling that made the stream slower is undone and not tried again.
+struct ChunkSizer
+{
+    bool adaptive;
+    size_t min_bytes;
+    size_t max_bytes;
+    size_t chunk_bytes; // Size the parser fills chunks to
+    size_t ceiling;     // Largest size that has not cost throughput
+    double grow_rate;   // B/ns of the window before the last doubling, 0 if it was no doubling
+    uint64_t last_ns;   // Previous completion, 0 before the first transfer
+    uint64_t window_chunks;
+    uint64_t window_bytes;
+    uint64_t window_ns;
+    uint64_t window_starved;
+    uint64_t grows;
+    uint64_t shrinks;
+    struct ChunkSizeStats size[CHUNK_SIZER_MAX_SIZES];
+    size_t sizes;
+};
+
+void initChunkSizer(struct ChunkSizer *sizer, size_t chunk_bytes, size_t min_bytes, size_t max_bytes, bool adaptive);
+void startChunkSizer(struct ChunkSizer *sizer);
+bool recordChunkSent(struct ChunkSizer *sizer, uint32_t bytes, bool starved);
+void printChunkSizerStats(const struct ChunkSizer *sizer);
+
+#endif
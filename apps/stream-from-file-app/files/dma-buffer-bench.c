@@ -0,0 +1,166 @@
+#include "dma-api.h"
+#include "helper.h"
+
+#include <inttypes.h>
+#include <time.h>
+
+// CPU side cost of the udmabuf accesses the streaming apps make, with the buffers
+// mapped uncached (the overlay default) and mapped cached with a per-range sync.
+// Does not touch the DMA engine, run it while no streaming app is running.
+//
+//   TX: write a chunk of parsed lines into udmabuf0, then sync it for the device
+//   RX: sync a frame slot of udmabuf1 for the CPU, then copy it out like the viewer
+
+#define DEFAULT_ITERATIONS 20000
+
+struct BenchResult
+{
+    double tx_ns;
+    double rx_ns;
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000u + (uint64_t)t.tv_nsec;
+}
+
+static int map_buffer(const char *dev, size_t buffer_index, int *fd, uint8_t **buf, uint32_t *size)
+{
+    if (getBufSize(buffer_index, size) != 0)
+    {
+        return -1;
+    }
+    *fd = openDmaDevice(dev, O_RDWR);
+    if (*fd < 0)
+    {
+        fprintf(stderr, "Failed to open %s: %s\n", dev, strerror(errno));
+        return -1;
+    }
+    *buf = (uint8_t *)mapDmaDevice(*fd, *size);
+    if (*buf == MAP_FAILED)
+    {
+        perror("mmap");
+        close(*fd);
+        return -1;
+    }
+    return 0;
+}
+
+static int run_mode(bool cached, unsigned int iterations, struct BenchResult *result)
+{
+    int fd_src, fd_dest;
+    uint8_t *src_buf, *dest_buf;
+    uint32_t size_src, size_dest;
+    uint8_t lines[LINES_PER_CHUNK][BYTES_PER_LINE];
+    uint8_t frame[BYTES_PER_RECEIVE_TRANSMISSION];
+    uint64_t checksum = 0;
+    uint64_t start;
+    size_t chunk = LINES_PER_CHUNK * BYTES_PER_LINE;
+    int rc = -1;
+
+    if (setDmaBufferCached(SRC_BUF_ID, cached) != 0 || setDmaBufferCached(DEST_BUF_ID, cached) != 0)
+    {
+        return -1;
+    }
+    if (map_buffer("/dev/udmabuf0", SRC_BUF_ID, &fd_src, &src_buf, &size_src) != 0)
+    {
+        return -1;
+    }
+    if (map_buffer("/dev/udmabuf1", DEST_BUF_ID, &fd_dest, &dest_buf, &size_dest) != 0)
+    {
+        munmap(src_buf, size_src);
+        close(fd_src);
+        return -1;
+    }
+    if (size_src < chunk || size_dest < FRAMES_PER_RECEIVE_BUFFER * BYTES_PER_RECEIVE_TRANSMISSION)
+    {
+        fprintf(stderr, "Buffers too small: udmabuf0 %u B, udmabuf1 %u B\n", size_src, size_dest);
+        goto out;
+    }
+
+    for (size_t i = 0; i < LINES_PER_CHUNK; i++)
+    {
+        for (size_t b = 0; b < BYTES_PER_LINE; b++)
+        {
+            lines[i][b] = (uint8_t)(i * BYTES_PER_LINE + b);
+        }
+    }
+
+    // Line by line, the way the stream app fills its transmit chunk
+    start = now_ns();
+    for (unsigned int n = 0; n < iterations; n++)
+    {
+        for (size_t i = 0; i < LINES_PER_CHUNK; i++)
+        {
+            memcpy(&src_buf[i * BYTES_PER_LINE], lines[i], BYTES_PER_LINE);
+        }
+        if (cached && syncDmaBufferForDevice(fd_src, 0, (uint32_t)chunk, DMA_SYNC_TO_DEVICE) != 0)
+        {
+            goto out;
+        }
+    }
+    result->tx_ns = (double)(now_ns() - start) / iterations;
+
+    start = now_ns();
+    for (unsigned int n = 0; n < iterations; n++)
+    {
+        uint64_t offset = (uint64_t)(n % FRAMES_PER_RECEIVE_BUFFER) * BYTES_PER_RECEIVE_TRANSMISSION;
+
+        if (cached && syncDmaBufferForCpu(fd_dest, offset, BYTES_PER_RECEIVE_TRANSMISSION, DMA_SYNC_FROM_DEVICE) != 0)
+        {
+            goto out;
+        }
+        memcpy(frame, dest_buf + offset, sizeof(frame));
+        checksum += frame[n % sizeof(frame)];
+    }
+    result->rx_ns = (double)(now_ns() - start) / iterations;
+    // Keeps the copies from being optimised away
+    if (checksum == UINT64_MAX)
+    {
+        printf("\n");
+    }
+    rc = 0;
+
+out:
+    munmap(dest_buf, size_dest);
+    close(fd_dest);
+    munmap(src_buf, size_src);
+    close(fd_src);
+    return rc;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int iterations = DEFAULT_ITERATIONS;
+    struct BenchResult uncached, cached;
+    size_t chunk = LINES_PER_CHUNK * BYTES_PER_LINE;
+
+    if (argc > 2 || (argc == 2 && sscanf(argv[1], "%u", &iterations) != 1) || iterations == 0)
+    {
+        printf("Invalid use. Function expects: dma-buffer-bench [iterations]\n");
+        exit(1);
+    }
+
+    int r = run_mode(false, iterations, &uncached);
+    if (r == 0)
+    {
+        r = run_mode(true, iterations, &cached);
+    }
+    // Whatever happened, leave the buffers the way the overlay set them up
+    setDmaBufferCached(SRC_BUF_ID, false);
+    setDmaBufferCached(DEST_BUF_ID, false);
+    if (r != 0)
+    {
+        return 1;
+    }
+
+    printf("%u iterations, TX chunk %zu B, RX slot %d B\n", iterations, chunk, BYTES_PER_RECEIVE_TRANSMISSION);
+    printf("%-10s %12s %10s %12s %10s\n", "mode", "TX ns", "TX MB/s", "RX ns", "RX MB/s");
+    printf("%-10s %12.0f %10.1f %12.0f %10.1f\n", "uncached", uncached.tx_ns, chunk * 1e3 / uncached.tx_ns, uncached.rx_ns,
+           BYTES_PER_RECEIVE_TRANSMISSION * 1e3 / uncached.rx_ns);
+    printf("%-10s %12.0f %10.1f %12.0f %10.1f\n", "cached", cached.tx_ns, chunk * 1e3 / cached.tx_ns, cached.rx_ns,
+           BYTES_PER_RECEIVE_TRANSMISSION * 1e3 / cached.rx_ns);
+    return 0;
+}
@@ -0,0 +1,252 @@
+#include "dma-reactor.h"
+#include "helper.h"
+
+#include <sched.h>
+#include <time.h>
+
+// Private helper functions
+static int64_t elapsed_ms(const struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)(now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+static int64_t elapsed_us(const struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)(now.tv_sec - since->tv_sec) * 1000000 + (now.tv_nsec - since->tv_nsec) / 1000;
+}
+
+// Run the callback of every armed channel whose transfer has finished
+static int dispatch_channels(struct DmaReactor *reactor)
+{
+    int dispatched = 0;
+
+    for (size_t i = 0; i < 2; i++)
+    {
+        struct DmaReactorWatch *w = &reactor->channel[i];
+        size_t buffer_index = (i == 0) ? SRC_BUF_ID : DEST_BUF_ID;
+        int result;
+
+        if (!w->armed)
+        {
+            continue;
+        }
+
+        uint32_t sr = getDmaStatus(reactor->regs, buffer_index);
+        if (sr & DMA_STATUS_ERR_IRQ)
+        {
+            fprintf(stderr, "DMA error: channel %zu status = 0x%08x\n", buffer_index, sr);
+            ackDmaInterrupt(reactor->regs, buffer_index, DMA_STATUS_IRQ_MASK);
+            result = DMA_FAILED;
+        }
+        else if ((w->desc != NULL) ? (w->desc->status & DMA_SG_STATUS_CMPLT) : (sr & DMA_STATUS_IDLE))
+        {
+            result = DMA_RECEIVED;
+        }
+        else
+        {
+            continue;
+        }
+
+        // Disarm first so the callback can queue the next transfer and re-arm
+        w->armed = false;
+        w->callback(w->arg, result);
+        dispatched++;
+    }
+    return dispatched;
+}
+
+// Spin, then yield, on the status registers before going to sleep in epoll
+static int busy_poll_channels(struct DmaReactor *reactor, const struct timespec *start, int timeout_ms)
+{
+    struct DmaWaitStrategy *wait = reactor->wait;
+    int64_t budget_us = (int64_t)wait->spin_us + wait->yield_us;
+
+    if (budget_us > (int64_t)timeout_ms * 1000)
+    {
+        budget_us = (int64_t)timeout_ms * 1000;
+    }
+    for (;;)
+    {
+        int64_t spent_us = elapsed_us(start);
+        int dispatched = dispatch_channels(reactor);
+
+        if (dispatched > 0)
+        {
+            *getDmaWaitPhaseHits(wait, spent_us) += (uint64_t)dispatched;
+            return dispatched;
+        }
+        if (spent_us >= budget_us)
+        {
+            return 0;
+        }
+        if (spent_us >= wait->spin_us)
+        {
+            sched_yield();
+        }
+    }
+}
+
+// Public methods
+int initDmaReactor(struct DmaReactor *reactor, volatile uint8_t *regs, int fd_uio)
+{
+    memset(reactor, 0, sizeof(*reactor));
+    reactor->regs = regs;
+    reactor->fd_uio = fd_uio;
+
+    reactor->fd_epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (reactor->fd_epoll < 0)
+    {
+        fprintf(stderr, "epoll_create1: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (fd_uio >= 0)
+    {
+        // data.ptr == NULL marks the UIO interrupt
+        struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+        if (epoll_ctl(reactor->fd_epoll, EPOLL_CTL_ADD, fd_uio, &ev) != 0)
+        {
+            fprintf(stderr, "epoll_ctl(uio): %s, completions will be polled\n", strerror(errno));
+            reactor->fd_uio = -1;
+        }
+    }
+    return 0;
+}
+
+void closeDmaReactor(struct DmaReactor *reactor)
+{
+    if (reactor->fd_epoll >= 0)
+    {
+        close(reactor->fd_epoll);
+    }
+    reactor->fd_epoll = -1;
+}
+
+void setDmaReactorWaitStrategy(struct DmaReactor *reactor, struct DmaWaitStrategy *wait)
+{
+    reactor->wait = wait;
+}
+
+void awaitDmaReactorTransfer(struct DmaReactor *reactor, size_t buffer_index, const volatile struct DmaSgDescriptor *desc,
+                             DmaReactorCallback callback, void *arg)
+{
+    struct DmaReactorWatch *w = &reactor->channel[(buffer_index == SRC_BUF_ID) ? 0 : 1];
+
+    w->armed = true;
+    w->fd = -1;
+    w->desc = desc;
+    w->callback = callback;
+    w->arg = arg;
+}
+
+int watchDmaReactorFd(struct DmaReactor *reactor, int fd, uint32_t events, DmaReactorCallback callback, void *arg)
+{
+    struct DmaReactorWatch *w;
+
+    if (reactor->fd_count >= DMA_REACTOR_MAX_FDS)
+    {
+        fprintf(stderr, "DMA reactor can watch at most %d fds\n", DMA_REACTOR_MAX_FDS);
+        return -1;
+    }
+
+    w = &reactor->fds[reactor->fd_count];
+    w->armed = true;
+    w->fd = fd;
+    w->desc = NULL;
+    w->callback = callback;
+    w->arg = arg;
+
+    struct epoll_event ev = {.events = events, .data.ptr = w};
+    if (epoll_ctl(reactor->fd_epoll, EPOLL_CTL_ADD, fd, &ev) != 0)
+    {
+        // Regular files are always ready and are rejected by epoll with EPERM
+        fprintf(stderr, "epoll_ctl(%d): %s\n", fd, strerror(errno));
+        return -1;
+    }
+    reactor->fd_count++;
+    return 0;
+}
+
+int runDmaReactorOnce(struct DmaReactor *reactor, int timeout_ms)
+{
+    struct epoll_event events[DMA_REACTOR_MAX_FDS + 1];
+    struct timespec start;
+    int dispatched;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    // Completions that landed while the caller was busy are served without sleeping
+    dispatched = (reactor->wait != NULL) ? busy_poll_channels(reactor, &start, timeout_ms) : dispatch_channels(reactor);
+    if (dispatched > 0)
+    {
+        return dispatched;
+    }
+
+    for (;;)
+    {
+        int64_t remaining = (int64_t)timeout_ms - elapsed_ms(&start);
+        if (remaining <= 0)
+        {
+            // A zero timeout is a poll, not a wait that ran out
+            if (reactor->wait != NULL && timeout_ms > 0)
+            {
+                reactor->wait->timeouts++;
+            }
+            return 0;
+        }
+        // Without the interrupt fd, wake up every ~1ms to look at the status registers
+        if (reactor->fd_uio < 0 && remaining > 1)
+        {
+            remaining = 1;
+        }
+
+        int n = epoll_wait(reactor->fd_epoll, events, DMA_REACTOR_MAX_FDS + 1, (int)remaining);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "epoll_wait: %s\n", strerror(errno));
+            return -1;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            struct DmaReactorWatch *w = (struct DmaReactorWatch *)events[i].data.ptr;
+
+            if (w == NULL)
+            {
+                uint32_t irq_count;
+                if (read(reactor->fd_uio, &irq_count, sizeof(irq_count)) != (ssize_t)sizeof(irq_count))
+                {
+                    fprintf(stderr, "read(uio): %s, completions will be polled\n", strerror(errno));
+                    epoll_ctl(reactor->fd_epoll, EPOLL_CTL_DEL, reactor->fd_uio, NULL);
+                    reactor->fd_uio = -1;
+                    continue;
+                }
+                // Drop the level interrupt on both channels before unmasking it again,
+                // error bits stay set for dispatch_channels to report
+                ackDmaInterrupt(reactor->regs, SRC_BUF_ID, DMA_STATUS_IOC_IRQ | DMA_STATUS_DLY_IRQ);
+                ackDmaInterrupt(reactor->regs, DEST_BUF_ID, DMA_STATUS_IOC_IRQ | DMA_STATUS_DLY_IRQ);
+                enableDmaInterrupt(reactor->fd_uio);
+                continue;
+            }
+
+            w->callback(w->arg, (int)events[i].events);
+            dispatched++;
+        }
+
+        int completed = dispatch_channels(reactor);
+        if (reactor->wait != NULL)
+        {
+            reactor->wait->fallback_hits += completed;
+        }
+        dispatched += completed;
+        if (dispatched > 0)
+        {
+            return dispatched;
+        }
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef _DMA_REACTOR_H
+#define _DMA_REACTOR_H 1
+
+#include "dma-api.h"
+
+#include <sys/epoll.h>
+
+#define DMA_REACTOR_MAX_FDS 8
+
+// Called once per completion with DMA_RECEIVED/DMA_FAILED, or with the epoll event mask for plain fds
+typedef void (*DmaReactorCallback)(void *arg, int result);
+
+struct DmaReactorWatch
+{
+    bool armed;
+    int fd;
+    const volatile struct DmaSgDescriptor *desc; // NULL waits for the channel to go idle
+    DmaReactorCallback callback;
+    void *arg;
+};
+
+// Single-threaded event loop over both DMA channels and any number of pollable fds.
+// Whichever source becomes ready first is serviced first, so a slow channel no longer
+// holds up the other one.
+struct DmaReactor
+{
+    int fd_epoll;
+    int fd_uio; // -1 when completions are found by polling the status registers
+    volatile uint8_t *regs;
+    struct DmaReactorWatch channel[2];
+    struct DmaReactorWatch fds[DMA_REACTOR_MAX_FDS];
+    size_t fd_count;
+    struct DmaWaitStrategy *wait; // Optional busy-poll phase before epoll, NULL to go straight to sleep
+};
+
+int initDmaReactor(struct DmaReactor *reactor, volatile uint8_t *regs, int fd_uio);
+void closeDmaReactor(struct DmaReactor *reactor);
+void setDmaReactorWaitStrategy(struct DmaReactor *reactor, struct DmaWaitStrategy *wait);
+void awaitDmaReactorTransfer(struct DmaReactor *reactor, size_t buffer_index, const volatile struct DmaSgDescriptor *desc,
+                             DmaReactorCallback callback, void *arg);
+int watchDmaReactorFd(struct DmaReactor *reactor, int fd, uint32_t events, DmaReactorCallback callback, void *arg);
+int runDmaReactorOnce(struct DmaReactor *reactor, int timeout_ms);
+
+#endif
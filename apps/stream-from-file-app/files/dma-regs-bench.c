@@ -0,0 +1,180 @@
+// Measures the hardware register path, a SIM build would route the length writes to the model
+#undef DMA_SIM
+
+#include "dma-api.h"
+#include "helper.h"
+
+#include <inttypes.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+
+// CPU side cost of programming one transfer: re-arm S2MM (address and length) and start
+// MM2S (length), as the streaming loop does per chunk. "call" is the register setters as
+// they were before DMA_CHANNEL_REG, out of line with a ternary per offset. "inline" is the
+// dma-api.h setters with constant buffer indexes. The registers are an ordinary array, so
+// the numbers are the instructions around the stores, not the bus cost of the stores.
+// Instructions are counted with perf_event_open where the kernel allows it.
+
+#define DEFAULT_ITERATIONS 10000000
+#define BENCH_ADDRESS 0x0000000870000000ull
+#define BENCH_LENGTH 0x4000u
+
+struct BenchResult
+{
+    double ns;
+    double instructions; // Negative when no counter is available
+};
+
+static uint32_t regs_storage[0x60 / sizeof(uint32_t)];
+
+static uint64_t now_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000u + (uint64_t)t.tv_nsec;
+}
+
+// Keeps the old setters real calls, as they were into dma-api.c, instead of letting the
+// compiler clone them for the constant arguments used here
+#if defined(__GNUC__) && !defined(__clang__)
+#define OUT_OF_LINE __attribute__((noipa))
+#else
+#define OUT_OF_LINE __attribute__((noinline))
+#endif
+
+// The setters before, kept out of line as they were in dma-api.c
+OUT_OF_LINE static void call_set_address(volatile uint8_t const *reg_map, size_t buffer_index, uint64_t phy_address)
+{
+    uint32_t offset = (buffer_index == SRC_BUF_ID) ? MM2S_SRC_ADDR : S2MM_DEST_ADDR;
+    *(volatile uint32_t *)(reg_map + offset) = (uint32_t)(phy_address & 0xFFFFFFFF);
+    offset = (buffer_index == SRC_BUF_ID) ? MM2S_SRC_ADDR_MSB : S2MM_DEST_ADDR_MSB;
+    *(volatile uint32_t *)(reg_map + offset) = (uint32_t)(phy_address >> 32);
+}
+
+OUT_OF_LINE static void call_set_length(volatile uint8_t const *reg_map, size_t buffer_index, uint32_t transmission_bytes)
+{
+    uint32_t offset = (buffer_index == SRC_BUF_ID) ? MM2S_LENGTH : S2MM_LENGTH;
+    *(volatile uint32_t *)(reg_map + offset) = transmission_bytes;
+}
+
+__attribute__((noinline)) static void run_empty(volatile uint8_t const *regs, unsigned int iterations)
+{
+    for (unsigned int i = 0; i < iterations; i++)
+    {
+        __asm__ volatile("" : : "r"(regs) : "memory");
+    }
+}
+
+__attribute__((noinline)) static void run_call(volatile uint8_t const *regs, unsigned int iterations)
+{
+    for (unsigned int i = 0; i < iterations; i++)
+    {
+        call_set_address(regs, DEST_BUF_ID, BENCH_ADDRESS);
+        call_set_length(regs, DEST_BUF_ID, BENCH_LENGTH);
+        call_set_length(regs, SRC_BUF_ID, BENCH_LENGTH);
+        __asm__ volatile("" : : "r"(regs) : "memory");
+    }
+}
+
+__attribute__((noinline)) static void run_inline(volatile uint8_t const *regs, unsigned int iterations)
+{
+    for (unsigned int i = 0; i < iterations; i++)
+    {
+        setDmaChannelAddress(regs, DEST_BUF_ID, BENCH_ADDRESS);
+        setDmaTransmissionLength(regs, DEST_BUF_ID, BENCH_LENGTH);
+        setDmaTransmissionLength(regs, SRC_BUF_ID, BENCH_LENGTH);
+        __asm__ volatile("" : : "r"(regs) : "memory");
+    }
+}
+
+static int open_instruction_counter(void)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void run(void (*fn)(volatile uint8_t const *, unsigned int), int counter, unsigned int iterations, struct BenchResult *result)
+{
+    volatile uint8_t const *regs = (volatile uint8_t const *)regs_storage;
+    uint64_t count = 0;
+
+    if (counter >= 0)
+    {
+        ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    uint64_t start = now_ns();
+    fn(regs, iterations);
+    uint64_t end = now_ns();
+    if (counter >= 0)
+    {
+        ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+    }
+    result->ns = (double)(end - start) / iterations;
+    if (counter >= 0 && read(counter, &count, sizeof(count)) == (ssize_t)sizeof(count))
+    {
+        result->instructions = (double)count / iterations;
+    }
+    else
+    {
+        result->instructions = -1;
+    }
+}
+
+static void print_result(const char *name, const struct BenchResult *result, const struct BenchResult *empty)
+{
+    if (result->instructions >= 0 && empty->instructions >= 0)
+    {
+        printf("%-7s %8.2f ns/transfer %8.1f instructions/transfer\n", name, result->ns - empty->ns,
+               result->instructions - empty->instructions);
+    }
+    else
+    {
+        printf("%-7s %8.2f ns/transfer %8s instructions/transfer\n", name, result->ns - empty->ns, "n/a");
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int iterations = DEFAULT_ITERATIONS;
+    struct BenchResult empty, call, inlined;
+
+    if (argc > 2 || (argc == 2 && sscanf(argv[1], "%u", &iterations) != 1) || iterations == 0)
+    {
+        fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+        exit(1);
+    }
+
+    int counter = open_instruction_counter();
+    if (counter < 0)
+    {
+        fprintf(stderr, "WARNING: no instruction counter (%s), timing only\n", strerror(errno));
+    }
+
+    // Warm up, then the loop overhead is measured alone and taken off the others
+    run(run_call, counter, iterations / 10 + 1, &call);
+    run(run_inline, counter, iterations / 10 + 1, &inlined);
+    run(run_empty, counter, iterations, &empty);
+    run(run_call, counter, iterations, &call);
+    run(run_inline, counter, iterations, &inlined);
+
+    printf("%u transfers: S2MM address + S2MM length + MM2S length\n", iterations);
+    print_result("call", &call, &empty);
+    print_result("inline", &inlined, &empty);
+
+    if (counter >= 0)
+    {
+        close(counter);
+    }
+    return 0;
+}
@@ -0,0 +1,553 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <signal.h>
+#include <inttypes.h>
+
+#include "dma-api.h"
+#include "dma-sim.h"
+
+#define SIM_FIFO_BYTES (1 << 20) // AXI-Stream data in flight between MM2S and S2MM in loopback mode
+
+struct SimChannel
+{
+    bool busy;
+    uint64_t address;
+    uint32_t length;
+    uint64_t transfers;
+    uint64_t bytes;
+};
+
+struct SimDma
+{
+    pthread_mutex_t lock;
+    pthread_t worker;
+    int fd_regs;
+    int fd_buf[DMA_SIM_BUFFERS];
+    uint32_t size_buf[DMA_SIM_BUFFERS];
+    uint8_t *buf[DMA_SIM_BUFFERS];
+    volatile uint8_t *regs;
+    int sock[2];  // [0] is what the app gets for /dev/uioN, [1] is the worker's end
+    int fd_kick;  // eventfd, register writes that start work wake the worker
+    bool irq_unmasked;
+    struct SimChannel ch[2];
+
+    bool source_mode;
+    uint32_t frame_us;
+    uint32_t error_every;
+    uint8_t length_width;
+    uint64_t s2mm_count;
+    struct timespec next_frame;
+    struct timespec started;
+
+    uint8_t *fifo;
+    size_t fifo_head;
+    size_t fifo_fill;
+};
+
+static struct SimDma sim;
+static pthread_once_t sim_once = PTHREAD_ONCE_INIT;
+static bool sim_ready;
+
+// Private helper functions
+static inline uint32_t sim_read(uint32_t off)
+{
+    return *(volatile uint32_t *)(sim.regs + off);
+}
+
+static inline void sim_write(uint32_t off, uint32_t val)
+{
+    *(volatile uint32_t *)(sim.regs + off) = val;
+}
+
+static uint32_t env_u32(const char *name, uint32_t fallback)
+{
+    const char *v = getenv(name);
+    return (v != NULL && *v != '\0') ? (uint32_t)strtoul(v, NULL, 0) : fallback;
+}
+
+static void timespec_add_us(struct timespec *t, uint32_t us)
+{
+    t->tv_nsec += (long)us * 1000;
+    while (t->tv_nsec >= 1000000000L)
+    {
+        t->tv_nsec -= 1000000000L;
+        t->tv_sec++;
+    }
+}
+
+static int64_t us_until(const struct timespec *t)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)(t->tv_sec - now.tv_sec) * 1000000 + (t->tv_nsec - now.tv_nsec) / 1000;
+}
+
+// Physical address to the simulated buffer holding [address, address + length)
+static uint8_t *sim_translate(uint64_t address, uint32_t length)
+{
+    for (size_t i = 0; i < DMA_SIM_BUFFERS; i++)
+    {
+        uint64_t phy = DMA_SIM_PHY_BASE + (uint64_t)i * DMA_SIM_PHY_STRIDE;
+        if (address >= phy && address + length <= phy + sim.size_buf[i])
+        {
+            return sim.buf[i] + (address - phy);
+        }
+    }
+    return NULL;
+}
+
+// The uio_pdrv_genirq line is level triggered on IOC/Dly/Err of either channel
+// and masked again every time it fires, until the app writes to the fd.
+static void sim_update_irq(void)
+{
+    uint32_t pending = 0;
+    static uint32_t irq_count;
+
+    for (size_t i = 0; i < 2; i++)
+    {
+        uint32_t base = (uint32_t)i * DMA_S2MM_BANK;
+        pending |= sim_read(base + MM2S_STATUS) & sim_read(base + MM2S_CRTL) & DMA_STATUS_IRQ_MASK;
+    }
+    if (pending && sim.irq_unmasked)
+    {
+        irq_count++;
+        sim.irq_unmasked = false;
+        if (write(sim.sock[1], &irq_count, sizeof(irq_count)) != (ssize_t)sizeof(irq_count))
+        {
+            fprintf(stderr, "dma-sim: interrupt write: %s\n", strerror(errno));
+        }
+    }
+}
+
+static void sim_finish(size_t i, uint32_t error_bits)
+{
+    uint32_t sr_off = (uint32_t)i * DMA_S2MM_BANK + MM2S_STATUS;
+    uint32_t sr = sim_read(sr_off);
+
+    sim.ch[i].busy = false;
+    if (error_bits)
+    {
+        // Errors halt the channel until the next reset
+        sr |= error_bits | DMA_STATUS_ERR_IRQ | DMA_STATUS_HALTED;
+    }
+    else
+    {
+        sr |= DMA_STATUS_IDLE | DMA_STATUS_IOC_IRQ;
+        sim.ch[i].transfers++;
+        sim.ch[i].bytes += sim.ch[i].length;
+    }
+    sim_write(sr_off, sr);
+}
+
+static bool sim_run_mm2s(void)
+{
+    struct SimChannel *c = &sim.ch[0];
+    uint8_t *src;
+
+    if (!c->busy)
+        return false;
+    src = sim_translate(c->address, c->length);
+    if (src == NULL)
+    {
+        sim_finish(0, DMA_STATUS_DEC_ERR);
+        return true;
+    }
+    if (!sim.source_mode)
+    {
+        // Backpressure: the stream stalls until S2MM drains enough
+        if (SIM_FIFO_BYTES - sim.fifo_fill < c->length)
+            return false;
+        for (uint32_t n = 0; n < c->length;)
+        {
+            size_t tail = (sim.fifo_head + sim.fifo_fill) % SIM_FIFO_BYTES;
+            size_t chunk = SIM_FIFO_BYTES - tail;
+            if (chunk > c->length - n)
+                chunk = c->length - n;
+            memcpy(sim.fifo + tail, src + n, chunk);
+            sim.fifo_fill += chunk;
+            n += (uint32_t)chunk;
+        }
+    }
+    sim_finish(0, 0);
+    return true;
+}
+
+static bool sim_run_s2mm(void)
+{
+    struct SimChannel *c = &sim.ch[1];
+    uint8_t *dst;
+
+    if (!c->busy)
+        return false;
+    dst = sim_translate(c->address, c->length);
+    if (dst == NULL)
+    {
+        sim_finish(1, DMA_STATUS_DEC_ERR);
+        return true;
+    }
+
+    if (sim.source_mode)
+    {
+        if (sim.frame_us > 0 && us_until(&sim.next_frame) > 0)
+            return false;
+        // Frame number in every word, enough to spot dropped or repeated frames
+        for (uint32_t n = 0; n + sizeof(uint64_t) <= c->length; n += sizeof(uint64_t))
+        {
+            memcpy(dst + n, &sim.s2mm_count, sizeof(uint64_t));
+        }
+        timespec_add_us(&sim.next_frame, sim.frame_us);
+    }
+    else
+    {
+        // Buffer-full completion, the PL side is not modelled packet by packet
+        if (sim.fifo_fill < c->length)
+            return false;
+        for (uint32_t n = 0; n < c->length;)
+        {
+            size_t chunk = SIM_FIFO_BYTES - sim.fifo_head;
+            if (chunk > c->length - n)
+                chunk = c->length - n;
+            memcpy(dst + n, sim.fifo + sim.fifo_head, chunk);
+            sim.fifo_head = (sim.fifo_head + chunk) % SIM_FIFO_BYTES;
+            sim.fifo_fill -= chunk;
+            n += (uint32_t)chunk;
+        }
+    }
+
+    sim.s2mm_count++;
+    if (sim.error_every > 0 && sim.s2mm_count % sim.error_every == 0)
+    {
+        sim_finish(1, DMA_STATUS_SLV_ERR);
+        return true;
+    }
+    sim_finish(1, 0);
+    return true;
+}
+
+static void *sim_worker(void *arg)
+{
+    struct pollfd pfd[2] = {{.fd = sim.sock[1], .events = POLLIN}, {.fd = sim.fd_kick, .events = POLLIN}};
+    (void)arg;
+
+    for (;;)
+    {
+        int timeout = -1;
+
+        pthread_mutex_lock(&sim.lock);
+        while (sim_run_mm2s() | sim_run_s2mm())
+        {
+        }
+        sim_update_irq();
+        // A paced frame source has to wake up on its own
+        if (sim.source_mode && sim.frame_us > 0 && sim.ch[1].busy)
+        {
+            int64_t us = us_until(&sim.next_frame);
+            timeout = (us <= 0) ? 0 : (int)((us + 999) / 1000);
+        }
+        pthread_mutex_unlock(&sim.lock);
+
+        if (poll(pfd, 2, timeout) < 0 && errno != EINTR)
+        {
+            fprintf(stderr, "dma-sim: poll: %s\n", strerror(errno));
+            return NULL;
+        }
+        if (pfd[0].revents & POLLIN)
+        {
+            uint32_t unmask;
+            if (read(sim.sock[1], &unmask, sizeof(unmask)) == (ssize_t)sizeof(unmask) && unmask)
+            {
+                pthread_mutex_lock(&sim.lock);
+                sim.irq_unmasked = true;
+                pthread_mutex_unlock(&sim.lock);
+            }
+        }
+        if (pfd[0].revents & (POLLHUP | POLLERR))
+        {
+            // The app closed its uio fd
+            return NULL;
+        }
+        if (pfd[1].revents & POLLIN)
+        {
+            uint64_t kicks;
+            (void)read(sim.fd_kick, &kicks, sizeof(kicks));
+        }
+    }
+}
+
+static void sim_report(void)
+{
+    struct timespec now;
+    double seconds;
+    char line[160];
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    seconds = (double)(now.tv_sec - sim.started.tv_sec) + (double)(now.tv_nsec - sim.started.tv_nsec) / 1e9;
+    for (size_t i = 0; i < 2; i++)
+    {
+        int n = snprintf(line, sizeof(line), "dma-sim %s: %" PRIu64 " transfers, %" PRIu64 " B, %.2f MB/s\n",
+                         (i == 0) ? "MM2S" : "S2MM", sim.ch[i].transfers, sim.ch[i].bytes,
+                         (seconds > 0) ? (double)sim.ch[i].bytes / seconds / 1e6 : 0.0);
+        // write(2) rather than stdio, this also runs from the signal handler
+        if (n > 0)
+            (void)write(STDERR_FILENO, line, (size_t)n);
+    }
+}
+
+// The apps stream until they are killed, report the numbers on the way out too
+static void sim_signal(int signo)
+{
+    sim_report();
+    signal(signo, SIG_DFL);
+    raise(signo);
+}
+
+static void sim_catch(int signo)
+{
+    struct sigaction old;
+
+    if (sigaction(signo, NULL, &old) == 0 && old.sa_handler == SIG_DFL)
+    {
+        signal(signo, sim_signal);
+    }
+}
+
+static void sim_init(void)
+{
+    static const uint32_t default_size[DMA_SIM_BUFFERS] = {0x800, 0x8000, 0x1000};
+    const char *mode = getenv("DMA_SIM_MODE");
+    char name[32];
+
+    pthread_mutex_init(&sim.lock, NULL);
+    sim.source_mode = (mode != NULL && strcmp(mode, "source") == 0);
+    sim.frame_us = env_u32("DMA_SIM_FRAME_US", 0);
+    sim.error_every = env_u32("DMA_SIM_ERROR_EVERY", 0);
+    sim.length_width = (uint8_t)env_u32("DMA_SIM_LENGTH_WIDTH", DMA_LENGTH_WIDTH_MAX);
+    if (sim.length_width < DMA_LENGTH_WIDTH_MIN || sim.length_width > DMA_LENGTH_WIDTH_MAX)
+    {
+        sim.length_width = DMA_LENGTH_WIDTH_MAX;
+    }
+
+    sim.fd_regs = memfd_create("dma-sim-regs", MFD_CLOEXEC);
+    if (sim.fd_regs < 0 || ftruncate(sim.fd_regs, REG_MAP_SIZE) != 0)
+    {
+        fprintf(stderr, "dma-sim: register file: %s\n", strerror(errno));
+        return;
+    }
+    sim.regs = (volatile uint8_t *)mmap(NULL, REG_MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, sim.fd_regs, 0);
+    if (sim.regs == MAP_FAILED)
+    {
+        fprintf(stderr, "dma-sim: mmap(regs): %s\n", strerror(errno));
+        return;
+    }
+    sim_write(MM2S_STATUS, DMA_STATUS_HALTED);
+    sim_write(S2MM_STATUS, DMA_STATUS_HALTED);
+
+    for (size_t i = 0; i < DMA_SIM_BUFFERS; i++)
+    {
+        snprintf(name, sizeof(name), "DMA_SIM_UDMABUF%zu_SIZE", i);
+        sim.size_buf[i] = env_u32(name, default_size[i]);
+        if (sim.size_buf[i] > DMA_SIM_PHY_STRIDE)
+        {
+            sim.size_buf[i] = DMA_SIM_PHY_STRIDE;
+        }
+        snprintf(name, sizeof(name), "udmabuf%zu", i);
+        sim.fd_buf[i] = memfd_create(name, MFD_CLOEXEC);
+        if (sim.fd_buf[i] < 0 || ftruncate(sim.fd_buf[i], sim.size_buf[i]) != 0)
+        {
+            fprintf(stderr, "dma-sim: %s: %s\n", name, strerror(errno));
+            return;
+        }
+        sim.buf[i] = (uint8_t *)mmap(NULL, sim.size_buf[i], PROT_READ | PROT_WRITE, MAP_SHARED, sim.fd_buf[i], 0);
+        if (sim.buf[i] == MAP_FAILED)
+        {
+            fprintf(stderr, "dma-sim: mmap(%s): %s\n", name, strerror(errno));
+            return;
+        }
+    }
+
+    sim.fifo = (uint8_t *)malloc(SIM_FIFO_BYTES);
+    sim.fd_kick = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (sim.fifo == NULL || sim.fd_kick < 0 || socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sim.sock) != 0)
+    {
+        fprintf(stderr, "dma-sim: setup: %s\n", strerror(errno));
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &sim.started);
+    sim.next_frame = sim.started;
+    if (pthread_create(&sim.worker, NULL, sim_worker, NULL) != 0)
+    {
+        fprintf(stderr, "dma-sim: failed to start the worker\n");
+        return;
+    }
+    pthread_detach(sim.worker);
+    atexit(sim_report);
+    sim_catch(SIGINT);
+    sim_catch(SIGTERM);
+    fprintf(stderr, "dma-sim: simulated AXI DMA in %s mode\n", sim.source_mode ? "frame source" : "loopback");
+    sim_ready = true;
+}
+
+static bool sim_start(void)
+{
+    pthread_once(&sim_once, sim_init);
+    return sim_ready;
+}
+
+// Public methods
+int simDmaOpen(const char *path)
+{
+    unsigned int n;
+
+    if (!sim_start())
+    {
+        errno = ENODEV;
+        return -1;
+    }
+    if (sscanf(path, "/dev/udmabuf%u", &n) == 1 && n < DMA_SIM_BUFFERS)
+    {
+        return dup(sim.fd_buf[n]);
+    }
+    if (strncmp(path, "/dev/uio", 8) == 0)
+    {
+        // Only one register file, later opens share the interrupt socket
+        return dup(sim.sock[0]);
+    }
+    errno = ENOENT;
+    return -1;
+}
+
+void *simDmaMap(int fd, size_t length)
+{
+    struct stat st;
+    int fd_map = fd;
+
+    if (!sim_start())
+    {
+        return MAP_FAILED;
+    }
+    // The uio fd is a socket, the registers behind it live in their own memfd
+    if (fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode))
+    {
+        fd_map = sim.fd_regs;
+    }
+    return mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd_map, 0);
+}
+
+int simDmaBufferInfo(const char *device_name, uint64_t *phy_addr, uint32_t *size)
+{
+    unsigned int n;
+
+    if (!sim_start() || sscanf(device_name, "udmabuf%u", &n) != 1 || n >= DMA_SIM_BUFFERS)
+    {
+        return -1;
+    }
+    if (phy_addr != NULL)
+    {
+        *phy_addr = DMA_SIM_PHY_BASE + (uint64_t)n * DMA_SIM_PHY_STRIDE;
+    }
+    if (size != NULL)
+    {
+        *size = sim.size_buf[n];
+    }
+    return 0;
+}
+
+uint8_t simDmaLengthWidth(void)
+{
+    return sim_start() ? sim.length_width : DMA_LENGTH_WIDTH_MAX;
+}
+
+void simDmaRegWrite(uint32_t offset, uint32_t value)
+{
+    size_t i = (offset >= DMA_S2MM_BANK) ? 1 : 0;
+    uint32_t base = (uint32_t)i * DMA_S2MM_BANK;
+    uint32_t local = offset - base;
+    uint64_t kick = 1;
+    bool wake = false;
+
+    if (!sim_start())
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&sim.lock);
+    switch (local)
+    {
+    case MM2S_CRTL:
+        if (value & DMA_CRTL_RESET)
+        {
+            // A soft reset on either channel resets the whole engine
+            for (size_t c = 0; c < 2; c++)
+            {
+                sim_write((uint32_t)c * DMA_S2MM_BANK + MM2S_CRTL, 0);
+                sim_write((uint32_t)c * DMA_S2MM_BANK + MM2S_STATUS, DMA_STATUS_HALTED);
+                sim.ch[c].busy = false;
+            }
+            sim.fifo_head = 0;
+            sim.fifo_fill = 0;
+            break;
+        }
+        sim_write(offset, value);
+        if (value & DMA_CRTL_RUN_STOP)
+        {
+            uint32_t sr = sim_read(base + MM2S_STATUS);
+            // An errored channel stays halted until reset
+            if (!(sr & DMA_STATUS_ERR_MASK))
+            {
+                sr &= ~DMA_STATUS_HALTED;
+                if (!sim.ch[i].busy)
+                    sr |= DMA_STATUS_IDLE;
+            }
+            sim_write(base + MM2S_STATUS, sr);
+        }
+        else
+        {
+            sim_write(base + MM2S_STATUS, sim_read(base + MM2S_STATUS) | DMA_STATUS_HALTED);
+        }
+        wake = true;
+        break;
+    case MM2S_STATUS:
+        // Only the interrupt bits are writable, and they clear on 1
+        sim_write(offset, sim_read(offset) & ~(value & DMA_STATUS_IRQ_MASK));
+        break;
+    case MM2S_LENGTH:
+        // Like the IP, bits above the configured width are simply not there
+        value &= (1u << sim.length_width) - 1;
+        sim_write(offset, value);
+        if (value != 0 && !sim.ch[i].busy && !(sim_read(base + MM2S_STATUS) & DMA_STATUS_HALTED))
+        {
+            uint32_t addr_off = base + MM2S_SRC_ADDR; // S2MM_DEST_ADDR in the S2MM bank
+            sim.ch[i].address = ((uint64_t)sim_read(addr_off + 4) << 32) | sim_read(addr_off);
+            sim.ch[i].length = value;
+            sim.ch[i].busy = true;
+            // Idle drops as soon as the length is written, like on the hardware
+            sim_write(base + MM2S_STATUS, sim_read(base + MM2S_STATUS) & ~DMA_STATUS_IDLE);
+            wake = true;
+        }
+        break;
+    default:
+        sim_write(offset, value);
+        break;
+    }
+    sim_update_irq();
+    pthread_mutex_unlock(&sim.lock);
+
+    if (wake && write(sim.fd_kick, &kick, sizeof(kick)) != (ssize_t)sizeof(kick) && errno != EAGAIN)
+    {
+        fprintf(stderr, "dma-sim: kick: %s\n", strerror(errno));
+    }
+}
@@ -0,0 +1,176 @@
+// Checks the UIO interrupt path of the completion waits on the hardware register path
+#undef DMA_SIM
+
+#include "dma-api.h"
+#include "helper.h"
+
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <time.h>
+
+// The registers are an ordinary array and the UIO device is one end of a socketpair, the
+// test plays the kernel on the other end: writing a 4 byte count raises the interrupt,
+// what the wait writes back are its unmasks. Each case checks the wait's result and that
+// it leaves neither an event behind nor an unmask it did not owe, a stale event would
+// show up as an extra unmask in the case after it.
+
+#define CHECK_TIMEOUT_MS 100
+#define CHECK_SHORT_TIMEOUT_MS 20
+#define CHECK_LATE_MS 5 // When the completion of the in-time case arrives
+
+static uint32_t regs_storage[0x60 / sizeof(uint32_t)];
+static volatile uint8_t *regs = (volatile uint8_t *)regs_storage;
+static int fd_uio = -1;    // The app's end
+static int fd_kernel = -1; // The test's end
+static uint32_t irq_count;
+static int failures;
+
+static void check(bool ok, const char *what)
+{
+    printf("%-4s %s\n", ok ? "ok" : "FAIL", what);
+    if (!ok)
+    {
+        failures++;
+    }
+}
+
+static uint64_t now_us(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000u + (uint64_t)t.tv_nsec / 1000u;
+}
+
+static void set_status(uint32_t sr)
+{
+    *(volatile uint32_t *)(regs + S2MM_STATUS) = sr;
+}
+
+static void raise_irq(void)
+{
+    irq_count++;
+    if (write(fd_kernel, &irq_count, sizeof(irq_count)) != (ssize_t)sizeof(irq_count))
+    {
+        fprintf(stderr, "write(socketpair): %s\n", strerror(errno));
+        exit(1);
+    }
+}
+
+static bool event_pending(void)
+{
+    struct pollfd pfd = {.fd = fd_uio, .events = POLLIN};
+    return poll(&pfd, 1, 0) == 1;
+}
+
+// Unmasks written since the last call, -1 for anything that is not a 1
+static int take_unmasks(void)
+{
+    struct pollfd pfd = {.fd = fd_kernel, .events = POLLIN};
+    uint32_t value;
+    int count = 0;
+
+    while (poll(&pfd, 1, 0) == 1)
+    {
+        if (read(fd_kernel, &value, sizeof(value)) != (ssize_t)sizeof(value) || value != 1)
+        {
+            return -1;
+        }
+        count++;
+    }
+    return count;
+}
+
+static void *complete_late(void *arg)
+{
+    (void)arg;
+    sleep_ms(CHECK_LATE_MS);
+    // The interrupt goes first, a wait that sees the status done finds it pending
+    raise_irq();
+    set_status(DMA_STATUS_IDLE | DMA_STATUS_IOC_IRQ);
+    return NULL;
+}
+
+static void check_early_completion(void)
+{
+    set_status(DMA_STATUS_IDLE | DMA_STATUS_IOC_IRQ);
+    raise_irq();
+    int result = waitDmaTransmissionDoneIrq(fd_uio, regs, DEST_BUF_ID, CHECK_TIMEOUT_MS);
+    check(result == DMA_RECEIVED, "early completion: received");
+    check(!event_pending(), "early completion: pending event consumed");
+    check(take_unmasks() == 1, "early completion: interrupt unmasked once");
+}
+
+static void check_early_completion_adaptive(void)
+{
+    struct DmaWaitStrategy wait;
+
+    initDmaWaitStrategy(&wait, DMA_WAIT_IRQ, 50, 0);
+    set_status(DMA_STATUS_IDLE | DMA_STATUS_IOC_IRQ);
+    raise_irq();
+    int result = waitDmaTransmissionAdaptive(&wait, fd_uio, regs, DEST_BUF_ID, CHECK_TIMEOUT_MS);
+    check(result == DMA_RECEIVED && wait.spin_hits == 1, "adaptive early completion: received while spinning");
+    check(!event_pending(), "adaptive early completion: pending event consumed");
+    check(take_unmasks() == 1, "adaptive early completion: interrupt unmasked once");
+}
+
+static void check_in_time(void)
+{
+    pthread_t thread;
+
+    set_status(0);
+    if (pthread_create(&thread, NULL, complete_late, NULL) != 0)
+    {
+        fprintf(stderr, "pthread_create failed\n");
+        exit(1);
+    }
+    uint64_t start = now_us();
+    int result = waitDmaTransmissionDoneIrq(fd_uio, regs, DEST_BUF_ID, CHECK_TIMEOUT_MS);
+    uint64_t spent = now_us() - start;
+    pthread_join(thread, NULL);
+    check(result == DMA_RECEIVED && spent < CHECK_TIMEOUT_MS * 1000u, "completion in time: received before the timeout");
+    check(!event_pending(), "completion in time: event consumed");
+    check(take_unmasks() == 1, "completion in time: interrupt unmasked once");
+}
+
+static void check_timeout(void)
+{
+    set_status(0);
+    uint64_t start = now_us();
+    int result = waitDmaTransmissionDoneIrq(fd_uio, regs, DEST_BUF_ID, CHECK_SHORT_TIMEOUT_MS);
+    uint64_t spent = now_us() - start;
+    check(result == DMA_TIMEOUT && spent >= CHECK_SHORT_TIMEOUT_MS * 1000u, "timeout: timed out after the full timeout");
+    check(!event_pending(), "timeout: no event left behind");
+    check(take_unmasks() == 0, "timeout: no stale event woke it up");
+}
+
+int main(void)
+{
+    int sv[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+    {
+        fprintf(stderr, "socketpair: %s\n", strerror(errno));
+        exit(1);
+    }
+    fd_uio = sv[0];
+    fd_kernel = sv[1];
+
+    // Each case runs after the previous one, so an event it left behind is caught there
+    check_early_completion();
+    check_timeout();
+    check_early_completion_adaptive();
+    check_timeout();
+    check_in_time();
+    check_timeout();
+
+    close(fd_uio);
+    close(fd_kernel);
+    if (failures > 0)
+    {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
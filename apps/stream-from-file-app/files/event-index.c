@@ -0,0 +1,356 @@
+#include "event-index.h"
+#include "event-pacer.h"
+#include "event-pack.h"
+
+#include <inttypes.h>
+
+// Private helper functions
+static inline uint64_t load_word(const uint8_t *p)
+{
+    uint64_t w = 0;
+
+    for (int i = 0; i < BYTES_PER_LINE; i++)
+    {
+        w = (w << 8) | p[i];
+    }
+    return w;
+}
+
+// Advance the clock to the EVT_TIME_HIGH word w. The first one is at first_us.
+static void clock_time_high(struct EventClock *clock, uint64_t w, uint64_t first_us)
+{
+    uint64_t t = ((w >> 32) & ((1u << EVT21_TIME_HIGH_BITS) - 1)) << EVT21_TIME_LOW_BITS;
+
+    if (!clock->synced)
+    {
+        clock->synced = true;
+        clock->time_us = first_us;
+    }
+    else
+    {
+        // Wraps of the 34 bit timestamp come out as a small step forward, a step back
+        // (more than half a wrap forward) leaves the time where it was
+        uint64_t delta = (t - clock->time_high) & (EVT21_TIME_WRAP_US - 1);
+        if (delta < EVT21_TIME_WRAP_US / 2)
+        {
+            clock->time_us += delta;
+        }
+    }
+    clock->time_high = t;
+}
+
+static int add_entry(struct EventIndex *index, uint64_t offset, uint64_t word)
+{
+    if (index->count == index->capacity)
+    {
+        size_t capacity = (index->capacity > 0) ? 2 * index->capacity : 1024;
+        struct EventIndexEntry *entry = realloc(index->entry, capacity * sizeof(*entry));
+        if (entry == NULL)
+        {
+            fprintf(stderr, "Failed to allocate %zu index entries\n", capacity);
+            return -1;
+        }
+        index->entry = entry;
+        index->capacity = capacity;
+    }
+    index->entry[index->count].time_us = index->clock.time_us;
+    index->entry[index->count].offset = offset;
+    index->entry[index->count].word = word;
+    index->count++;
+    return 0;
+}
+
+static int64_t mtime_ns(const struct stat *st)
+{
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+static char *index_path(const char *recording_path, const char *suffix)
+{
+    size_t len = strlen(recording_path) + strlen(suffix) + 1;
+    char *path = malloc(len);
+
+    if (path != NULL)
+    {
+        snprintf(path, len, "%s%s", recording_path, suffix);
+    }
+    return path;
+}
+
+// Returns 0 when path holds an up to date index of recording, 1 when it has to be built
+static int read_index(struct EventIndex *index, const char *path, const struct EventRecording *recording)
+{
+    struct EventIndexHeader header;
+    struct stat st, recording_st;
+    FILE *f = fopen(path, "rb");
+
+    if (f == NULL)
+    {
+        return 1;
+    }
+    if (fstat(fileno(f), &st) != 0 || fstat(recording->fd, &recording_st) != 0 || fread(&header, sizeof(header), 1, f) != 1 ||
+        memcmp(header.magic, EVENT_INDEX_MAGIC, sizeof(header.magic)) != 0 || header.version != EVENT_INDEX_VERSION ||
+        header.entry_size != sizeof(struct EventIndexEntry) || header.recording_size != (uint64_t)recording_st.st_size ||
+        header.recording_words != recording->count || header.recording_inode != (uint64_t)recording_st.st_ino ||
+        header.recording_mtime_ns != mtime_ns(&recording_st) ||
+        header.entries > ((uint64_t)st.st_size - sizeof(header)) / sizeof(struct EventIndexEntry))
+    {
+        fclose(f);
+        return 1;
+    }
+    index->entry = malloc((header.entries > 0 ? header.entries : 1) * sizeof(struct EventIndexEntry));
+    if (index->entry == NULL || fread(index->entry, sizeof(struct EventIndexEntry), header.entries, f) != header.entries)
+    {
+        free(index->entry);
+        index->entry = NULL;
+        fclose(f);
+        return 1;
+    }
+    index->count = header.entries;
+    index->capacity = header.entries;
+    fclose(f);
+    return 0;
+}
+
+// Walk the blocks of a packed recording, each one is decompressed to find its first EVT_TIME_HIGH
+static int index_packed(struct EventIndex *index, const struct EventRecording *recording)
+{
+    uint64_t offset = sizeof(struct EventRecordingHeader), word = 0;
+    uint8_t *packed = malloc(EVENT_PACK_MAX_BYTES(EVENT_PACK_BLOCK_WORDS));
+    uint8_t *words = malloc(EVENT_PACK_BLOCK_WORDS * BYTES_PER_LINE);
+    int r = 0;
+
+    if (packed == NULL || words == NULL)
+    {
+        fprintf(stderr, "Failed to allocate the index buffers\n");
+        r = -1;
+    }
+    while (r == 0 && word < recording->count)
+    {
+        struct EventPackBlockHeader header;
+
+        if (pread(recording->fd, &header, sizeof(header), (off_t)offset) != (ssize_t)sizeof(header) || header.words == 0 ||
+            header.words > EVENT_PACK_BLOCK_WORDS || header.bytes > EVENT_PACK_MAX_BYTES(EVENT_PACK_BLOCK_WORDS))
+        {
+            fprintf(stderr, "Corrupt block header after %" PRIu64 " words of the packed recording\n", word);
+            r = -1;
+            break;
+        }
+        bool raw = (header.bytes == header.words * BYTES_PER_LINE);
+        if (pread(recording->fd, raw ? words : packed, header.bytes, (off_t)(offset + sizeof(header))) != (ssize_t)header.bytes ||
+            (!raw && unpackEventWords(packed, header.bytes, words, header.words) != 0))
+        {
+            fprintf(stderr, "Corrupt block after %" PRIu64 " words of the packed recording\n", word);
+            r = -1;
+            break;
+        }
+        r = indexEventWords(index, words, header.words, offset, word, true);
+        offset += sizeof(header) + header.bytes;
+        word += header.words;
+    }
+    free(words);
+    free(packed);
+    return r;
+}
+
+// Public methods
+void initEventIndex(struct EventIndex *index)
+{
+    memset(index, 0, sizeof(*index));
+}
+
+void freeEventIndex(struct EventIndex *index)
+{
+    free(index->entry);
+    initEventIndex(index);
+}
+
+// Add the next count words of a recording, the first of them being word `word` at file
+// offset `offset`. A block is one block of a packed recording starting at offset, which
+// has to be read whole, so it gets at most one entry.
+int indexEventWords(struct EventIndex *index, const uint8_t *words, size_t count, uint64_t offset, uint64_t word, bool block)
+{
+    bool first = true;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        uint64_t w = load_word(words + i * BYTES_PER_LINE);
+
+        if ((unsigned int)(w >> 60) != EVT21_TYPE_TIME_HIGH)
+        {
+            continue;
+        }
+        clock_time_high(&index->clock, w, 0);
+        if (block && !first)
+        {
+            continue;
+        }
+        first = false;
+        if (index->count > 0 && index->clock.time_us < index->entry[index->count - 1].time_us + EVENT_INDEX_INTERVAL_US)
+        {
+            continue;
+        }
+        int r = block ? add_entry(index, offset, word) : add_entry(index, offset + i * BYTES_PER_LINE, word + i);
+        if (r != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Write the index next to the recording as <recording>.idx. recording_st is the stat of
+// the recording as it is indexed. It is written under a temporary name first, so a
+// reader never finds half an index.
+int saveEventIndex(const struct EventIndex *index, const char *recording_path, const struct stat *recording_st, uint64_t recording_words)
+{
+    struct EventIndexHeader header = {.magic = EVENT_INDEX_MAGIC,
+                                      .version = EVENT_INDEX_VERSION,
+                                      .entry_size = sizeof(struct EventIndexEntry),
+                                      .entries = index->count,
+                                      .recording_size = (uint64_t)recording_st->st_size,
+                                      .recording_words = recording_words,
+                                      .recording_inode = (uint64_t)recording_st->st_ino,
+                                      .recording_mtime_ns = mtime_ns(recording_st)};
+    char *path = index_path(recording_path, EVENT_INDEX_SUFFIX);
+    char *tmp = index_path(recording_path, EVENT_INDEX_SUFFIX ".tmp");
+    FILE *f = NULL;
+    int r = -1;
+
+    if (path != NULL && tmp != NULL)
+    {
+        f = fopen(tmp, "wb");
+    }
+    if (f != NULL)
+    {
+        bool written = (fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(index->entry, sizeof(struct EventIndexEntry), index->count, f) == index->count);
+        if (fclose(f) == 0 && written && rename(tmp, path) == 0)
+        {
+            r = 0;
+        }
+        else
+        {
+            unlink(tmp);
+        }
+    }
+    free(tmp);
+    free(path);
+    return r;
+}
+
+// Load the index of a recording from <recording_path>.idx. Without one, or with one that
+// does not match the recording, it is built by reading the recording through and saved
+// for the next time. Returns 0 on success and -1 on error.
+int loadEventIndex(struct EventIndex *index, const char *recording_path, const struct EventRecording *recording)
+{
+    char *path = index_path(recording_path, EVENT_INDEX_SUFFIX);
+    int r;
+
+    initEventIndex(index);
+    if (path == NULL)
+    {
+        fprintf(stderr, "Failed to allocate the index path\n");
+        return -1;
+    }
+    if (read_index(index, path, recording) == 0)
+    {
+        free(path);
+        return 0;
+    }
+
+    printf("INFO: Building the time index of %s\n", recording_path);
+    if (recording->packed)
+    {
+        r = index_packed(index, recording);
+    }
+    else
+    {
+        r = indexEventWords(index, recording->words, recording->count, sizeof(struct EventRecordingHeader), 0, false);
+    }
+    if (r != 0)
+    {
+        freeEventIndex(index);
+        free(path);
+        return -1;
+    }
+    struct stat recording_st;
+    if (fstat(recording->fd, &recording_st) != 0 || saveEventIndex(index, recording_path, &recording_st, recording->count) != 0)
+    {
+        fprintf(stderr, "WARNING: %s could not be written, the index is built again on every seek\n", path);
+    }
+    free(path);
+    return 0;
+}
+
+// Last entry at or before time_us, where reading has to start to get everything from
+// time_us on. NULL for a recording without any EVT_TIME_HIGH.
+const struct EventIndexEntry *findEventIndex(const struct EventIndex *index, uint64_t time_us)
+{
+    size_t lo = 0, hi = index->count;
+
+    if (index->count == 0)
+    {
+        return NULL;
+    }
+    // The first entry is at time 0, find the last one not after time_us
+    while (hi - lo > 1)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index->entry[mid].time_us <= time_us)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return &index->entry[lo];
+}
+
+// Reading starts at the entry found for start_us, which is at entry_us. A window from 0
+// starts at the first word of the recording instead and is open from the start.
+void initEventWindow(struct EventWindow *window, uint64_t start_us, uint64_t end_us, uint64_t entry_us)
+{
+    memset(window, 0, sizeof(*window));
+    window->start_us = start_us;
+    window->end_us = end_us;
+    window->entry_us = entry_us;
+    window->started = (start_us == 0);
+}
+
+// Drop the words of count read words that are outside the window, in place. Returns the
+// words kept, ended is set once the window has closed.
+size_t filterEventWindow(struct EventWindow *window, uint8_t *words, size_t count)
+{
+    size_t kept = 0;
+
+    for (size_t i = 0; i < count && !window->ended; i++)
+    {
+        const uint8_t *p = words + i * BYTES_PER_LINE;
+        uint64_t w = load_word(p);
+
+        if ((unsigned int)(w >> 60) == EVT21_TYPE_TIME_HIGH)
+        {
+            clock_time_high(&window->clock, w, window->entry_us);
+            if (!window->started && window->clock.time_us + (1u << EVT21_TIME_LOW_BITS) > window->start_us)
+            {
+                window->started = true;
+            }
+            if (window->started && window->clock.time_us >= window->end_us)
+            {
+                window->ended = true;
+                break;
+            }
+        }
+        if (window->started)
+        {
+            if (kept != i)
+            {
+                memmove(words + kept * BYTES_PER_LINE, p, BYTES_PER_LINE);
+            }
+            kept++;
+        }
+    }
+    return kept;
+}
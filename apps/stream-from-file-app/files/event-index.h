@@ -0,0 +1,79 @@
+#ifndef _EVENT_INDEX_H
+#define _EVENT_INDEX_H 1
+
+#include "event-recording.h"
+#include "helper.h"
+
+#include <sys/stat.h>
+
+#define EVENT_INDEX_MAGIC "EVTIDX64"
+#define EVENT_INDEX_VERSION 2
+#define EVENT_INDEX_SUFFIX ".idx"
+#define EVENT_INDEX_INTERVAL_US 10000 // Recorded time between two entries, packed recordings have at most one per block
+
+// File layout of <recording>.idx: this header, then `entries` struct EventIndexEntry in
+// time order. The recording fields tie it to the recording it was built from, an index
+// that does not match all of them is rebuilt. The modification time is kept to the
+// nanosecond, so a recording rewritten within the same second is still noticed.
+struct EventIndexHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size;
+    uint64_t entries;
+    uint64_t recording_size;
+    uint64_t recording_words;
+    uint64_t recording_inode;
+    int64_t recording_mtime_ns;
+};
+
+// A place reading can start from. The first EVT_TIME_HIGH read from offset on is at time_us.
+struct EventIndexEntry
+{
+    uint64_t time_us; // Relative to the first EVT_TIME_HIGH of the recording
+    uint64_t offset;  // File offset of that EVT_TIME_HIGH word, or of its block in a packed recording
+    uint64_t word;    // Index of the word at offset, or of the first word of the block
+};
+
+// Time of the last EVT_TIME_HIGH, relative to the first one and counted across wraps of
+// the 34 bit timestamp
+struct EventClock
+{
+    bool synced; // An EVT_TIME_HIGH was seen
+    uint64_t time_high;
+    uint64_t time_us;
+};
+
+// Sparse time index of a recording, one entry per EVENT_INDEX_INTERVAL_US of recorded time
+struct EventIndex
+{
+    struct EventIndexEntry *entry;
+    size_t count;
+    size_t capacity;
+    struct EventClock clock; // Where building has got to
+};
+
+// Cuts [start_us, end_us) out of a recording read from an index entry on. The window
+// opens at the EVT_TIME_HIGH whose 64 us period holds start_us and that word is passed
+// on, so the stream after the seek carries the time high state of its first events.
+// It closes at the first EVT_TIME_HIGH at or after end_us.
+struct EventWindow
+{
+    uint64_t start_us;
+    uint64_t end_us;   // UINT64_MAX for the end of the recording
+    uint64_t entry_us; // Time of the first EVT_TIME_HIGH read after the seek
+    struct EventClock clock;
+    bool started;
+    bool ended;
+};
+
+void initEventIndex(struct EventIndex *index);
+void freeEventIndex(struct EventIndex *index);
+int indexEventWords(struct EventIndex *index, const uint8_t *words, size_t count, uint64_t offset, uint64_t word, bool block);
+int saveEventIndex(const struct EventIndex *index, const char *recording_path, const struct stat *recording_st, uint64_t recording_words);
+int loadEventIndex(struct EventIndex *index, const char *recording_path, const struct EventRecording *recording);
+const struct EventIndexEntry *findEventIndex(const struct EventIndex *index, uint64_t time_us);
+void initEventWindow(struct EventWindow *window, uint64_t start_us, uint64_t end_us, uint64_t entry_us);
+size_t filterEventWindow(struct EventWindow *window, uint8_t *words, size_t count);
+
+#endif
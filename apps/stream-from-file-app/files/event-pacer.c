@@ -0,0 +1,146 @@
+#include "event-pacer.h"
+
+#include <inttypes.h>
+
+// Private helper functions
+static uint64_t now_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000u + (uint64_t)t.tv_nsec;
+}
+
+// A hex line is one word written most significant digit first, so is its byte stream
+static inline uint64_t load_word(const uint8_t *p)
+{
+    uint64_t w = 0;
+
+    for (int i = 0; i < BYTES_PER_LINE; i++)
+    {
+        w = (w << 8) | p[i];
+    }
+    return w;
+}
+
+// Public methods
+void initEventPacer(struct EventPacer *pacer, double speed)
+{
+    memset(pacer, 0, sizeof(*pacer));
+    pacer->speed = speed;
+}
+
+void startPacedChunk(struct EventPacer *pacer)
+{
+    pacer->chunk_timed = false;
+}
+
+// Follow the timestamps of words about to go into the current chunk
+void scanPacedWords(struct EventPacer *pacer, const uint8_t *words, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        uint64_t w = load_word(words + i * BYTES_PER_LINE);
+        unsigned int type = (unsigned int)(w >> 60);
+        uint64_t t;
+
+        if (type == EVT21_TYPE_TIME_HIGH)
+        {
+            t = ((w >> 32) & ((1u << EVT21_TIME_HIGH_BITS) - 1)) << EVT21_TIME_LOW_BITS;
+            // The 34 bit timestamp wraps every ~4.8 hours
+            if (pacer->have_time_high && t + EVT21_TIME_WRAP_US / 2 < pacer->time_high)
+            {
+                pacer->wrap_us += EVT21_TIME_WRAP_US;
+            }
+            pacer->time_high = t;
+            pacer->have_time_high = true;
+        }
+        else if ((type == EVT21_TYPE_NEG || type == EVT21_TYPE_POS || type == EVT21_TYPE_EXT_TRIGGER) && pacer->have_time_high)
+        {
+            t = pacer->time_high | ((w >> (64 - 4 - EVT21_TIME_LOW_BITS)) & ((1u << EVT21_TIME_LOW_BITS) - 1));
+        }
+        else
+        {
+            continue;
+        }
+
+        t += pacer->wrap_us;
+        if (!pacer->have_first)
+        {
+            pacer->first_us = t;
+            pacer->have_first = true;
+        }
+        uint64_t rel = ((t > pacer->first_us) ? t - pacer->first_us : 0) + pacer->pass_us;
+        if (rel > pacer->last_us)
+        {
+            pacer->last_us = rel;
+        }
+        if (!pacer->chunk_timed)
+        {
+            pacer->chunk_us = rel;
+            pacer->chunk_timed = true;
+        }
+    }
+}
+
+// --loop starts over or the playlist moves on to the next file, which follows right after
+// the last event of this one
+void rewindPacedInput(struct EventPacer *pacer)
+{
+    pacer->have_first = false;
+    pacer->pass_us = pacer->last_us;
+    pacer->time_high = 0;
+    pacer->have_time_high = false;
+    pacer->wrap_us = 0;
+}
+
+// Sleep until the current chunk is due. Chunks without a timestamp go out right away.
+void waitPacedChunk(struct EventPacer *pacer)
+{
+    uint64_t now = now_ns();
+
+    pacer->chunks++;
+    if (!pacer->chunk_timed)
+    {
+        return;
+    }
+    uint64_t offset_ns = (uint64_t)((double)pacer->chunk_us * 1000.0 / pacer->speed);
+    if (!pacer->started)
+    {
+        pacer->start_ns = now - offset_ns;
+        pacer->started = true;
+        return;
+    }
+
+    uint64_t deadline = pacer->start_ns + offset_ns;
+    if (now < deadline)
+    {
+        struct timespec t = {.tv_sec = (time_t)(deadline / 1000000000u), .tv_nsec = (long)(deadline % 1000000000u)};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR)
+            ;
+        return;
+    }
+
+    uint64_t late_ns = now - deadline;
+    if (late_ns > pacer->max_late_ns)
+    {
+        pacer->max_late_ns = late_ns;
+    }
+    if (late_ns > EVENT_PACER_LATE_NS)
+    {
+        pacer->late++;
+    }
+    if (late_ns > EVENT_PACER_MAX_LAG_NS)
+    {
+        // Catching up would squeeze the backlog into one burst, shift the schedule instead
+        pacer->start_ns += late_ns;
+        pacer->slips++;
+    }
+}
+
+void printEventPacerStats(const struct EventPacer *pacer)
+{
+    printf("Pacing at %.2fx: %" PRIu64 " chunks over %.3f s of recording, %" PRIu64 " late by more than %d ms (max %.3f ms), %" PRIu64
+           " schedule slips\n",
+           pacer->speed, pacer->chunks, pacer->last_us / 1e6, pacer->late, EVENT_PACER_LATE_NS / 1000000,
+           pacer->max_late_ns / 1e6, pacer->slips);
+}
@@ -0,0 +1,51 @@
+#ifndef _EVENT_PACER_H
+#define _EVENT_PACER_H 1
+
+#include "helper.h"
+
+#include <time.h>
+
+// EVT2.1 word types, bits 63..60
+#define EVT21_TYPE_NEG 0x0
+#define EVT21_TYPE_POS 0x1
+#define EVT21_TYPE_TIME_HIGH 0x8
+#define EVT21_TYPE_EXT_TRIGGER 0xA
+
+#define EVT21_TIME_LOW_BITS 6
+#define EVT21_TIME_HIGH_BITS 28
+#define EVT21_TIME_WRAP_US (1ull << (EVT21_TIME_HIGH_BITS + EVT21_TIME_LOW_BITS))
+
+#define EVENT_PACER_LATE_NS 1000000      // Released later than this counts as late
+#define EVENT_PACER_MAX_LAG_NS 100000000 // Further behind than this and the schedule slips instead of bursting
+
+// Releases chunks of an EVT2.1 stream at the rate they were recorded, or a multiple of it.
+// Each chunk is due at the timestamp of its first timed word. Deadlines are absolute
+// CLOCK_MONOTONIC times counted from the first chunk, so sleep overshoot never adds up.
+struct EventPacer
+{
+    double speed; // 2.0 replays twice as fast as recorded
+    bool started;
+    uint64_t start_ns;  // CLOCK_MONOTONIC time that relative timestamp 0 maps to
+    uint64_t time_high; // Last EVT_TIME_HIGH of this pass, already shifted into place
+    bool have_time_high;
+    bool have_first;
+    uint64_t first_us;  // First timestamp of the current file
+    uint64_t wrap_us;   // Added for every wrap of the 34 bit timestamp
+    uint64_t pass_us;   // Added for every --loop pass and playlist file
+    uint64_t last_us;   // Latest timestamp, relative to first_us
+    bool chunk_timed;
+    uint64_t chunk_us; // Due time of the chunk being filled, relative to first_us
+    uint64_t chunks;
+    uint64_t late;    // Chunks released more than EVENT_PACER_LATE_NS after their deadline
+    uint64_t slips;   // Times the schedule was moved because the stream fell too far behind
+    uint64_t max_late_ns;
+};
+
+void initEventPacer(struct EventPacer *pacer, double speed);
+void startPacedChunk(struct EventPacer *pacer);
+void scanPacedWords(struct EventPacer *pacer, const uint8_t *words, size_t count);
+void rewindPacedInput(struct EventPacer *pacer);
+void waitPacedChunk(struct EventPacer *pacer);
+void printEventPacerStats(const struct EventPacer *pacer);
+
+#endif
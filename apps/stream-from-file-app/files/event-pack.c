@@ -0,0 +1,483 @@
+#include "event-pack.h"
+#include "event-recording.h"
+
+#include <inttypes.h>
+
+// Each word is coded against the last word of the same type (bits 63..60), so time high
+// words follow time high words and CD events follow CD events. The token is a varint of
+// (delta of bits 59..32 << 6) | (type << 2) | tag, with the tag saying what follows:
+//   0: the lower 32 bits (EVT2.1 valid mask) as a varint
+//   1: nothing, the lower 32 bits are unchanged
+//   2: nothing, the previous word repeats (token >> 2) + 1 times
+//   3: the lower 32 bits as 4 raw little endian bytes (dense masks)
+// The delta of a time high word is the zigzag difference of its 28 bit time. Other words
+// hold time low (6 bits), x and y (11 bits each) there, each field is differenced on its
+// own and x, which changes the most, goes lowest. Most words take 3 to 6 bytes instead of
+// 8, and 17 as a hex line. Blocks of noise that would grow are written unpacked.
+#define PACK_TAG_MASK_VARINT 0
+#define PACK_TAG_MASK_SAME 1
+#define PACK_TAG_RUN 2
+#define PACK_TAG_MASK_RAW 3
+#define PACK_HI_MASK 0x0FFFFFFFu // Bits 59..32 of a word
+
+#define EVT21_TYPE_TIME_HIGH 0x8
+
+// Private helper functions
+
+// A word is sent most significant byte first, as its hex line is written
+static inline uint64_t load_word(const uint8_t *p)
+{
+    uint64_t w = 0;
+
+    for (int i = 0; i < BYTES_PER_LINE; i++)
+    {
+        w = (w << 8) | p[i];
+    }
+    return w;
+}
+
+static inline void store_word(uint8_t *p, uint64_t w)
+{
+    for (int i = BYTES_PER_LINE - 1; i >= 0; i--)
+    {
+        p[i] = (uint8_t)w;
+        w >>= 8;
+    }
+}
+
+static inline size_t put_varint(uint8_t *out, uint64_t v)
+{
+    size_t n = 0;
+
+    while (v >= 0x80)
+    {
+        out[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (uint8_t)v;
+    return n;
+}
+
+static inline int get_varint(const uint8_t *in, size_t bytes, size_t *pos, uint64_t *v)
+{
+    uint64_t value = 0;
+
+    for (unsigned int shift = 0; shift < 64 && *pos < bytes; shift += 7)
+    {
+        uint8_t b = in[(*pos)++];
+        value |= (uint64_t)(b & 0x7F) << shift;
+        if ((b & 0x80) == 0)
+        {
+            *v = value;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static inline uint32_t zigzag(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t v)
+{
+    return (int32_t)((v >> 1) ^ -(v & 1));
+}
+
+// Difference of two n bit fields, sign extended
+static inline int32_t field_delta(uint32_t a, uint32_t b, unsigned int bits)
+{
+    return (int32_t)((a - b) << (32 - bits)) >> (32 - bits);
+}
+
+// Bits 59..32 of a word against those of the last word of its type
+static inline uint32_t delta_hi(unsigned int type, uint32_t hi, uint32_t prev)
+{
+    if (type == EVT21_TYPE_TIME_HIGH)
+    {
+        return zigzag(field_delta(hi, prev, 28));
+    }
+    // ts 27..22, x 21..11, y 10..0
+    uint32_t dts = ((hi >> 22) - (prev >> 22)) & 0x3F; // Time low only moves forward within a time high
+    uint32_t dx = zigzag(field_delta(hi >> 11, prev >> 11, 11)) & 0x7FF;
+    uint32_t dy = zigzag(field_delta(hi, prev, 11)) & 0x7FF;
+    return dx | dy << 11 | dts << 22;
+}
+
+static inline uint32_t undelta_hi(unsigned int type, uint32_t delta, uint32_t prev)
+{
+    if (type == EVT21_TYPE_TIME_HIGH)
+    {
+        return (prev + (uint32_t)unzigzag(delta)) & PACK_HI_MASK;
+    }
+    uint32_t ts = ((prev >> 22) + (delta >> 22)) & 0x3F;
+    uint32_t x = ((prev >> 11) + (uint32_t)unzigzag(delta & 0x7FF)) & 0x7FF;
+    uint32_t y = (prev + (uint32_t)unzigzag(delta >> 11 & 0x7FF)) & 0x7FF;
+    return ts << 22 | x << 11 | y;
+}
+
+// Fill all of dst, short reads only end at the end of the file. Returns the bytes read.
+static ssize_t read_full(struct InputReader *reader, void *dst, size_t len)
+{
+    size_t done = 0;
+
+    while (done < len)
+    {
+        ssize_t n = readInput(reader, (uint8_t *)dst + done, len - done);
+        if (n < 0)
+        {
+            return -1;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        done += (size_t)n;
+    }
+    return (ssize_t)done;
+}
+
+// Read and decompress the next block into slot. Sets slot->result.
+static void unpack_block(struct EventUnpacker *unpacker, struct UnpackedBlock *slot, uint64_t *total)
+{
+    struct EventPackBlockHeader header;
+    ssize_t n = read_full(&unpacker->reader, &header, sizeof(header));
+
+    slot->count = 0;
+    slot->result = -1;
+    if (n < 0)
+    {
+        return;
+    }
+    if (n == 0)
+    {
+        if (*total != unpacker->words)
+        {
+            fprintf(stderr, "Packed recording ends after %" PRIu64 " of %" PRIu64 " words\n", *total, unpacker->words);
+            return;
+        }
+        slot->result = 1;
+        return;
+    }
+    if (n != (ssize_t)sizeof(header) || header.words == 0 || header.words > EVENT_PACK_BLOCK_WORDS ||
+        header.bytes > EVENT_PACK_MAX_BYTES(EVENT_PACK_BLOCK_WORDS))
+    {
+        fprintf(stderr, "Corrupt block header after %" PRIu64 " words of the packed recording\n", *total);
+        return;
+    }
+    // Blocks that would not shrink are stored as they are
+    bool raw = (header.bytes == header.words * BYTES_PER_LINE);
+    if (read_full(&unpacker->reader, raw ? slot->words : unpacker->packed, header.bytes) != (ssize_t)header.bytes)
+    {
+        fprintf(stderr, "Packed recording truncated after %" PRIu64 " words\n", *total);
+        return;
+    }
+    if (!raw && unpackEventWords(unpacker->packed, header.bytes, slot->words, header.words) != 0)
+    {
+        fprintf(stderr, "Corrupt block after %" PRIu64 " words of the packed recording\n", *total);
+        return;
+    }
+    slot->count = header.words;
+    *total += header.words;
+    slot->result = 0;
+}
+
+static void *unpack_thread(void *arg)
+{
+    struct EventUnpacker *unpacker = (struct EventUnpacker *)arg;
+    uint64_t total = unpacker->start_word;
+    int result = 0;
+
+    while (result == 0)
+    {
+        pthread_mutex_lock(&unpacker->lock);
+        while (unpacker->running && unpacker->next >= unpacker->current + EVENT_UNPACK_SLOTS)
+        {
+            pthread_cond_wait(&unpacker->space, &unpacker->lock);
+        }
+        if (!unpacker->running)
+        {
+            pthread_mutex_unlock(&unpacker->lock);
+            break;
+        }
+        struct UnpackedBlock *slot = &unpacker->slot[unpacker->next % EVENT_UNPACK_SLOTS];
+        pthread_mutex_unlock(&unpacker->lock);
+
+        unpack_block(unpacker, slot, &total);
+        result = slot->result;
+
+        pthread_mutex_lock(&unpacker->lock);
+        slot->ready = true;
+        unpacker->next++;
+        pthread_cond_broadcast(&unpacker->ready);
+        pthread_mutex_unlock(&unpacker->lock);
+    }
+    return NULL;
+}
+
+static int launch_thread(struct EventUnpacker *unpacker)
+{
+    if (seekInputReader(&unpacker->reader, unpacker->start_offset, UINT64_MAX) != 0)
+    {
+        return -1;
+    }
+    unpacker->next = 0;
+    unpacker->current = 0;
+    unpacker->offset = 0;
+    unpacker->running = true;
+    for (size_t i = 0; i < EVENT_UNPACK_SLOTS; i++)
+    {
+        unpacker->slot[i].ready = false;
+    }
+    if (pthread_create(&unpacker->thread, NULL, unpack_thread, unpacker) != 0)
+    {
+        fprintf(stderr, "pthread_create(unpacker) failed\n");
+        return -1;
+    }
+    unpacker->started = true;
+    return 0;
+}
+
+static void join_thread(struct EventUnpacker *unpacker)
+{
+    if (!unpacker->started)
+    {
+        return;
+    }
+    pthread_mutex_lock(&unpacker->lock);
+    unpacker->running = false;
+    pthread_cond_broadcast(&unpacker->space);
+    pthread_mutex_unlock(&unpacker->lock);
+    pthread_join(unpacker->thread, NULL);
+    unpacker->started = false;
+}
+
+static void free_unpacker(struct EventUnpacker *unpacker)
+{
+    for (size_t i = 0; i < EVENT_UNPACK_SLOTS; i++)
+    {
+        free(unpacker->slot[i].words);
+        unpacker->slot[i].words = NULL;
+    }
+    free(unpacker->packed);
+    unpacker->packed = NULL;
+    freeInputReader(&unpacker->reader);
+    pthread_cond_destroy(&unpacker->space);
+    pthread_cond_destroy(&unpacker->ready);
+    pthread_mutex_destroy(&unpacker->lock);
+}
+
+// Public methods
+
+// Pack count words into out, which needs EVENT_PACK_MAX_BYTES(count). Returns the bytes used.
+size_t packEventWords(const uint8_t *words, size_t count, uint8_t *out)
+{
+    uint32_t prev_hi[16] = {0}, prev_lo[16] = {0};
+    uint64_t prev = 0;
+    size_t n = 0;
+
+    for (size_t i = 0; i < count;)
+    {
+        uint64_t w = load_word(words + i * BYTES_PER_LINE);
+
+        if (w == prev)
+        {
+            size_t run = 1;
+            while (i + run < count && load_word(words + (i + run) * BYTES_PER_LINE) == prev)
+            {
+                run++;
+            }
+            n += put_varint(out + n, ((uint64_t)(run - 1) << 2) | PACK_TAG_RUN);
+            i += run;
+            continue;
+        }
+
+        unsigned int type = (unsigned int)(w >> 60);
+        uint32_t hi = (uint32_t)(w >> 32) & PACK_HI_MASK, lo = (uint32_t)w;
+        uint64_t token = ((uint64_t)delta_hi(type, hi, prev_hi[type]) << 6) | (type << 2);
+        if (lo == prev_lo[type])
+        {
+            n += put_varint(out + n, token | PACK_TAG_MASK_SAME);
+        }
+        else if (lo < (1u << 28))
+        {
+            n += put_varint(out + n, token | PACK_TAG_MASK_VARINT);
+            n += put_varint(out + n, lo);
+        }
+        else
+        {
+            n += put_varint(out + n, token | PACK_TAG_MASK_RAW);
+            memcpy(out + n, &lo, sizeof(lo));
+            n += sizeof(lo);
+        }
+        prev_hi[type] = hi;
+        prev_lo[type] = lo;
+        prev = w;
+        i++;
+    }
+    return n;
+}
+
+// Unpack exactly count words from bytes of in. Returns -1 if in does not hold that.
+int unpackEventWords(const uint8_t *in, size_t bytes, uint8_t *words, size_t count)
+{
+    uint32_t prev_hi[16] = {0}, prev_lo[16] = {0};
+    uint64_t prev = 0;
+    size_t pos = 0;
+
+    for (size_t i = 0; i < count;)
+    {
+        uint64_t token, lo;
+
+        if (get_varint(in, bytes, &pos, &token) != 0)
+        {
+            return -1;
+        }
+        unsigned int type = (unsigned int)(token >> 2) & 0xF;
+        switch (token & 3)
+        {
+        case PACK_TAG_RUN:
+        {
+            uint64_t run = (token >> 2) + 1;
+            if (run > count - i)
+            {
+                return -1;
+            }
+            for (uint64_t k = 0; k < run; k++)
+            {
+                store_word(words + (i++) * BYTES_PER_LINE, prev);
+            }
+            continue;
+        }
+        case PACK_TAG_MASK_SAME:
+            lo = prev_lo[type];
+            break;
+        case PACK_TAG_MASK_VARINT:
+            if (get_varint(in, bytes, &pos, &lo) != 0 || lo > UINT32_MAX)
+            {
+                return -1;
+            }
+            break;
+        default:
+        {
+            uint32_t raw;
+            if (bytes - pos < sizeof(raw))
+            {
+                return -1;
+            }
+            memcpy(&raw, in + pos, sizeof(raw));
+            pos += sizeof(raw);
+            lo = raw;
+            break;
+        }
+        }
+        if ((token >> 6) > PACK_HI_MASK)
+        {
+            return -1;
+        }
+        uint32_t hi = undelta_hi(type, (uint32_t)(token >> 6), prev_hi[type]);
+        prev_hi[type] = hi;
+        prev_lo[type] = (uint32_t)lo;
+        prev = ((uint64_t)type << 60) | ((uint64_t)hi << 32) | (uint32_t)lo;
+        store_word(words + (i++) * BYTES_PER_LINE, prev);
+    }
+    return (pos == bytes) ? 0 : -1;
+}
+
+// Start decompressing at the block at file offset `offset`, whose first word is word
+// first_word of the recording. Rewinds go back there.
+int startEventUnpacker(struct EventUnpacker *unpacker, int fd, uint64_t words, uint64_t offset, uint64_t first_word)
+{
+    memset(unpacker, 0, sizeof(*unpacker));
+    unpacker->fd = fd;
+    unpacker->words = words;
+    unpacker->start_offset = offset;
+    unpacker->start_word = first_word;
+    pthread_mutex_init(&unpacker->lock, NULL);
+    pthread_cond_init(&unpacker->ready, NULL);
+    pthread_cond_init(&unpacker->space, NULL);
+    if (initInputReader(&unpacker->reader, fd) != 0)
+    {
+        free_unpacker(unpacker);
+        return -1;
+    }
+    unpacker->packed = malloc(EVENT_PACK_MAX_BYTES(EVENT_PACK_BLOCK_WORDS));
+    for (size_t i = 0; i < EVENT_UNPACK_SLOTS; i++)
+    {
+        unpacker->slot[i].words = malloc(EVENT_PACK_BLOCK_WORDS * BYTES_PER_LINE);
+        if (unpacker->slot[i].words == NULL)
+        {
+            break;
+        }
+    }
+    if (unpacker->packed == NULL || unpacker->slot[EVENT_UNPACK_SLOTS - 1].words == NULL)
+    {
+        fprintf(stderr, "Failed to allocate the unpacker buffers\n");
+        free_unpacker(unpacker);
+        return -1;
+    }
+    if (launch_thread(unpacker) != 0)
+    {
+        free_unpacker(unpacker);
+        return -1;
+    }
+    return 0;
+}
+
+void stopEventUnpacker(struct EventUnpacker *unpacker)
+{
+    join_thread(unpacker);
+    free_unpacker(unpacker);
+}
+
+int rewindEventUnpacker(struct EventUnpacker *unpacker)
+{
+    join_thread(unpacker);
+    return launch_thread(unpacker);
+}
+
+// Same contract as decodeHexLines: up to max_words words into out, 0 while there is more,
+// 1 at the end of the recording and -1 on error.
+int readUnpackedWords(struct EventUnpacker *unpacker, uint8_t *out, size_t max_words, size_t *words)
+{
+    size_t n = 0;
+
+    while (n < max_words)
+    {
+        struct UnpackedBlock *slot = &unpacker->slot[unpacker->current % EVENT_UNPACK_SLOTS];
+        pthread_mutex_lock(&unpacker->lock);
+        while (!slot->ready)
+        {
+            pthread_cond_wait(&unpacker->ready, &unpacker->lock);
+        }
+        pthread_mutex_unlock(&unpacker->lock);
+        if (slot->result != 0)
+        {
+            *words = n;
+            return slot->result;
+        }
+
+        size_t take = slot->count - unpacker->offset;
+        if (take > max_words - n)
+        {
+            take = max_words - n;
+        }
+        memcpy(out + n * BYTES_PER_LINE, slot->words + unpacker->offset * BYTES_PER_LINE, take * BYTES_PER_LINE);
+        n += take;
+        unpacker->offset += take;
+        if (unpacker->offset < slot->count)
+        {
+            break;
+        }
+
+        pthread_mutex_lock(&unpacker->lock);
+        slot->ready = false;
+        unpacker->current++;
+        unpacker->offset = 0;
+        pthread_cond_broadcast(&unpacker->space);
+        pthread_mutex_unlock(&unpacker->lock);
+    }
+    *words = n;
+    return 0;
+}
@@ -0,0 +1,61 @@
+#ifndef _EVENT_PACK_H
+#define _EVENT_PACK_H 1
+
+#include "helper.h"
+#include "input-reader.h"
+
+#include <pthread.h>
+
+#define EVENT_PACK_MAGIC "EVTPAK64"
+#define EVENT_PACK_VERSION 1
+#define EVENT_PACK_BLOCK_WORDS (64 * 1024)
+#define EVENT_PACK_MAX_BYTES(words) ((words) * 10) // Worst case, a 5 B token and a 5 B mask per word
+#define EVENT_UNPACK_SLOTS 4                       // Blocks decompressed ahead of the parser
+
+// File layout: a struct EventRecordingHeader with EVENT_PACK_MAGIC, then blocks of up to
+// EVENT_PACK_BLOCK_WORDS words, each this header and `bytes` of packed words. Blocks do
+// not depend on each other. A block with bytes == words * 8 holds the words unpacked.
+struct EventPackBlockHeader
+{
+    uint32_t words;
+    uint32_t bytes;
+};
+
+struct UnpackedBlock
+{
+    uint8_t *words;
+    size_t count;
+    int result; // 0 for a block of words, 1 past the last block, -1 on error
+    bool ready;
+};
+
+// Decompresses a packed recording on its own thread, a few blocks ahead of the reader.
+// The file is read through an InputReader, so disk reads overlap decompression too.
+struct EventUnpacker
+{
+    int fd;
+    uint64_t words;        // Words the header promises
+    uint64_t start_offset; // Block decompression starts from
+    uint64_t start_word;   // First word of that block
+    struct InputReader reader;
+    uint8_t *packed; // One packed block as read from the file
+    struct UnpackedBlock slot[EVENT_UNPACK_SLOTS];
+    pthread_t thread;
+    bool started; // thread has to be joined
+    pthread_mutex_t lock;
+    pthread_cond_t ready; // A block was decompressed
+    pthread_cond_t space; // A slot was handed back
+    uint64_t next;        // Next block the thread fills
+    uint64_t current;     // Block being handed out
+    size_t offset;        // Words of the current block already handed out
+    bool running;
+};
+
+size_t packEventWords(const uint8_t *words, size_t count, uint8_t *out);
+int unpackEventWords(const uint8_t *in, size_t bytes, uint8_t *words, size_t count);
+int startEventUnpacker(struct EventUnpacker *unpacker, int fd, uint64_t words, uint64_t offset, uint64_t first_word);
+void stopEventUnpacker(struct EventUnpacker *unpacker);
+int rewindEventUnpacker(struct EventUnpacker *unpacker);
+int readUnpackedWords(struct EventUnpacker *unpacker, uint8_t *out, size_t max_words, size_t *words);
+
+#endif
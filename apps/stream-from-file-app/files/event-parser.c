@@ -0,0 +1,275 @@
+#include "event-parser.h"
+#include "dma-api.h"
+
+#include <sched.h>
+#include <sys/eventfd.h>
+
+// Private helper functions
+
+// Fill one chunk with up to max_lines words, moving on to the next file of the playlist
+// when one ends. Returns 1 once the input is exhausted or broken, 0 while there is more
+// to read.
+static int fill_chunk(struct EventParser *parser, uint8_t *chunk, size_t max_lines, size_t *lines_read)
+{
+    *lines_read = 0;
+    while (*lines_read < max_lines)
+    {
+        size_t n;
+        uint8_t *out = chunk + *lines_read * BYTES_PER_LINE;
+        int r = readEventPlaylist(parser->playlist, out, max_lines - *lines_read, &n);
+
+        if (parser->pacer != NULL)
+        {
+            scanPacedWords(parser->pacer, out, n);
+        }
+        *lines_read += n;
+        if (r == 1)
+        {
+            r = advanceEventPlaylist(parser->playlist);
+            if (r == 0)
+            {
+                if (parser->pacer != NULL)
+                {
+                    rewindPacedInput(parser->pacer);
+                }
+                continue; // keep filling this chunk
+            }
+            if (r == 1)
+            {
+                printf("INFO: Finished sending events\n");
+            }
+            return 1;
+        }
+        if (r < 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void signal_event(int fd)
+{
+    uint64_t one = 1;
+
+    if (write(fd, &one, sizeof(one)) != (ssize_t)sizeof(one))
+    {
+        perror("write(eventfd)");
+    }
+}
+
+static void *parser_thread(void *arg)
+{
+    struct EventParser *parser = (struct EventParser *)arg;
+    int done = 0;
+
+    while (!done && atomic_load(&parser->running))
+    {
+        size_t head = atomic_load_explicit(&parser->head, memory_order_relaxed);
+        size_t tail = atomic_load_explicit(&parser->tail, memory_order_acquire);
+        uint64_t ticks;
+
+        if (head - tail >= parser->depth)
+        {
+            // Every chunk is queued or in flight, sleep until the DMA thread frees one
+            parser->full_waits++;
+            if (read(parser->fd_space, &ticks, sizeof(ticks)) < 0 && errno != EINTR)
+            {
+                perror("read(eventfd)");
+                break;
+            }
+            continue;
+        }
+
+        size_t index = head % parser->depth;
+        uint8_t *chunk = parser->buf + index * parser->slot_bytes;
+        size_t lines_read;
+
+        if (parser->pacer != NULL)
+        {
+            startPacedChunk(parser->pacer);
+        }
+        done = fill_chunk(parser, chunk, atomic_load_explicit(&parser->chunk_lines, memory_order_relaxed), &lines_read);
+        if (lines_read == 0)
+        {
+            continue;
+        }
+        parser->length[index] = (uint32_t)(lines_read * BYTES_PER_LINE);
+        if (parser->cached)
+        {
+            // Push the freshly parsed lines out of the CPU caches before MM2S reads them
+            syncDmaBufferForDevice(parser->fd_buf, index * parser->slot_bytes, parser->length[index], DMA_SYNC_TO_DEVICE);
+        }
+        if (parser->pacer != NULL)
+        {
+            // Parsed ahead of time, held back until the recording says it is due
+            waitPacedChunk(parser->pacer);
+        }
+        atomic_store_explicit(&parser->head, head + 1, memory_order_release);
+        signal_event(parser->fd_data);
+    }
+
+    atomic_store(&parser->finished, true);
+    signal_event(parser->fd_data);
+    return NULL;
+}
+
+// Public methods
+int startEventParser(struct EventParser *parser, struct EventPlaylist *playlist, uint8_t *buf, int fd_buf, bool cached,
+                     size_t depth, size_t slot_bytes, size_t chunk_bytes, int cpu, struct EventPacer *pacer)
+{
+    if (depth == 0 || depth > EVENT_PARSER_MAX_DEPTH)
+    {
+        fprintf(stderr, "Parser ring depth must be between 1 and %d\n", EVENT_PARSER_MAX_DEPTH);
+        return -1;
+    }
+
+    memset(parser, 0, sizeof(*parser));
+    parser->playlist = playlist;
+    parser->pacer = pacer;
+    parser->cached = cached;
+    parser->fd_buf = fd_buf;
+    parser->buf = buf;
+    parser->depth = depth;
+    parser->slot_bytes = slot_bytes;
+    parser->cpu = cpu;
+    atomic_init(&parser->running, true);
+    atomic_init(&parser->finished, false);
+    atomic_init(&parser->chunk_lines, chunk_bytes / BYTES_PER_LINE);
+    atomic_init(&parser->head, 0);
+    atomic_init(&parser->tail, 0);
+
+    parser->fd_data = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (parser->fd_data < 0)
+    {
+        perror("eventfd");
+        return -1;
+    }
+    // The parser blocks on this one while the ring is full
+    parser->fd_space = eventfd(0, EFD_CLOEXEC);
+    if (parser->fd_space < 0)
+    {
+        perror("eventfd");
+        close(parser->fd_data);
+        return -1;
+    }
+
+    if (pthread_create(&parser->thread, NULL, parser_thread, parser) != 0)
+    {
+        fprintf(stderr, "pthread_create(parser) failed\n");
+        close(parser->fd_space);
+        close(parser->fd_data);
+        return -1;
+    }
+    if (cpu >= 0)
+    {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (pthread_setaffinity_np(parser->thread, sizeof(set), &set) != 0)
+        {
+            fprintf(stderr, "WARNING: could not pin the parser to CPU %d\n", cpu);
+        }
+    }
+    return 0;
+}
+
+void stopEventParser(struct EventParser *parser)
+{
+    if (!atomic_exchange(&parser->running, false))
+    {
+        return;
+    }
+    // Wakes the parser if it is waiting on a full ring
+    signal_event(parser->fd_space);
+    pthread_join(parser->thread, NULL);
+    close(parser->fd_space);
+    close(parser->fd_data);
+}
+
+// Chunks started from now on are filled to chunk_bytes, at most slot_bytes
+void setEventParserChunkBytes(struct EventParser *parser, size_t chunk_bytes)
+{
+    atomic_store_explicit(&parser->chunk_lines, chunk_bytes / BYTES_PER_LINE, memory_order_relaxed);
+}
+
+// Chunks published by the parser and not yet released by the DMA thread
+size_t countParsedChunks(struct EventParser *parser)
+{
+    size_t tail = atomic_load_explicit(&parser->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&parser->head, memory_order_acquire);
+
+    return head - tail;
+}
+
+// Index of the nth unreleased chunk, oldest first. n must be below countParsedChunks().
+size_t getParsedChunk(const struct EventParser *parser, size_t n)
+{
+    return (atomic_load_explicit(&parser->tail, memory_order_relaxed) + n) % parser->depth;
+}
+
+// Hand the oldest chunk back to the parser once MM2S is done with it
+void releaseParsedChunk(struct EventParser *parser)
+{
+    size_t tail = atomic_load_explicit(&parser->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&parser->head, memory_order_acquire);
+
+    atomic_store_explicit(&parser->tail, tail + 1, memory_order_release);
+    // Only the parser moves head and it only sleeps on a full ring, so this sees every such sleep
+    if (head - tail == parser->depth)
+    {
+        signal_event(parser->fd_space);
+    }
+}
+
+// Parser has stopped and every chunk it published has been released
+bool isEventParserDone(struct EventParser *parser)
+{
+    return atomic_load(&parser->finished) && countParsedChunks(parser) == 0;
+}
+
+// Decode the whole playlist into buf once, for --loop to replay it from DMA memory.
+// Returns 0 when it fits, 1 when it does not and -1 on error. The playlist is back at
+// its start unless it fit.
+int loadResidentEvents(struct EventPlaylist *playlist, uint8_t *buf, size_t size, size_t *bytes)
+{
+    size_t capacity = size / BYTES_PER_LINE;
+    size_t lines = 0, n;
+    uint8_t spare[BYTES_PER_LINE];
+    bool fits = false;
+
+    for (;;)
+    {
+        // Once the buffer is full, it only fits if nothing is left
+        bool full = (lines == capacity);
+        int r = readEventPlaylist(playlist, full ? spare : buf + lines * BYTES_PER_LINE, full ? 1 : capacity - lines, &n);
+        if (r < 0)
+        {
+            return -1;
+        }
+        if (full && n > 0)
+        {
+            break;
+        }
+        lines += n;
+        if (r == 1)
+        {
+            if (playlist->index + 1 == playlist->count)
+            {
+                fits = (lines > 0);
+                break;
+            }
+            if (advanceEventPlaylist(playlist) != 0)
+            {
+                return -1;
+            }
+        }
+    }
+    if (fits)
+    {
+        *bytes = lines * BYTES_PER_LINE;
+        return 0;
+    }
+    return (rewindEventPlaylist(playlist) != 0) ? -1 : 1;
+}
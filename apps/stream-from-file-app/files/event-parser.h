@@ -0,0 +1,52 @@
+#ifndef _EVENT_PARSER_H
+#define _EVENT_PARSER_H 1
+
+#include "event-pacer.h"
+#include "event-playlist.h"
+#include "helper.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define EVENT_PARSER_MAX_DEPTH 64
+
+// Parses the input file on its own thread into chunks of the transmit buffer and hands
+// them to the DMA thread through a lock-free single-producer/single-consumer ring. Chunk
+// i lives at buf + i * slot_bytes, the ring only passes its ownership back and forth.
+// The files of the playlist are spliced back to back, a chunk can hold the end of one and
+// the start of the next.
+struct EventParser
+{
+    struct EventPlaylist *playlist; // Inputs, read in order
+    struct EventPacer *pacer;       // NULL publishes chunks as fast as they are parsed
+    bool cached; // buf is mapped cacheable, each chunk is flushed before it is published
+    int fd_buf;
+    uint8_t *buf;
+    size_t depth;
+    size_t slot_bytes;         // Room for the largest chunk
+    atomic_size_t chunk_lines; // Words the next chunk is filled to, set by the DMA thread
+    int cpu;      // -1 leaves the thread unpinned
+    int fd_data;  // eventfd the parser signals after publishing a chunk
+    int fd_space; // eventfd the DMA thread signals when it frees a chunk of a full ring
+    pthread_t thread;
+    atomic_bool running;
+    atomic_bool finished; // EOF or parse error, nothing more will be published
+    uint64_t full_waits; // Waits for a free chunk, the parser is ahead of the DMA
+    uint32_t length[EVENT_PARSER_MAX_DEPTH];
+
+    // Free running counters, each written by one side only and kept on its own cache line
+    _Alignas(64) atomic_size_t head; // Next chunk the parser publishes
+    _Alignas(64) atomic_size_t tail; // Next chunk the DMA thread releases
+};
+
+int startEventParser(struct EventParser *parser, struct EventPlaylist *playlist, uint8_t *buf, int fd_buf, bool cached,
+                     size_t depth, size_t slot_bytes, size_t chunk_bytes, int cpu, struct EventPacer *pacer);
+void setEventParserChunkBytes(struct EventParser *parser, size_t chunk_bytes);
+void stopEventParser(struct EventParser *parser);
+size_t countParsedChunks(struct EventParser *parser);
+size_t getParsedChunk(const struct EventParser *parser, size_t n);
+void releaseParsedChunk(struct EventParser *parser);
+bool isEventParserDone(struct EventParser *parser);
+int loadResidentEvents(struct EventPlaylist *playlist, uint8_t *buf, size_t size, size_t *bytes);
+
+#endif
@@ -0,0 +1,300 @@
+#include "event-playlist.h"
+
+#include <inttypes.h>
+
+// Private helper functions
+
+// Look up where reading a recording has to start for --start in its time index
+static int seek_source(const struct EventPlaylist *playlist, struct EventSource *source)
+{
+    const struct EventIndexEntry *entry;
+    struct EventIndex index;
+
+    if (loadEventIndex(&index, source->path, &source->recording) != 0)
+    {
+        return -1;
+    }
+    entry = findEventIndex(&index, playlist->start_us);
+    if (entry == NULL)
+    {
+        fprintf(stderr, "WARNING: %s has no EVT_TIME_HIGH words, nothing of it is in the --start window\n", source->path);
+        freeEventIndex(&index);
+        return 0;
+    }
+    source->seek_offset = entry->offset;
+    source->seek_word = entry->word;
+    initEventWindow(&source->window, playlist->start_us, playlist->end_us, entry->time_us);
+    printf("INFO: Seeking to %.3f s of %s, reading from word %" PRIu64 " at %.3f s\n", (double)playlist->start_us / 1e6, source->path,
+           entry->word, (double)entry->time_us / 1e6);
+    freeEventIndex(&index);
+    return 0;
+}
+
+// Open one input and start decoding it. Returns -1 with the reason printed on failure.
+static int open_source(const struct EventPlaylist *playlist, struct EventSource *source, const char *path)
+{
+    memset(source, 0, sizeof(*source));
+    source->path = path;
+    source->seek_offset = sizeof(struct EventRecordingHeader);
+    // Without a seek the window is cut while reading from the start
+    source->windowed = (playlist->start_us > 0 || playlist->end_us != UINT64_MAX);
+    initEventWindow(&source->window, playlist->start_us, playlist->end_us, 0);
+
+    // Binary recordings (see evt-convert) are mapped, anything else is parsed as a hex dump
+    int r = openEventRecording(path, &source->recording);
+    if (r < 0)
+    {
+        return -1;
+    }
+    if (r == 0)
+    {
+        const struct EventRecording *recording = &source->recording;
+
+        if (playlist->start_us > 0 && seek_source(playlist, source) != 0)
+        {
+            closeEventRecording(&source->recording);
+            return -1;
+        }
+        if (recording->packed && startEventUnpacker(&source->unpacker, recording->fd, recording->count, source->seek_offset, source->seek_word) != 0)
+        {
+            closeEventRecording(&source->recording);
+            return -1;
+        }
+        if (!recording->packed)
+        {
+            // The words are copied out front to back from the seek on, have the kernel read them in now
+            size_t skip = (size_t)source->seek_offset & ~((size_t)sysconf(_SC_PAGESIZE) - 1);
+            madvise((void *)(recording->map + skip), recording->map_len - skip, MADV_WILLNEED);
+            source->word_pos = source->seek_word;
+        }
+        source->open = true;
+        return 0;
+    }
+
+    source->input = fopen(path, "r");
+    if (source->input == NULL)
+    {
+        fprintf(stderr, "fopen(%s): %s\n", path, strerror(errno));
+        return -1;
+    }
+    // Hex dumps are read in large blocks by the decoder, the FILE is never read through
+    if (startParallelDecoder(&source->decoder, fileno(source->input), playlist->decode_threads) != 0)
+    {
+        fclose(source->input);
+        return -1;
+    }
+    // The decoder threads start on the first blocks right away, a single decoder only
+    // reads on demand and the kernel fetches the rest of the file meanwhile
+    posix_fadvise(fileno(source->input), 0, 0, POSIX_FADV_WILLNEED);
+    source->open = true;
+    return 0;
+}
+
+static void close_source(struct EventSource *source)
+{
+    if (!source->open)
+    {
+        return;
+    }
+    if (source->input != NULL)
+    {
+        stopParallelDecoder(&source->decoder);
+        fclose(source->input);
+    }
+    else
+    {
+        if (source->recording.packed)
+        {
+            stopEventUnpacker(&source->unpacker);
+        }
+        closeEventRecording(&source->recording);
+    }
+    source->open = false;
+}
+
+static int rewind_source(struct EventSource *source)
+{
+    initEventWindow(&source->window, source->window.start_us, source->window.end_us, source->window.entry_us);
+    if (source->input != NULL)
+    {
+        return rewindParallelDecoder(&source->decoder);
+    }
+    source->word_pos = source->seek_word;
+    return source->recording.packed ? rewindEventUnpacker(&source->unpacker) : 0;
+}
+
+// Same contract as decodeHexLines, for whichever kind of input the source is
+static int read_words(struct EventSource *source, uint8_t *out, size_t max_words, size_t *words)
+{
+    const struct EventRecording *recording = &source->recording;
+    int r;
+
+    if (source->input != NULL)
+    {
+        r = decodeParallelLines(&source->decoder, out, max_words, words);
+        if (r < 0)
+        {
+            fprintf(stderr, "Parse error. result < 0, lineno: %" PRIu64 "\n", source->decoder.lineno);
+        }
+        return r;
+    }
+    if (recording->packed)
+    {
+        return readUnpackedWords(&source->unpacker, out, max_words, words);
+    }
+
+    // Mapped recording, no parsing involved
+    uint64_t n = recording->count - source->word_pos;
+    if (n > max_words)
+    {
+        n = max_words;
+    }
+    memcpy(out, recording->words + source->word_pos * BYTES_PER_LINE, n * BYTES_PER_LINE);
+    source->word_pos += n;
+    *words = n;
+    return (source->word_pos == recording->count) ? 1 : 0;
+}
+
+// read_words with the words outside --start/--end dropped
+static int read_source(struct EventSource *source, uint8_t *out, size_t max_words, size_t *words)
+{
+    int r = read_words(source, out, max_words, words);
+
+    if (r < 0 || !source->windowed)
+    {
+        return r;
+    }
+    *words = filterEventWindow(&source->window, out, *words);
+    return source->window.ended ? 1 : r;
+}
+
+static void announce_source(const struct EventPlaylist *playlist)
+{
+    const struct EventSource *source = playlist->current;
+
+    if (playlist->count > 1)
+    {
+        printf("INFO: Input %zu of %zu: %s\n", playlist->index + 1, playlist->count, source->path);
+    }
+    if (source->input == NULL)
+    {
+        printf("Replaying %s recording of %" PRIu64 " events\n", source->recording.packed ? "packed" : "binary", source->recording.count);
+    }
+}
+
+// Open the file after the current one into the other slot, so it is ready when the current one ends
+static void prefetch_next(struct EventPlaylist *playlist)
+{
+    size_t index = playlist->index + 1;
+    struct EventSource *source = (playlist->current == &playlist->source[0]) ? &playlist->source[1] : &playlist->source[0];
+
+    playlist->next = NULL;
+    if (index == playlist->count)
+    {
+        if (!playlist->loop || playlist->count == 1)
+        {
+            return; // Nothing follows, or a single file rewinds in place
+        }
+        index = 0;
+    }
+    if (open_source(playlist, source, playlist->paths[index]) != 0)
+    {
+        fprintf(stderr, "WARNING: %s could not be opened, the stream stops after %s\n", playlist->paths[index], playlist->current->path);
+        return;
+    }
+    playlist->next = source;
+}
+
+// Public methods
+
+// Open the first file and start on the second. Returns -1 if the first cannot be opened.
+int openEventPlaylist(struct EventPlaylist *playlist, char **paths, size_t count, bool loop, unsigned int decode_threads, uint64_t start_us,
+                      uint64_t end_us)
+{
+    memset(playlist, 0, sizeof(*playlist));
+    playlist->paths = paths;
+    playlist->count = count;
+    playlist->loop = loop;
+    playlist->decode_threads = decode_threads;
+    playlist->start_us = start_us;
+    playlist->end_us = end_us;
+    playlist->current = &playlist->source[0];
+    if (count == 0 || open_source(playlist, playlist->current, paths[0]) != 0)
+    {
+        return -1;
+    }
+    announce_source(playlist);
+    prefetch_next(playlist);
+    return 0;
+}
+
+void closeEventPlaylist(struct EventPlaylist *playlist)
+{
+    close_source(&playlist->source[0]);
+    close_source(&playlist->source[1]);
+}
+
+// Up to max_words words of the current file into out. Returns 0 while the file has more,
+// 1 at its end (see advanceEventPlaylist) and -1 on error.
+int readEventPlaylist(struct EventPlaylist *playlist, uint8_t *out, size_t max_words, size_t *words)
+{
+    int r = read_source(playlist->current, out, max_words, words);
+
+    playlist->pass_words += *words;
+    return r;
+}
+
+// Move on to the next file once the current one has ended, from the first file again
+// after the last with --loop. Returns 0 when there is a next file, 1 at the end of the
+// playlist and -1 on error.
+int advanceEventPlaylist(struct EventPlaylist *playlist)
+{
+    bool wrap = (playlist->index + 1 == playlist->count);
+
+    if (wrap && (!playlist->loop || playlist->pass_words == 0))
+    {
+        return 1; // Done, or looping would only spin over empty files
+    }
+    if (wrap)
+    {
+        printf("INFO: Reached EOF, rewinding input and continuing\n");
+        playlist->pass_words = 0;
+    }
+    if (playlist->count == 1)
+    {
+        return rewind_source(playlist->current);
+    }
+    if (playlist->next == NULL)
+    {
+        return -1; // Reported when it failed to open
+    }
+
+    close_source(playlist->current);
+    playlist->current = playlist->next;
+    playlist->index = wrap ? 0 : playlist->index + 1;
+    announce_source(playlist);
+    prefetch_next(playlist);
+    return 0;
+}
+
+// Back to the start of the first file
+int rewindEventPlaylist(struct EventPlaylist *playlist)
+{
+    playlist->pass_words = 0;
+    if (playlist->index == 0)
+    {
+        return rewind_source(playlist->current);
+    }
+
+    close_source(&playlist->source[0]);
+    close_source(&playlist->source[1]);
+    playlist->index = 0;
+    playlist->current = &playlist->source[0];
+    if (open_source(playlist, playlist->current, playlist->paths[0]) != 0)
+    {
+        return -1;
+    }
+    announce_source(playlist);
+    prefetch_next(playlist);
+    return 0;
+}
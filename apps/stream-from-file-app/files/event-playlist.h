@@ -0,0 +1,51 @@
+#ifndef _EVENT_PLAYLIST_H
+#define _EVENT_PLAYLIST_H 1
+
+#include "event-index.h"
+#include "event-pack.h"
+#include "event-recording.h"
+#include "helper.h"
+#include "parallel-decoder.h"
+
+// One input file: a hex dump, a mapped binary recording or a packed one
+struct EventSource
+{
+    const char *path;
+    FILE *input;                     // Hex dump, NULL for a recording
+    struct EventRecording recording; // Valid when input is NULL
+    struct ParallelDecoder decoder;  // Reads and decodes input
+    struct EventUnpacker unpacker;   // Decompresses a packed recording
+    uint64_t word_pos;               // Next word of a mapped recording
+    uint64_t seek_offset;            // Where reading a recording starts and rewinds to
+    uint64_t seek_word;              // Word at seek_offset
+    bool windowed;                   // Only window is passed on (--start/--end)
+    struct EventWindow window;
+    bool open;
+};
+
+// Streams a list of inputs back to back. The file after the current one is opened as soon
+// as the current one starts, so its decoder threads (or its unpacker) are already working
+// on it and the kernel is reading it in while the current one streams.
+struct EventPlaylist
+{
+    char **paths;
+    size_t count;
+    bool loop; // Start over after the last file
+    unsigned int decode_threads;
+    uint64_t start_us; // Window cut out of every file, relative to its first EVT_TIME_HIGH
+    uint64_t end_us;   // UINT64_MAX without --end
+    size_t index;                 // File being streamed
+    struct EventSource source[2]; // Current and next file, alternating
+    struct EventSource *current;
+    struct EventSource *next; // NULL after the last file without --loop or when it failed to open
+    uint64_t pass_words;      // Words read since the first file started, an empty pass ends --loop
+};
+
+int openEventPlaylist(struct EventPlaylist *playlist, char **paths, size_t count, bool loop, unsigned int decode_threads, uint64_t start_us,
+                      uint64_t end_us);
+void closeEventPlaylist(struct EventPlaylist *playlist);
+int readEventPlaylist(struct EventPlaylist *playlist, uint8_t *out, size_t max_words, size_t *words);
+int advanceEventPlaylist(struct EventPlaylist *playlist);
+int rewindEventPlaylist(struct EventPlaylist *playlist);
+
+#endif
@@ -0,0 +1,184 @@
+#include "event-recording.h"
+#include "event-index.h"
+#include "event-pack.h"
+#include "parallel-decoder.h"
+
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#define CONVERT_BATCH_WORDS 4096
+
+// Public methods
+
+// Map a binary recording, or only check the header of a packed one, which is read through
+// an EventUnpacker instead. Returns 0 on success, 1 if the file is not a binary recording
+// (e.g. a hex dump, which the caller parses instead) and -1 on error.
+int openEventRecording(const char *path, struct EventRecording *recording)
+{
+    struct EventRecordingHeader header;
+    struct stat st;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        fprintf(stderr, "open(%s): %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (fstat(fd, &st) != 0)
+    {
+        fprintf(stderr, "fstat(%s): %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof(header) || pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header))
+    {
+        close(fd);
+        return 1;
+    }
+    memset(recording, 0, sizeof(*recording));
+    recording->packed = (memcmp(header.magic, EVENT_PACK_MAGIC, sizeof(header.magic)) == 0);
+    if (!recording->packed && memcmp(header.magic, EVENT_RECORDING_MAGIC, sizeof(header.magic)) != 0)
+    {
+        close(fd);
+        return 1;
+    }
+    if (header.version != (recording->packed ? EVENT_PACK_VERSION : EVENT_RECORDING_VERSION) || header.word_size != BYTES_PER_LINE)
+    {
+        fprintf(stderr, "%s: unsupported recording version %u with %u B words\n", path, header.version, header.word_size);
+        close(fd);
+        return -1;
+    }
+    if (recording->packed)
+    {
+        // Checked block by block as it is unpacked
+        recording->fd = fd;
+        recording->count = header.words;
+        recording->map_len = (size_t)st.st_size;
+        return 0;
+    }
+    if (header.words > ((uint64_t)st.st_size - sizeof(header)) / BYTES_PER_LINE)
+    {
+        fprintf(stderr, "%s: header says %" PRIu64 " words, the file is truncated\n", path, header.words);
+        close(fd);
+        return -1;
+    }
+
+    recording->map_len = (size_t)st.st_size;
+    recording->map = (const uint8_t *)mmap(NULL, recording->map_len, PROT_READ, MAP_SHARED, fd, 0);
+    if (recording->map == MAP_FAILED)
+    {
+        fprintf(stderr, "mmap(%s): %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    // Read once, front to back, let the kernel read ahead
+    madvise((void *)recording->map, recording->map_len, MADV_SEQUENTIAL);
+    recording->fd = fd;
+    recording->words = recording->map + sizeof(header);
+    recording->count = header.words;
+    return 0;
+}
+
+void closeEventRecording(struct EventRecording *recording)
+{
+    if (recording->map != NULL)
+    {
+        munmap((void *)recording->map, recording->map_len);
+    }
+    close(recording->fd);
+}
+
+// Write out one batch of words, as they are or as a packed block, and add it to index.
+// word is the index of the first word of the batch in the recording.
+static int write_batch(FILE *out, const uint8_t *words, size_t n, bool packed, struct EventIndex *index, uint64_t word)
+{
+    static uint8_t block[EVENT_PACK_MAX_BYTES(EVENT_PACK_BLOCK_WORDS)];
+    struct EventPackBlockHeader header = {.words = (uint32_t)n};
+    const uint8_t *data = block;
+    off_t offset = ftello(out);
+
+    if (n == 0)
+    {
+        return 0;
+    }
+    if (index != NULL && (offset < 0 || indexEventWords(index, words, n, (uint64_t)offset, word, packed) != 0))
+    {
+        return -1;
+    }
+    if (!packed)
+    {
+        return (fwrite(words, BYTES_PER_LINE, n, out) == n) ? 0 : -1;
+    }
+    header.bytes = (uint32_t)packEventWords(words, n, block);
+    if (header.bytes >= n * BYTES_PER_LINE)
+    {
+        // Would not shrink, store the words as they are
+        header.bytes = (uint32_t)(n * BYTES_PER_LINE);
+        data = words;
+    }
+    if (fwrite(&header, sizeof(header), 1, out) != 1 || fwrite(data, 1, header.bytes, out) != header.bytes)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+// Write the lines of a hex dump as a binary recording, packed (see event-pack.c) or not,
+// and build its time index into index unless that is NULL. The word count is patched
+// into the header at the end, so out has to be seekable.
+int convertEventRecording(FILE *hex, FILE *out, uint64_t *words, unsigned int decode_threads, bool packed, struct EventIndex *index)
+{
+    struct EventRecordingHeader header = {.magic = EVENT_RECORDING_MAGIC,
+                                          .version = EVENT_RECORDING_VERSION,
+                                          .word_size = BYTES_PER_LINE};
+    static uint8_t batch[EVENT_PACK_BLOCK_WORDS][BYTES_PER_LINE];
+    size_t batch_words = packed ? EVENT_PACK_BLOCK_WORDS : CONVERT_BATCH_WORDS;
+    struct ParallelDecoder decoder;
+    size_t n = 0, lines;
+    int r = 0;
+
+    if (packed)
+    {
+        memcpy(header.magic, EVENT_PACK_MAGIC, sizeof(header.magic));
+        header.version = EVENT_PACK_VERSION;
+    }
+    if (fwrite(&header, sizeof(header), 1, out) != 1)
+    {
+        fprintf(stderr, "Failed to write recording header\n");
+        return -1;
+    }
+    if (startParallelDecoder(&decoder, fileno(hex), decode_threads) != 0)
+    {
+        return -1;
+    }
+    while (r == 0)
+    {
+        r = decodeParallelLines(&decoder, batch[n], batch_words - n, &lines);
+        n += lines;
+        header.words += lines;
+        // Packed blocks are only cut when full, the last one excepted
+        if ((n == batch_words || r != 0) && write_batch(out, batch[0], n, packed, index, header.words - n) != 0)
+        {
+            fprintf(stderr, "Failed to write recording\n");
+            r = -1;
+            break;
+        }
+        if (n == batch_words)
+        {
+            n = 0;
+        }
+    }
+    stopParallelDecoder(&decoder);
+    if (r < 0)
+    {
+        return -1;
+    }
+    if (fseek(out, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, out) != 1)
+    {
+        fprintf(stderr, "Failed to write recording\n");
+        return -1;
+    }
+    *words = header.words;
+    return 0;
+}
@@ -0,0 +1,38 @@
+#ifndef _EVENT_RECORDING_H
+#define _EVENT_RECORDING_H 1
+
+#include "helper.h"
+
+#define EVENT_RECORDING_MAGIC "EVTRAW64"
+#define EVENT_RECORDING_VERSION 1
+
+// File layout: this header followed by `words` event words of `word_size` bytes, little
+// endian. Each word holds the bytes of one hex line in the order they are streamed.
+struct EventRecordingHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t word_size;
+    uint64_t words;
+    uint64_t reserved;
+};
+
+// A binary recording mapped read-only, words points right past the header. Packed
+// recordings are not mapped, map and words are NULL.
+struct EventRecording
+{
+    int fd;
+    bool packed;
+    const uint8_t *map;
+    size_t map_len; // File size
+    const uint8_t *words;
+    uint64_t count;
+};
+
+struct EventIndex; // event-index.h, which builds on this header
+
+int openEventRecording(const char *path, struct EventRecording *recording);
+void closeEventRecording(struct EventRecording *recording);
+int convertEventRecording(FILE *hex, FILE *out, uint64_t *words, unsigned int decode_threads, bool packed, struct EventIndex *index);
+
+#endif
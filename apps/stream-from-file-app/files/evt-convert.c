@@ -0,0 +1,74 @@
+#include "event-index.h"
+#include "event-recording.h"
+#include "parallel-decoder.h"
+
+#include <inttypes.h>
+#include <sys/stat.h>
+
+// Converts a hex event dump (16 hex characters per line, # comments) into the binary
+// recording format stream-from-file-app maps directly, or with --pack into the block
+// compressed one it decompresses while streaming. The dump is decoded on one thread per
+// CPU unless a thread count is given. The time index --start seeks with is written next
+// to the recording as <binary output file>.idx.
+int main(int argc, char *argv[])
+{
+    FILE *hex, *out;
+    uint64_t words = 0;
+    struct EventIndex index;
+    unsigned int threads = getDefaultDecodeThreads();
+    bool packed = false;
+
+    if (argc > 1 && strcmp(argv[1], "--pack") == 0)
+    {
+        packed = true;
+        argv++;
+        argc--;
+    }
+    if (argc < 3 || argc > 4 || (argc == 4 && (sscanf(argv[3], "%u", &threads) != 1 || threads == 0)))
+    {
+        printf("Invalid use. Function expects: evt-convert [--pack] <hex input file> <binary output file> [decode threads]\n");
+        exit(1);
+    }
+
+    hex = fopen(argv[1], "r");
+    if (hex == NULL)
+    {
+        fprintf(stderr, "fopen(%s): %s\n", argv[1], strerror(errno));
+        exit(1);
+    }
+    out = fopen(argv[2], "wb");
+    if (out == NULL)
+    {
+        fprintf(stderr, "fopen(%s): %s\n", argv[2], strerror(errno));
+        fclose(hex);
+        exit(1);
+    }
+
+    initEventIndex(&index);
+    int r = convertEventRecording(hex, out, &words, threads, packed, &index);
+    fclose(hex);
+    if (fclose(out) != 0 || r != 0)
+    {
+        fprintf(stderr, "Conversion failed, removing %s\n", argv[2]);
+        unlink(argv[2]);
+        freeEventIndex(&index);
+        exit(1);
+    }
+    struct stat in_st, out_st;
+    // Stat taken after the recording is closed, its modification time is final
+    if (stat(argv[2], &out_st) != 0 || saveEventIndex(&index, argv[2], &out_st, words) != 0)
+    {
+        fprintf(stderr, "WARNING: the time index of %s could not be written, it is built on the first --start\n", argv[2]);
+    }
+    freeEventIndex(&index);
+    if (stat(argv[1], &in_st) == 0 && stat(argv[2], &out_st) == 0)
+    {
+        printf("%" PRIu64 " events written to %s, %lld B from %lld B of hex\n", words, argv[2], (long long)out_st.st_size,
+               (long long)in_st.st_size);
+    }
+    else
+    {
+        printf("%" PRIu64 " events written to %s\n", words, argv[2]);
+    }
+    return 0;
+}
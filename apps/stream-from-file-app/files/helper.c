@@ -104,4 +104,29 @@ int readNextLine(FILE *f, char hex16[HEXCHARS_PER_LINE], uint64_t *lineno)
     }
 
     return 0; // EOF
-}
\ No newline at end of file
+}
+
+volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int signo)
+{
+    (void)signo;
+    stop_requested = 1;
+}
+
+// Without SA_RESTART, so a blocking wait returns EINTR and its loop sees the flag. The
+// handler stays, supervisors like timeout(1) deliver the signal more than once.
+int installStopHandler(void)
+{
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = request_stop;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGINT, &sa, NULL) != 0 || sigaction(SIGTERM, &sa, NULL) != 0)
+    {
+        perror("sigaction");
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,192 @@
+#include "helper.h"
+#include "hex-decoder.h"
+#include "parallel-decoder.h"
+
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <time.h>
+
+// Decode speed of a hex dump with the line parser (readNextLine + parseLine), the block
+// decoder and the parallel decoder, and a check that all of them produce the same bytes. Run it on the file to be
+// streamed, a second pass comes from the page cache so the numbers are parsing only.
+
+#define DEFAULT_ITERATIONS 5
+
+static const char *reader_name = "";
+
+struct BenchResult
+{
+    double seconds;
+    uint64_t lines;
+    uint64_t checksum;
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000u + (uint64_t)t.tv_nsec;
+}
+
+// FNV-1a over every decoded byte, in order
+static uint64_t checksum_chunk(uint64_t hash, const uint8_t *chunk, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; i++)
+    {
+        hash = (hash ^ chunk[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static int run_line_parser(const char *path, struct BenchResult *result)
+{
+    uint8_t chunk[LINES_PER_CHUNK * BYTES_PER_LINE];
+    char line_buf[HEXCHARS_PER_LINE + 1];
+    uint64_t lineno = 0;
+    size_t n = 0;
+    int r;
+    FILE *f = fopen(path, "r");
+
+    if (f == NULL)
+    {
+        fprintf(stderr, "fopen(%s): %s\n", path, strerror(errno));
+        return -1;
+    }
+    uint64_t start = now_ns();
+    while ((r = readNextLine(f, line_buf, &lineno)) > 0)
+    {
+        if (parseLine(line_buf, &chunk[n * BYTES_PER_LINE]) != 0)
+        {
+            fprintf(stderr, "Line %" PRIu64 ": invalid hex digit\n", lineno);
+            r = -1;
+            break;
+        }
+        result->lines++;
+        if (++n == LINES_PER_CHUNK)
+        {
+            result->checksum = checksum_chunk(result->checksum, chunk, sizeof(chunk));
+            n = 0;
+        }
+    }
+    result->checksum = checksum_chunk(result->checksum, chunk, n * BYTES_PER_LINE);
+    result->seconds += (double)(now_ns() - start) / 1e9;
+    fclose(f);
+    return (r < 0) ? -1 : 0;
+}
+
+static int run_block_decoder(const char *path, struct BenchResult *result)
+{
+    uint8_t chunk[LINES_PER_CHUNK * BYTES_PER_LINE];
+    struct HexDecoder decoder;
+    int r;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+    {
+        fprintf(stderr, "open(%s): %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (initHexDecoder(&decoder, fd) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    reader_name = getInputReaderName(&decoder.reader);
+    uint64_t start = now_ns();
+    do
+    {
+        size_t n;
+        r = decodeHexLines(&decoder, chunk, LINES_PER_CHUNK, &n);
+        result->lines += n;
+        result->checksum = checksum_chunk(result->checksum, chunk, n * BYTES_PER_LINE);
+    } while (r == 0);
+    result->seconds += (double)(now_ns() - start) / 1e9;
+    freeHexDecoder(&decoder);
+    close(fd);
+    return (r < 0) ? -1 : 0;
+}
+
+static int run_parallel_decoder(const char *path, unsigned int threads, struct BenchResult *result)
+{
+    uint8_t chunk[LINES_PER_CHUNK * BYTES_PER_LINE];
+    struct ParallelDecoder decoder;
+    int r;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+    {
+        fprintf(stderr, "open(%s): %s\n", path, strerror(errno));
+        return -1;
+    }
+    // Thread start-up is part of what a caller pays, so it is timed too
+    uint64_t start = now_ns();
+    if (startParallelDecoder(&decoder, fd, threads) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    do
+    {
+        size_t n;
+        r = decodeParallelLines(&decoder, chunk, LINES_PER_CHUNK, &n);
+        result->lines += n;
+        result->checksum = checksum_chunk(result->checksum, chunk, n * BYTES_PER_LINE);
+    } while (r == 0);
+    stopParallelDecoder(&decoder);
+    result->seconds += (double)(now_ns() - start) / 1e9;
+    close(fd);
+    return (r < 0) ? -1 : 0;
+}
+
+static void print_result(const char *name, const struct BenchResult *result, uint64_t file_bytes, unsigned int iterations)
+{
+    double seconds = result->seconds / iterations;
+
+    printf("%-16s %10.2f %10.1f %12.2f\n", name, seconds * 1e3, file_bytes / seconds / 1e6, result->lines / iterations / seconds / 1e6);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int iterations = DEFAULT_ITERATIONS;
+    unsigned int threads = getDefaultDecodeThreads();
+    struct BenchResult line = {0}, block = {0}, parallel = {0};
+    struct stat st;
+    char name[32];
+
+    if (argc < 2 || argc > 4 || (argc >= 3 && sscanf(argv[2], "%u", &iterations) != 1) || iterations == 0 ||
+        (argc == 4 && (sscanf(argv[3], "%u", &threads) != 1 || threads == 0)))
+    {
+        printf("Invalid use. Function expects: hex-decode-bench <hex input file> [iterations] [decode threads]\n");
+        exit(1);
+    }
+    if (stat(argv[1], &st) != 0)
+    {
+        fprintf(stderr, "stat(%s): %s\n", argv[1], strerror(errno));
+        exit(1);
+    }
+
+    for (unsigned int i = 0; i < iterations; i++)
+    {
+        if (run_line_parser(argv[1], &line) != 0 || run_block_decoder(argv[1], &block) != 0 ||
+            run_parallel_decoder(argv[1], threads, &parallel) != 0)
+        {
+            exit(1);
+        }
+    }
+    if (line.lines != block.lines || line.checksum != block.checksum || line.lines != parallel.lines || line.checksum != parallel.checksum)
+    {
+        fprintf(stderr, "Decoders disagree: %" PRIu64 " vs %" PRIu64 " vs %" PRIu64 " lines, checksum %016" PRIx64 " vs %016" PRIx64
+                " vs %016" PRIx64 "\n",
+                line.lines, block.lines, parallel.lines, line.checksum, block.checksum, parallel.checksum);
+        exit(1);
+    }
+
+    printf("%" PRIu64 " lines, %lld B, %u iterations, block decoder: %s, input: %s\n", line.lines / iterations, (long long)st.st_size,
+           iterations, getHexDecoderName(), reader_name);
+    printf("%-16s %10s %10s %12s\n", "parser", "ms", "MB/s", "Mlines/s");
+    print_result("readNextLine", &line, (uint64_t)st.st_size, iterations);
+    print_result("block", &block, (uint64_t)st.st_size, iterations);
+    snprintf(name, sizeof(name), "parallel x%u", threads);
+    print_result(name, &parallel, (uint64_t)st.st_size, iterations);
+    return 0;
+}
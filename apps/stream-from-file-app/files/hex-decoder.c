@@ -0,0 +1,288 @@
+#include "hex-decoder.h"
+
+#include <inttypes.h>
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HEX_DECODER_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define HEX_DECODER_SSE2 1
+#endif
+
+#define HEX_RECORD_LEN (HEXCHARS_PER_LINE + 1) // 16 digits and '\n'
+#define HEX_BLOCK_LINES 4
+
+// Private helper functions
+
+// Decode 16 hex digits into 8 bytes. Returns -1 if any of them is not a hex digit.
+static inline int decode_line(const char *p, uint8_t *out)
+{
+#if defined(HEX_DECODER_NEON)
+    uint8x16_t v = vld1q_u8((const uint8_t *)p);
+    uint8x16_t digit = vsubq_u8(v, vdupq_n_u8('0'));
+    uint8x16_t alpha = vsubq_u8(vorrq_u8(v, vdupq_n_u8(0x20)), vdupq_n_u8('a'));
+    uint8x16_t is_digit = vcltq_u8(digit, vdupq_n_u8(10));
+    uint8x16_t is_alpha = vcltq_u8(alpha, vdupq_n_u8(6));
+
+    if (vminvq_u8(vorrq_u8(is_digit, is_alpha)) != 0xFF)
+    {
+        return -1;
+    }
+    uint16x8_t nibbles = vreinterpretq_u16_u8(vbslq_u8(is_digit, digit, vaddq_u8(alpha, vdupq_n_u8(10))));
+    // Little endian lanes: the low byte of each pair is the high nibble
+    uint16x8_t bytes = vorrq_u16(vshlq_n_u16(nibbles, 4), vshrq_n_u16(nibbles, 8));
+    vst1_u8(out, vmovn_u16(bytes));
+    return 0;
+#elif defined(HEX_DECODER_SSE2)
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i digit = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+    __m128i alpha = _mm_sub_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    // Unsigned x <= n as min(x, n) == x, SSE2 has no unsigned compare
+    __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+    __m128i is_alpha = _mm_cmpeq_epi8(_mm_min_epu8(alpha, _mm_set1_epi8(5)), alpha);
+
+    if (_mm_movemask_epi8(_mm_or_si128(is_digit, is_alpha)) != 0xFFFF)
+    {
+        return -1;
+    }
+    __m128i nibbles = _mm_or_si128(_mm_and_si128(is_digit, digit),
+                                   _mm_andnot_si128(is_digit, _mm_add_epi8(alpha, _mm_set1_epi8(10))));
+    // Little endian lanes: the low byte of each pair is the high nibble
+    __m128i bytes = _mm_or_si128(_mm_slli_epi16(nibbles, 4), _mm_srli_epi16(nibbles, 8));
+    bytes = _mm_and_si128(bytes, _mm_set1_epi16(0x00FF));
+    _mm_storel_epi64((__m128i *)out, _mm_packus_epi16(bytes, bytes));
+    return 0;
+#else
+    return parseLine(p, out);
+#endif
+}
+
+// Character i of a segment read the way fgets hands it to readNextLine, '\0' past its end
+static inline char segment_char(const char *p, size_t len, size_t i)
+{
+    return (i < len) ? p[i] : '\0';
+}
+
+static int line_error(struct HexDecoder *decoder, const char *error)
+{
+    decoder->error = error;
+    if (!decoder->quiet)
+    {
+        fprintf(stderr, "Line %" PRIu64 ": %s\n", decoder->lineno, error);
+    }
+    return -1;
+}
+
+// readNextLine's rules for one line. Returns 1 when a line was decoded into out, 0 for
+// blank and comment lines and -1 on error.
+static int decode_segment(struct HexDecoder *decoder, const char *p, size_t len, uint8_t *out)
+{
+    size_t i = 0;
+    char c;
+
+    while (segment_char(p, len, i) == ' ' || segment_char(p, len, i) == '\t')
+        i++; // skip leading WS
+    c = segment_char(p, len, i);
+    if (c == '\0' || c == '\n' || c == '\r')
+        return 0; // blank
+    if (c == '#')
+        return 0; // comment
+
+    for (size_t k = 0; k < HEXCHARS_PER_LINE; k++)
+    {
+        c = segment_char(p, len, i + k);
+        if (c == '\0' || c == '\n' || c == '\r')
+        {
+            return line_error(decoder, "too short (need 16 hex chars)");
+        }
+    }
+
+    // Trailing whitespace and/or a trailing comment are fine
+    size_t q = i + HEXCHARS_PER_LINE;
+    while (segment_char(p, len, q) == ' ' || segment_char(p, len, q) == '\t')
+        q++;
+    c = segment_char(p, len, q);
+    if (c != '\0' && c != '\n' && c != '\r' && c != '#')
+    {
+        return line_error(decoder, "extra garbage after 16 hex chars");
+    }
+
+    if (parseLine(p + i, out) != 0)
+    {
+        return line_error(decoder, "invalid hex digit");
+    }
+    return 1;
+}
+
+// Move the undecoded tail to the front of the buffer and read more behind it
+static int refill(struct HexDecoder *decoder)
+{
+    size_t left = decoder->end - decoder->start;
+
+    memmove(decoder->buf, decoder->buf + decoder->start, left);
+    decoder->start = 0;
+    decoder->end = left;
+    ssize_t n = readInput(&decoder->reader, decoder->buf + decoder->end, HEX_DECODER_BUF_SIZE - decoder->end);
+    if (n < 0)
+    {
+        return -1;
+    }
+    if (n == 0)
+    {
+        decoder->eof = true;
+    }
+    decoder->end += (size_t)n;
+    return 0;
+}
+
+// Public methods
+int initHexDecoder(struct HexDecoder *decoder, int fd)
+{
+    memset(decoder, 0, sizeof(*decoder));
+    decoder->range_end = UINT64_MAX;
+    decoder->buf = malloc(HEX_DECODER_BUF_SIZE);
+    if (decoder->buf == NULL)
+    {
+        fprintf(stderr, "Failed to allocate the hex decoder buffer\n");
+        return -1;
+    }
+    if (initInputReader(&decoder->reader, fd) != 0)
+    {
+        free(decoder->buf);
+        decoder->buf = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void freeHexDecoder(struct HexDecoder *decoder)
+{
+    if (decoder->buf == NULL)
+    {
+        return;
+    }
+    freeInputReader(&decoder->reader);
+    free(decoder->buf);
+    decoder->buf = NULL;
+}
+
+int rewindHexDecoder(struct HexDecoder *decoder)
+{
+    if (seekInputReader(&decoder->reader, decoder->range_start, decoder->range_end) != 0)
+    {
+        return -1;
+    }
+    decoder->start = 0;
+    decoder->end = 0;
+    decoder->eof = false;
+    decoder->lineno = 0;
+    decoder->error = NULL;
+    return 0;
+}
+
+// Decode only [start, end) of the file from now on. start must be the first byte of a line.
+int setHexDecoderRange(struct HexDecoder *decoder, uint64_t start, uint64_t end)
+{
+    decoder->range_start = start;
+    decoder->range_end = end;
+    return rewindHexDecoder(decoder);
+}
+
+// Decode up to max_lines lines into out, BYTES_PER_LINE bytes each. Returns 0 while there
+// is more input, 1 at the end of the file and -1 on error. *lines holds the lines decoded
+// in all three cases.
+int decodeHexLines(struct HexDecoder *decoder, uint8_t *out, size_t max_lines, size_t *lines)
+{
+    size_t n = 0;
+    int rc = 0;
+
+    while (n < max_lines)
+    {
+        const char *p = decoder->buf + decoder->start;
+        size_t avail = decoder->end - decoder->start;
+
+        // Fast path, a block of bare "<16 digits>\n" lines at a time
+        while (max_lines - n >= HEX_BLOCK_LINES && avail >= HEX_BLOCK_LINES * HEX_RECORD_LEN &&
+               p[HEX_RECORD_LEN - 1] == '\n' && p[2 * HEX_RECORD_LEN - 1] == '\n' && p[3 * HEX_RECORD_LEN - 1] == '\n' &&
+               p[4 * HEX_RECORD_LEN - 1] == '\n')
+        {
+            uint8_t *o = out + n * BYTES_PER_LINE;
+            if ((decode_line(p, o) | decode_line(p + HEX_RECORD_LEN, o + BYTES_PER_LINE) |
+                 decode_line(p + 2 * HEX_RECORD_LEN, o + 2 * BYTES_PER_LINE) | decode_line(p + 3 * HEX_RECORD_LEN, o + 3 * BYTES_PER_LINE)) != 0)
+            {
+                break;
+            }
+            p += HEX_BLOCK_LINES * HEX_RECORD_LEN;
+            avail -= HEX_BLOCK_LINES * HEX_RECORD_LEN;
+            n += HEX_BLOCK_LINES;
+            decoder->lineno += HEX_BLOCK_LINES;
+        }
+        while (n < max_lines && avail >= HEX_RECORD_LEN && p[HEX_RECORD_LEN - 1] == '\n' &&
+               decode_line(p, out + n * BYTES_PER_LINE) == 0)
+        {
+            p += HEX_RECORD_LEN;
+            avail -= HEX_RECORD_LEN;
+            n++;
+            decoder->lineno++;
+        }
+        decoder->start = (size_t)(p - decoder->buf);
+        if (n == max_lines)
+        {
+            break;
+        }
+
+        // Slow path, one line (or fgets sized piece of one) with the readNextLine rules
+        const char *nl = memchr(p, '\n', (avail < HEX_DECODER_LINE_MAX) ? avail : HEX_DECODER_LINE_MAX);
+        size_t len;
+        if (nl != NULL)
+        {
+            len = (size_t)(nl - p) + 1;
+        }
+        else if (avail >= HEX_DECODER_LINE_MAX)
+        {
+            len = HEX_DECODER_LINE_MAX;
+        }
+        else if (!decoder->eof)
+        {
+            if (refill(decoder) != 0)
+            {
+                rc = -1;
+                break;
+            }
+            continue;
+        }
+        else if (avail == 0)
+        {
+            rc = 1;
+            break;
+        }
+        else
+        {
+            len = avail; // Last line without a newline
+        }
+
+        decoder->lineno++;
+        int r = decode_segment(decoder, p, len, out + n * BYTES_PER_LINE);
+        decoder->start += len;
+        if (r < 0)
+        {
+            rc = -1;
+            break;
+        }
+        n += (size_t)r;
+    }
+    *lines = n;
+    return rc;
+}
+
+const char *getHexDecoderName(void)
+{
+#if defined(HEX_DECODER_NEON)
+    return "neon";
+#elif defined(HEX_DECODER_SSE2)
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
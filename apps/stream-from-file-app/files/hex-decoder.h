@@ -0,0 +1,36 @@
+#ifndef _HEX_DECODER_H
+#define _HEX_DECODER_H 1
+
+#include "helper.h"
+#include "input-reader.h"
+
+#define HEX_DECODER_BUF_SIZE (64 * 1024)
+#define HEX_DECODER_LINE_MAX 255 // readNextLine reads through a 256 B fgets buffer, longer lines are split the same way
+
+// Block decoder for hex dumps. Reads the file in large chunks, through io_uring read-ahead
+// where the kernel has it, and decodes runs of bare
+// 16 digit lines several at a time with NEON or SSE2. Anything else (comments, blank
+// lines, CRLF, trailing whitespace) goes through the same rules as readNextLine, so
+// both accept the same files and report errors at the same line numbers.
+struct HexDecoder
+{
+    struct InputReader reader;
+    char *buf;
+    size_t start; // Next byte to decode
+    size_t end;   // Bytes read into buf
+    bool eof;
+    uint64_t range_start;
+    uint64_t range_end; // Input ends here, UINT64_MAX for the end of the file
+    uint64_t lineno;    // Lines since range_start
+    bool quiet;         // Leave reporting line errors to the caller
+    const char *error;  // What is wrong with line lineno after an error
+};
+
+int initHexDecoder(struct HexDecoder *decoder, int fd);
+void freeHexDecoder(struct HexDecoder *decoder);
+int rewindHexDecoder(struct HexDecoder *decoder);
+int setHexDecoderRange(struct HexDecoder *decoder, uint64_t start, uint64_t end);
+int decodeHexLines(struct HexDecoder *decoder, uint8_t *out, size_t max_lines, size_t *lines);
+const char *getHexDecoderName(void);
+
+#endif
@@ -0,0 +1,392 @@
+#include "input-reader.h"
+
+#include <sys/syscall.h>
+
+// Private helper functions
+
+// No liburing on the target, the three system calls are all it needs
+static int uring_setup(unsigned int entries, struct io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int uring_register(int fd, unsigned int opcode, const void *arg, unsigned int nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void unmap_ring(struct InputRing *ring)
+{
+    if (ring->sqes != NULL)
+    {
+        munmap(ring->sqes, ring->sqes_len);
+    }
+    if (ring->cq_map != NULL && ring->cq_map != ring->sq_map)
+    {
+        munmap(ring->cq_map, ring->cq_map_len);
+    }
+    if (ring->sq_map != NULL)
+    {
+        munmap(ring->sq_map, ring->sq_map_len);
+    }
+    if (ring->fd >= 0)
+    {
+        close(ring->fd);
+    }
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+static int map_ring(struct InputRing *ring)
+{
+    struct io_uring_params params;
+    void *map;
+
+    memset(&params, 0, sizeof(params));
+    ring->fd = uring_setup(INPUT_READER_DEPTH, &params);
+    if (ring->fd < 0)
+    {
+        return -1;
+    }
+
+    ring->sq_map_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        // Since 5.4 both rings share one mapping
+        if (ring->cq_map_len > ring->sq_map_len)
+        {
+            ring->sq_map_len = ring->cq_map_len;
+        }
+        ring->cq_map_len = ring->sq_map_len;
+    }
+    map = mmap(NULL, ring->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (map == MAP_FAILED)
+    {
+        unmap_ring(ring);
+        return -1;
+    }
+    ring->sq_map = map;
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->cq_map = ring->sq_map;
+    }
+    else
+    {
+        map = mmap(NULL, ring->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (map == MAP_FAILED)
+        {
+            unmap_ring(ring);
+            return -1;
+        }
+        ring->cq_map = map;
+    }
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    map = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (map == MAP_FAILED)
+    {
+        unmap_ring(ring);
+        return -1;
+    }
+    ring->sqes = (struct io_uring_sqe *)map;
+
+    ring->sq_head = (unsigned *)((uint8_t *)ring->sq_map + params.sq_off.head);
+    ring->sq_tail = (unsigned *)((uint8_t *)ring->sq_map + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)((uint8_t *)ring->sq_map + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)((uint8_t *)ring->sq_map + params.sq_off.array);
+    ring->cq_head = (unsigned *)((uint8_t *)ring->cq_map + params.cq_off.head);
+    ring->cq_tail = (unsigned *)((uint8_t *)ring->cq_map + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)((uint8_t *)ring->cq_map + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)((uint8_t *)ring->cq_map + params.cq_off.cqes);
+    return 0;
+}
+
+// Keep INPUT_READER_DEPTH reads in flight, in file order
+static int issue_reads(struct InputReader *reader)
+{
+    struct InputRing *ring = &reader->ring;
+    unsigned int tail = *ring->sq_tail; // Only this thread moves the tail
+    unsigned int count = 0;
+
+    while (!reader->eof && reader->issued - reader->consumed < INPUT_READER_DEPTH && reader->pos < reader->end)
+    {
+        size_t slot = reader->issued % INPUT_READER_DEPTH;
+        struct io_uring_sqe *sqe = &ring->sqes[tail & *ring->sq_mask];
+        size_t len = INPUT_READER_BLOCK;
+
+        if (len > reader->end - reader->pos)
+        {
+            len = (size_t)(reader->end - reader->pos);
+        }
+        reader->iov[slot].iov_len = len;
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->fd = reader->fd;
+        sqe->off = reader->pos;
+        sqe->user_data = slot;
+        if (reader->fixed)
+        {
+            sqe->opcode = IORING_OP_READ_FIXED;
+            sqe->addr = (uint64_t)(uintptr_t)reader->iov[slot].iov_base;
+            sqe->len = (uint32_t)len;
+            sqe->buf_index = (uint16_t)slot;
+        }
+        else
+        {
+            sqe->opcode = IORING_OP_READV;
+            sqe->addr = (uint64_t)(uintptr_t)&reader->iov[slot];
+            sqe->len = 1;
+        }
+        ring->sq_array[tail & *ring->sq_mask] = tail & *ring->sq_mask;
+        tail++;
+        count++;
+        reader->done[slot] = false;
+        reader->issued++;
+        reader->inflight++;
+        reader->pos += len;
+    }
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    // The kernel reads the entries once it sees the new tail
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+    while (count > 0)
+    {
+        int r = uring_enter(ring->fd, count, 0, 0);
+        if (r < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (r < 0)
+        {
+            fprintf(stderr, "io_uring_enter: %s\n", strerror(errno));
+            return -1;
+        }
+        count -= (unsigned int)r;
+    }
+    return 0;
+}
+
+static void reap_completions(struct InputReader *reader)
+{
+    struct InputRing *ring = &reader->ring;
+    unsigned int head = *ring->cq_head;
+    unsigned int tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail)
+    {
+        const struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        size_t slot = (size_t)cqe->user_data;
+
+        reader->result[slot] = cqe->res;
+        reader->done[slot] = true;
+        reader->inflight--;
+        head++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+// Block until at least one more read completes. Only called with reads in flight.
+static int wait_completion(struct InputReader *reader)
+{
+    size_t before = reader->inflight;
+
+    reap_completions(reader);
+    while (reader->inflight == before)
+    {
+        if (uring_enter(reader->ring.fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+        {
+            fprintf(stderr, "io_uring_enter: %s\n", strerror(errno));
+            return -1;
+        }
+        reap_completions(reader);
+    }
+    return 0;
+}
+
+// Reads still in flight write into the blocks, wait for all of them before reusing any
+static int drain_reads(struct InputReader *reader)
+{
+    while (reader->inflight > 0)
+    {
+        if (wait_completion(reader) != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static ssize_t read_sync(struct InputReader *reader, void *dst, size_t max)
+{
+    if (max > reader->end - reader->pos)
+    {
+        max = (size_t)(reader->end - reader->pos);
+    }
+    if (max == 0)
+    {
+        return 0;
+    }
+    for (;;)
+    {
+        ssize_t n = reader->stream ? read(reader->fd, dst, max) : pread(reader->fd, dst, max, (off_t)reader->pos);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            fprintf(stderr, "read: %s\n", strerror(errno));
+            return -1;
+        }
+        reader->pos += (uint64_t)n;
+        return n;
+    }
+}
+
+// Public methods
+int initInputReader(struct InputReader *reader, int fd)
+{
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = fd;
+    reader->end = UINT64_MAX;
+    reader->ring.fd = -1;
+
+    if (lseek(fd, 0, SEEK_CUR) < 0)
+    {
+        // A pipe or terminal, nothing to read ahead at an offset
+        reader->stream = true;
+        return 0;
+    }
+    if (map_ring(&reader->ring) != 0)
+    {
+        return 0; // No io_uring in this kernel, read on demand
+    }
+    reader->blocks = aligned_alloc(4096, INPUT_READER_DEPTH * INPUT_READER_BLOCK);
+    if (reader->blocks == NULL)
+    {
+        fprintf(stderr, "Failed to allocate the input read-ahead blocks\n");
+        unmap_ring(&reader->ring);
+        return -1;
+    }
+    for (size_t i = 0; i < INPUT_READER_DEPTH; i++)
+    {
+        reader->iov[i].iov_base = reader->blocks + i * INPUT_READER_BLOCK;
+        reader->iov[i].iov_len = INPUT_READER_BLOCK;
+    }
+    // Registering pins the blocks, older kernels count that against RLIMIT_MEMLOCK
+    reader->fixed = (uring_register(reader->ring.fd, IORING_REGISTER_BUFFERS, reader->iov, INPUT_READER_DEPTH) == 0);
+    reader->uring = true;
+    return 0;
+}
+
+void freeInputReader(struct InputReader *reader)
+{
+    if (reader->uring)
+    {
+        drain_reads(reader);
+        unmap_ring(&reader->ring);
+        free(reader->blocks);
+        reader->blocks = NULL;
+        reader->uring = false;
+    }
+}
+
+// Read [start, end) from now on, UINT64_MAX for the end of the file
+int seekInputReader(struct InputReader *reader, uint64_t start, uint64_t end)
+{
+    if (reader->uring && drain_reads(reader) != 0)
+    {
+        return -1;
+    }
+    if (reader->stream && lseek(reader->fd, (off_t)start, SEEK_SET) < 0)
+    {
+        fprintf(stderr, "lseek: %s\n", strerror(errno));
+        return -1;
+    }
+    reader->pos = start;
+    reader->end = end;
+    reader->issued = 0;
+    reader->consumed = 0;
+    reader->used = 0;
+    reader->eof = false;
+    return 0;
+}
+
+// Copy up to max bytes of the file, in order, into dst. Returns the bytes copied, 0 at
+// the end of the input and -1 on error.
+ssize_t readInput(struct InputReader *reader, void *dst, size_t max)
+{
+    if (!reader->uring)
+    {
+        return read_sync(reader, dst, max);
+    }
+
+    for (;;)
+    {
+        if (issue_reads(reader) != 0)
+        {
+            return -1;
+        }
+        if (reader->consumed == reader->issued)
+        {
+            return 0;
+        }
+
+        size_t slot = reader->consumed % INPUT_READER_DEPTH;
+        while (!reader->done[slot])
+        {
+            if (wait_completion(reader) != 0)
+            {
+                return -1;
+            }
+        }
+        if (reader->result[slot] < 0)
+        {
+            fprintf(stderr, "read: %s\n", strerror(-reader->result[slot]));
+            return -1;
+        }
+
+        size_t length = (size_t)reader->result[slot];
+        size_t n = length - reader->used;
+        if (n > max)
+        {
+            n = max;
+        }
+        memcpy(dst, (uint8_t *)reader->iov[slot].iov_base + reader->used, n);
+        reader->used += n;
+        if (reader->used == length)
+        {
+            // A short read is the end of the file, the reads issued past it are dropped
+            if (length < reader->iov[slot].iov_len)
+            {
+                reader->eof = true;
+                reader->consumed = reader->issued;
+            }
+            else
+            {
+                reader->consumed++;
+            }
+            reader->used = 0;
+        }
+        if (n > 0)
+        {
+            return (ssize_t)n;
+        }
+    }
+}
+
+const char *getInputReaderName(const struct InputReader *reader)
+{
+    if (reader->uring)
+    {
+        return reader->fixed ? "io_uring, registered buffers" : "io_uring";
+    }
+    return reader->stream ? "read" : "pread";
+}
@@ -0,0 +1,58 @@
+#ifndef _INPUT_READER_H
+#define _INPUT_READER_H 1
+
+#include "helper.h"
+
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+
+#define INPUT_READER_BLOCK (128 * 1024)
+#define INPUT_READER_DEPTH 4 // Reads kept in flight ahead of the decoder
+
+// The io_uring submission and completion rings, mapped from the kernel
+struct InputRing
+{
+    int fd;
+    void *sq_map;
+    size_t sq_map_len;
+    void *cq_map; // Same as sq_map with IORING_FEAT_SINGLE_MMAP
+    size_t cq_map_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+// Reads a file front to back with INPUT_READER_DEPTH reads of INPUT_READER_BLOCK bytes
+// in flight through io_uring, so the page cache misses of the next blocks are served
+// while the current one is decoded. The blocks are registered with the ring once when
+// the kernel allows it. Kernels without io_uring (or where it is disabled) and inputs
+// that are not regular files fall back to plain pread()/read() on demand.
+struct InputReader
+{
+    int fd;
+    bool uring;  // false reads synchronously
+    bool fixed;  // Blocks are registered, IORING_OP_READ_FIXED instead of READV
+    bool stream; // Not seekable, plain read() in order
+    struct InputRing ring;
+    uint8_t *blocks;
+    struct iovec iov[INPUT_READER_DEPTH];
+    int32_t result[INPUT_READER_DEPTH]; // Bytes read into each block, -errno on error
+    bool done[INPUT_READER_DEPTH];
+    uint64_t pos; // File offset of the next read to issue
+    uint64_t end; // Reading stops here, UINT64_MAX for the end of the file
+    size_t issued;   // Reads issued, free running
+    size_t consumed; // Blocks fully handed out, free running
+    size_t inflight; // Issued reads whose completion has not been reaped
+    size_t used;     // Bytes of the oldest block already handed out
+    bool eof;        // A read came back short, nothing past it is issued or handed out
+};
+
+int initInputReader(struct InputReader *reader, int fd);
+void freeInputReader(struct InputReader *reader);
+int seekInputReader(struct InputReader *reader, uint64_t start, uint64_t end);
+ssize_t readInput(struct InputReader *reader, void *dst, size_t max);
+const char *getInputReaderName(const struct InputReader *reader);
+
+#endif
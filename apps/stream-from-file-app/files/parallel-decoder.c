@@ -0,0 +1,338 @@
+#include "parallel-decoder.h"
+
+#include <inttypes.h>
+#include <sys/stat.h>
+
+// Private helper functions
+
+// First line start at or after off. Blocks begin there, so a line is never split between two.
+static int find_line_start(int fd, uint64_t off, uint64_t size, uint64_t *start)
+{
+    char buf[4096];
+    uint64_t pos;
+
+    if (off == 0 || off >= size)
+    {
+        *start = (off < size) ? off : size;
+        return 0;
+    }
+    pos = off - 1; // A line starts at off if the byte before it ends one
+    while (pos < size)
+    {
+        ssize_t n = pread(fd, buf, sizeof(buf), (off_t)pos);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            fprintf(stderr, "pread: %s\n", strerror(errno));
+            return -1;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        const char *nl = memchr(buf, '\n', (size_t)n);
+        if (nl != NULL)
+        {
+            *start = pos + (uint64_t)(nl - buf) + 1;
+            return 0;
+        }
+        pos += (uint64_t)n;
+    }
+    *start = size;
+    return 0;
+}
+
+static void decode_block(struct ParallelWorker *worker, uint64_t k, struct ParallelBlock *block)
+{
+    struct ParallelDecoder *pd = worker->pd;
+    uint64_t start, end;
+
+    block->lines = 0;
+    block->lineno = 0;
+    block->error = NULL;
+    block->result = -1;
+    if (find_line_start(pd->fd, k * PARALLEL_DECODER_BLOCK, pd->size, &start) != 0 ||
+        find_line_start(pd->fd, (k + 1) * PARALLEL_DECODER_BLOCK, pd->size, &end) != 0)
+    {
+        return;
+    }
+
+    // Every decoded line takes 16 digits of the block, one more line of room lets the
+    // decoder see the end of the block instead of stopping on a full buffer
+    size_t need = (size_t)((end - start) / HEXCHARS_PER_LINE) + 1;
+    if (need > block->capacity)
+    {
+        uint8_t *words = realloc(block->words, need * BYTES_PER_LINE);
+        if (words == NULL)
+        {
+            fprintf(stderr, "Failed to allocate %zu B for a decoded block\n", need * BYTES_PER_LINE);
+            return;
+        }
+        block->words = words;
+        block->capacity = need;
+    }
+    if (setHexDecoderRange(&worker->decoder, start, end) != 0)
+    {
+        return;
+    }
+    block->result = decodeHexLines(&worker->decoder, block->words, need, &block->lines);
+    block->lineno = worker->decoder.lineno;
+    block->error = worker->decoder.error;
+}
+
+static void *decode_worker(void *arg)
+{
+    struct ParallelWorker *worker = (struct ParallelWorker *)arg;
+    struct ParallelDecoder *pd = worker->pd;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&pd->lock);
+        // Block k reuses the slot of block k - slots, wait until that one has been handed out
+        while (pd->running && pd->next < pd->blocks && pd->next >= pd->current + pd->slots)
+        {
+            pthread_cond_wait(&pd->space, &pd->lock);
+        }
+        if (!pd->running || pd->next >= pd->blocks)
+        {
+            pthread_mutex_unlock(&pd->lock);
+            break;
+        }
+        uint64_t k = pd->next++;
+        pthread_mutex_unlock(&pd->lock);
+
+        struct ParallelBlock *block = &pd->slot[k % pd->slots];
+        decode_block(worker, k, block);
+
+        pthread_mutex_lock(&pd->lock);
+        block->ready = true;
+        pthread_cond_broadcast(&pd->ready);
+        pthread_mutex_unlock(&pd->lock);
+    }
+    return NULL;
+}
+
+static int launch_workers(struct ParallelDecoder *pd)
+{
+    pd->next = 0;
+    pd->current = 0;
+    pd->offset = 0;
+    pd->lineno = 0;
+    pd->running = true;
+    for (size_t i = 0; i < pd->slots; i++)
+    {
+        pd->slot[i].ready = false;
+    }
+    for (unsigned int i = 0; i < pd->threads; i++)
+    {
+        if (pthread_create(&pd->worker[i].thread, NULL, decode_worker, &pd->worker[i]) != 0)
+        {
+            fprintf(stderr, "pthread_create(decoder) failed\n");
+            pthread_mutex_lock(&pd->lock);
+            pd->running = false;
+            pthread_cond_broadcast(&pd->space);
+            pthread_mutex_unlock(&pd->lock);
+            for (unsigned int j = 0; j < i; j++)
+            {
+                pthread_join(pd->worker[j].thread, NULL);
+            }
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void join_workers(struct ParallelDecoder *pd)
+{
+    pthread_mutex_lock(&pd->lock);
+    pd->running = false;
+    pthread_cond_broadcast(&pd->space);
+    pthread_mutex_unlock(&pd->lock);
+    for (unsigned int i = 0; i < pd->threads; i++)
+    {
+        pthread_join(pd->worker[i].thread, NULL);
+    }
+}
+
+static void free_workers(struct ParallelDecoder *pd)
+{
+    for (unsigned int i = 0; i < pd->threads; i++)
+    {
+        freeHexDecoder(&pd->worker[i].decoder);
+    }
+    for (size_t i = 0; i < pd->slots; i++)
+    {
+        free(pd->slot[i].words);
+    }
+    pthread_cond_destroy(&pd->space);
+    pthread_cond_destroy(&pd->ready);
+    pthread_mutex_destroy(&pd->lock);
+}
+
+// Public methods
+
+// One decoder per online CPU
+unsigned int getDefaultDecodeThreads(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (n < 1)
+    {
+        return 1;
+    }
+    return (n > PARALLEL_DECODER_MAX_THREADS) ? PARALLEL_DECODER_MAX_THREADS : (unsigned int)n;
+}
+
+int startParallelDecoder(struct ParallelDecoder *pd, int fd, unsigned int threads)
+{
+    struct stat st;
+
+    memset(pd, 0, sizeof(*pd));
+    pd->fd = fd;
+    if (threads > PARALLEL_DECODER_MAX_THREADS)
+    {
+        threads = PARALLEL_DECODER_MAX_THREADS;
+    }
+    if (fstat(fd, &st) != 0)
+    {
+        fprintf(stderr, "fstat: %s\n", strerror(errno));
+        return -1;
+    }
+    pd->size = (uint64_t)st.st_size;
+    pd->blocks = (pd->size + PARALLEL_DECODER_BLOCK - 1) / PARALLEL_DECODER_BLOCK;
+    if (threads > pd->blocks)
+    {
+        threads = (unsigned int)pd->blocks;
+    }
+    if (threads <= 1 || !S_ISREG(st.st_mode))
+    {
+        // Nothing to split, or nothing to split it with
+        return initHexDecoder(&pd->decoder, fd);
+    }
+
+    pd->slots = 2 * threads;
+    pthread_mutex_init(&pd->lock, NULL);
+    pthread_cond_init(&pd->ready, NULL);
+    pthread_cond_init(&pd->space, NULL);
+    for (unsigned int i = 0; i < threads; i++)
+    {
+        pd->worker[i].pd = pd;
+        if (initHexDecoder(&pd->worker[i].decoder, fd) != 0)
+        {
+            pd->threads = i;
+            free_workers(pd);
+            return -1;
+        }
+        // Line numbers are only known once the blocks before are counted, see decodeParallelLines
+        pd->worker[i].decoder.quiet = true;
+    }
+    pd->threads = threads;
+    if (launch_workers(pd) != 0)
+    {
+        free_workers(pd);
+        return -1;
+    }
+    return 0;
+}
+
+void stopParallelDecoder(struct ParallelDecoder *pd)
+{
+    if (pd->threads == 0)
+    {
+        freeHexDecoder(&pd->decoder);
+        return;
+    }
+    join_workers(pd);
+    free_workers(pd);
+    pd->threads = 0;
+}
+
+int rewindParallelDecoder(struct ParallelDecoder *pd)
+{
+    int r;
+
+    if (pd->threads == 0)
+    {
+        r = rewindHexDecoder(&pd->decoder);
+        pd->lineno = 0;
+        return r;
+    }
+    join_workers(pd);
+    r = launch_workers(pd);
+    if (r != 0)
+    {
+        // The workers are gone, stopParallelDecoder must not join them again
+        free_workers(pd);
+        memset(pd->worker, 0, sizeof(pd->worker));
+        pd->threads = 0;
+    }
+    return r;
+}
+
+// Same contract as decodeHexLines: up to max_lines lines into out, 0 while there is more
+// input, 1 at the end of the file and -1 on error. Lines come out in file order.
+int decodeParallelLines(struct ParallelDecoder *pd, uint8_t *out, size_t max_lines, size_t *lines)
+{
+    size_t n = 0;
+
+    if (pd->threads == 0)
+    {
+        int r = decodeHexLines(&pd->decoder, out, max_lines, lines);
+        pd->lineno = pd->decoder.lineno;
+        return r;
+    }
+
+    while (n < max_lines)
+    {
+        if (pd->current >= pd->blocks)
+        {
+            *lines = n;
+            return 1;
+        }
+
+        struct ParallelBlock *block = &pd->slot[pd->current % pd->slots];
+        pthread_mutex_lock(&pd->lock);
+        while (!block->ready)
+        {
+            pthread_cond_wait(&pd->ready, &pd->lock);
+        }
+        pthread_mutex_unlock(&pd->lock);
+
+        size_t take = block->lines - pd->offset;
+        if (take > max_lines - n)
+        {
+            take = max_lines - n;
+        }
+        memcpy(out + n * BYTES_PER_LINE, block->words + pd->offset * BYTES_PER_LINE, take * BYTES_PER_LINE);
+        n += take;
+        pd->offset += take;
+        if (pd->offset < block->lines)
+        {
+            break;
+        }
+
+        if (block->result < 0)
+        {
+            // Everything before the bad line has been handed out
+            pd->lineno += block->lineno;
+            if (block->error != NULL)
+            {
+                fprintf(stderr, "Line %" PRIu64 ": %s\n", pd->lineno, block->error);
+            }
+            *lines = n;
+            return -1;
+        }
+        pd->lineno += block->lineno;
+        pthread_mutex_lock(&pd->lock);
+        block->ready = false;
+        pd->current++;
+        pd->offset = 0;
+        pthread_cond_broadcast(&pd->space);
+        pthread_mutex_unlock(&pd->lock);
+    }
+    *lines = n;
+    return 0;
+}
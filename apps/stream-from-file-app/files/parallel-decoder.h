@@ -0,0 +1,65 @@
+#ifndef _PARALLEL_DECODER_H
+#define _PARALLEL_DECODER_H 1
+
+#include "helper.h"
+#include "hex-decoder.h"
+
+#include <pthread.h>
+
+#ifndef PARALLEL_DECODER_BLOCK
+#define PARALLEL_DECODER_BLOCK (1024 * 1024) // Bytes of hex dump per work item
+#endif
+#define PARALLEL_DECODER_MAX_THREADS 16
+
+struct ParallelDecoder;
+
+struct ParallelBlock
+{
+    uint8_t *words;
+    size_t capacity; // Lines words has room for
+    size_t lines;    // Lines decoded
+    int result;      // decodeHexLines() result for the block, 1 when all of it decoded
+    uint64_t lineno; // Lines of the file in the block, decoded or not
+    const char *error;
+    bool ready;
+};
+
+struct ParallelWorker
+{
+    struct ParallelDecoder *pd;
+    struct HexDecoder decoder; // Over one block at a time
+    pthread_t thread;
+};
+
+// Decodes a hex dump on a pool of worker threads. The file is cut into blocks of about
+// PARALLEL_DECODER_BLOCK bytes, each moved forward to the next line start, so every worker
+// finds its own range without reading the ones before it. Up to two blocks per worker are
+// decoded ahead and handed out strictly in file order. With one thread, or an input that
+// cannot be split (a pipe), the lines are decoded in place by a single HexDecoder instead.
+struct ParallelDecoder
+{
+    int fd;
+    unsigned int threads;      // Workers, 0 when decoding in place
+    struct HexDecoder decoder; // The in place decoder
+    uint64_t size;
+    uint64_t blocks;
+    struct ParallelWorker worker[PARALLEL_DECODER_MAX_THREADS];
+    struct ParallelBlock slot[2 * PARALLEL_DECODER_MAX_THREADS];
+    size_t slots;
+    pthread_mutex_t lock;
+    pthread_cond_t ready; // A block was decoded
+    pthread_cond_t space; // A slot was handed back
+    uint64_t next;        // Next block a worker picks up
+    uint64_t current;     // Block being handed out
+    size_t offset;        // Lines of the current block already handed out
+    bool running;
+    uint64_t lineno; // Lines of the file behind what was handed out, the line at fault after an error
+};
+
+unsigned int getDefaultDecodeThreads(void);
+int startParallelDecoder(struct ParallelDecoder *pd, int fd, unsigned int threads);
+void stopParallelDecoder(struct ParallelDecoder *pd);
+int rewindParallelDecoder(struct ParallelDecoder *pd);
+int decodeParallelLines(struct ParallelDecoder *pd, uint8_t *out, size_t max_lines, size_t *lines);
+
+#endif
@@ -1,43 +1,118 @@
+#include "chunk-sizer.h"
 #include "dma-api.h"
+#include "dma-reactor.h"
+#include "event-parser.h"
 #include "helper.h"
 
 #include <inttypes.h>
 
+struct TxSlotStats
+{
+    uint64_t chunks;
+    uint64_t underruns;                         // MM2S ran dry while there was input left
+    uint64_t depth[EVENT_PARSER_MAX_DEPTH + 1]; // Slots queued when a chunk completes
+};
+
+static void print_tx_stats(const struct TxSlotStats *stats, const struct EventParser *parser, size_t slot_bytes)
+{
+    size_t slots = parser->depth;
+
+    printf("TX: %zu slots of %zu B, %" PRIu64 " chunks, %" PRIu64 " underruns, %" PRIu64 " parser waits with every slot queued\n",
+           slots, slot_bytes, stats->chunks, stats->underruns, parser->full_waits);
+    printf("TX queue depth at completion:");
+    for (size_t d = 1; d <= slots; d++)
+    {
+        printf(" %zu: %" PRIu64, d, stats->depth[d]);
+    }
+    printf("\n");
+}
+
+// Reactor callback, hands the completion result back to the main loop
+static void storeDmaResult(void *arg, int result)
+{
+    *(int *)arg = result;
+}
+
+// Reactor callback for the parser eventfd, the main loop looks at the ring itself
+static void drainParserEvent(void *arg, int events)
+{
+    uint64_t ticks;
+
+    (void)events;
+    if (read(*(int *)arg, &ticks, sizeof(ticks)) < 0 && errno != EAGAIN)
+    {
+        perror("read(eventfd)");
+    }
+}
+
 int main(int argc, char *argv[])
 {
     const char *udmabuf0_dev = "/dev/udmabuf0";
     const char *udmabuf1_dev = "/dev/udmabuf1";
+    const char *udmabuf2_dev = "/dev/udmabuf2";
     const char *uio_dev = "/dev/uio4";
 
-    FILE *input_file_handle;
+    // Inputs are collected at the front of argv, argv[1] up to argv[input_end - 1]
+    int input_end = 2;
+    struct EventPlaylist playlist;
 
-    uint64_t phy_src_addr, phy_dest_addr;
-    uint32_t size_src_buf, size_dest_buf;
-    int fd_buf0, fd_buf1;
-    uint8_t *src_buf, *dest_buf;
+    uint64_t phy_src_addr, phy_dest_addr, phy_desc_addr;
+    uint32_t size_src_buf, size_dest_buf, size_desc_buf = 0;
+    int fd_buf0, fd_buf1, fd_buf2 = -1;
+    uint8_t *src_buf, *dest_buf, *desc_buf = NULL;
     volatile uint8_t *reg_map;
+    struct DmaSgRing tx_ring, rx_ring;
+    struct DmaReactor reactor;
+    int rx_result, tx_result;
+    struct DmaRecovery recovery;
+    struct DmaWaitStrategy wait;
+    struct DmaTrace trace;
 
-    // 2048B is 128 lines, i.e. 2048/16.
-    char line_buf[17];
-    // 128 lines is 1024B, i.e. 128*8
-    size_t transmission_bytes = 1024;
     size_t network_trigger_counter = 0;
 
-    uint64_t lineno = 0;
     bool finished_operation = false;
+    int exit_code = 0;
     bool finished_transmitting = false;
-    bool transmit_slot_available = true;
+    // The source buffer is split into slots of one chunk each. The parser thread fills them and
+    // this thread only moves them through MM2S, the oldest tx_issued published slots are with the engine.
+    struct EventParser parser;
+    // One MM2S transfer per chunk, CHUNK_BYTES unless --chunk-bytes says otherwise. Slots
+    // are as large as the largest chunk, which --chunk-bytes=auto grows and shrinks.
+    size_t chunk_bytes = CHUNK_BYTES, slot_bytes, max_chunk_bytes;
+    bool adaptive_chunks = false;
+    struct ChunkSizer sizer;
+    uint8_t length_width;
+    size_t tx_slots, tx_issued = 0;
+    // With --loop, an input that fits in udmabuf0 is decoded there once and MM2S cycles over it,
+    // each pass one large transfer split at the chunk size
+    size_t resident_bytes = 0;
+    struct DmaLargeTransfer resident_xfer = {0};
+    uint64_t resident_passes = 0;
+    size_t ring_depth = 0;
+    int parser_cpu = -1, dma_cpu = -1;
+    struct TxSlotStats tx_stats = {0};
+    struct EventPacer pacer;
+    double pace_speed = 0; // 0 streams as fast as the DMA takes it
+    unsigned int decode_threads = getDefaultDecodeThreads();
+    // --start/--end, in seconds from the first EVT_TIME_HIGH of each input
+    double start_s = 0, end_s = -1;
     size_t frame_index = 0;
     uint64_t frames_received = 0;
 
-    if (argc < 2 || argc > 4)
+    if (argc < 2)
     {
-        printf("Invalid use. Function expects: stream-from-file <path to input file> [visualizer PID] [--loop]\n");
+        printf("Invalid use. Function expects: stream-from-file <path to input file> [more input files...] [visualizer PID] [--loop] [--irq] [--sg] [--cyclic] [--busy-poll=SPIN_US[,YIELD_US]] [--trace=FILE] [--cached] [--ring-depth=N] [--parser-cpu=N] [--dma-cpu=N] [--pace[=SPEED]] [--decode-threads=N] [--chunk-bytes=N|auto] [--start=SECONDS] [--end=SECONDS]\n");
         exit(1);
     }
 
     pid_t pid = -1; // means "not provided"
     bool loop_file = false;
+    enum DmaWaitMode wait_mode = DMA_WAIT_POLL;
+    bool use_sg = false;
+    bool use_cyclic = false;
+    uint32_t spin_us = 0, yield_us = 0;
+    const char *trace_path = NULL;
+    bool use_cached = false;
 
     for (int i = 2; i < argc; i++)
     {
@@ -46,22 +121,157 @@ int main(int argc, char *argv[])
             loop_file = true;
             continue;
         }
+        if (strcmp(argv[i], "--irq") == 0)
+        {
+            wait_mode = DMA_WAIT_IRQ;
+            continue;
+        }
+        if (strcmp(argv[i], "--sg") == 0)
+        {
+            use_sg = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--cyclic") == 0)
+        {
+            use_cyclic = true;
+            continue;
+        }
+        if (strncmp(argv[i], "--busy-poll=", 12) == 0)
+        {
+            // Yield budget defaults to the spin budget
+            int n = sscanf(argv[i] + 12, "%u,%u", &spin_us, &yield_us);
+            if (n < 1)
+            {
+                fprintf(stderr, "Invalid arg: %s (expected --busy-poll=SPIN_US[,YIELD_US])\n", argv[i]);
+                return 1;
+            }
+            if (n == 1)
+            {
+                yield_us = spin_us;
+            }
+            continue;
+        }
+        if (strncmp(argv[i], "--trace=", 8) == 0)
+        {
+            trace_path = argv[i] + 8;
+            continue;
+        }
+        if (strcmp(argv[i], "--cached") == 0)
+        {
+            use_cached = true;
+            continue;
+        }
+        if (strncmp(argv[i], "--ring-depth=", 13) == 0)
+        {
+            if (sscanf(argv[i] + 13, "%zu", &ring_depth) != 1 || ring_depth == 0 || ring_depth > EVENT_PARSER_MAX_DEPTH)
+            {
+                fprintf(stderr, "Invalid arg: %s (expected --ring-depth=1..%d)\n", argv[i], EVENT_PARSER_MAX_DEPTH);
+                return 1;
+            }
+            continue;
+        }
+        if (strncmp(argv[i], "--parser-cpu=", 13) == 0 || strncmp(argv[i], "--dma-cpu=", 10) == 0)
+        {
+            int *cpu = (argv[i][2] == 'p') ? &parser_cpu : &dma_cpu;
+            if (sscanf(strchr(argv[i], '=') + 1, "%d", cpu) != 1 || *cpu < 0)
+            {
+                fprintf(stderr, "Invalid arg: %s (expected a CPU number)\n", argv[i]);
+                return 1;
+            }
+            continue;
+        }
+
+        if (strcmp(argv[i], "--pace") == 0)
+        {
+            pace_speed = 1.0;
+            continue;
+        }
+        if (strncmp(argv[i], "--pace=", 7) == 0)
+        {
+            if (sscanf(argv[i] + 7, "%lf", &pace_speed) != 1 || !(pace_speed > 0))
+            {
+                fprintf(stderr, "Invalid arg: %s (expected --pace=SPEED, e.g. 0.5 or 2)\n", argv[i]);
+                return 1;
+            }
+            continue;
+        }
+
+        if (strncmp(argv[i], "--decode-threads=", 17) == 0)
+        {
+            if (sscanf(argv[i] + 17, "%u", &decode_threads) != 1 || decode_threads == 0 || decode_threads > PARALLEL_DECODER_MAX_THREADS)
+            {
+                fprintf(stderr, "Invalid arg: %s (expected --decode-threads=1..%d)\n", argv[i], PARALLEL_DECODER_MAX_THREADS);
+                return 1;
+            }
+            continue;
+        }
 
-        // otherwise treat it as PID
+        if (strcmp(argv[i], "--chunk-bytes=auto") == 0)
+        {
+            adaptive_chunks = true;
+            continue;
+        }
+        if (strncmp(argv[i], "--chunk-bytes=", 14) == 0)
+        {
+            if (sscanf(argv[i] + 14, "%zu", &chunk_bytes) != 1 || chunk_bytes == 0 || chunk_bytes % BYTES_PER_LINE != 0)
+            {
+                fprintf(stderr, "Invalid arg: %s (expected --chunk-bytes=auto or a multiple of %d)\n", argv[i], BYTES_PER_LINE);
+                return 1;
+            }
+            continue;
+        }
+
+        if (strncmp(argv[i], "--start=", 8) == 0 || strncmp(argv[i], "--end=", 6) == 0)
+        {
+            bool start = (argv[i][2] == 's');
+            double *seconds = start ? &start_s : &end_s;
+            if (sscanf(argv[i] + (start ? 8 : 6), "%lf", seconds) != 1 || !(*seconds >= 0))
+            {
+                fprintf(stderr, "Invalid arg: %s (expected --start=SECONDS or --end=SECONDS, e.g. 12.5)\n", argv[i]);
+                return 1;
+            }
+            continue;
+        }
+
+        if (strncmp(argv[i], "--", 2) == 0)
+        {
+            fprintf(stderr, "Invalid arg: %s (expected PID, input file, --loop, --irq, --sg, --cyclic, --busy-poll=, --trace=, --cached, --ring-depth=, --parser-cpu=, --dma-cpu=, --pace, --decode-threads=, --chunk-bytes=, --start= or --end=)\n", argv[i]);
+            return 1;
+        }
+
+        // A number is the PID, anything else one more input for the playlist
         char *end = NULL;
         long v = strtol(argv[i], &end, 10);
-        if (end == argv[i] || *end != '\0' || v <= 0)
+        if (end == argv[i] || *end != '\0')
+        {
+            argv[input_end++] = argv[i];
+            continue;
+        }
+        if (v <= 0)
         {
-            fprintf(stderr, "Invalid arg: %s (expected PID or --loop)\n", argv[i]);
+            fprintf(stderr, "Invalid arg: %s (expected a PID above 0)\n", argv[i]);
             return 1;
         }
         pid = (pid_t)v;
     }
 
-    input_file_handle = fopen(argv[1], "r");
-    if (!input_file_handle)
+    // The inputs stream back to back through the one DMA setup below, the next file is
+    // opened and decoded ahead while the current one streams
+    if (end_s >= 0 && end_s <= start_s)
+    {
+        fprintf(stderr, "Invalid args: --end=%g has to be after --start=%g\n", end_s, start_s);
+        return 1;
+    }
+    // Ctrl-C or SIGTERM ends the stream through the statistics and the trace dump below
+    if (installStopHandler() != 0)
+    {
+        return 1;
+    }
+    // Recordings seek straight to --start through their time index (see evt-convert)
+    uint64_t start_us = (uint64_t)(start_s * 1e6);
+    uint64_t end_us = (end_s >= 0) ? (uint64_t)(end_s * 1e6) : UINT64_MAX;
+    if (openEventPlaylist(&playlist, argv + 1, (size_t)(input_end - 1), loop_file, decode_threads, start_us, end_us) != 0)
     {
-        fprintf(stderr, "fopen: %s\n", strerror(errno));
         printf("Provide a valid value, i.e. path to input file\n");
         exit(1);
     }
@@ -82,21 +292,84 @@ int main(int argc, char *argv[])
         exit(1);
     }
 
-    fd_buf0 = open(udmabuf0_dev, O_RDWR);
+    // A chunk goes out as one transfer, so it is bounded by the length register of the DMA
+    if (getDmaLengthWidth(uio_dev, &length_width) != 0)
+    {
+        length_width = DMA_LENGTH_WIDTH_DEFAULT;
+    }
+    max_chunk_bytes = getDmaMaxSegment(length_width);
+    if (max_chunk_bytes > size_src_buf)
+    {
+        max_chunk_bytes = size_src_buf & ~(uint32_t)(BYTES_PER_LINE - 1);
+    }
+    if (adaptive_chunks)
+    {
+        // Room for the ring depth asked for, or at least CHUNK_SIZER_MIN_SLOTS slots
+        slot_bytes = (size_src_buf / ((ring_depth > 0) ? ring_depth : CHUNK_SIZER_MIN_SLOTS)) & ~(size_t)(BYTES_PER_LINE - 1);
+        if (slot_bytes > max_chunk_bytes)
+        {
+            slot_bytes = max_chunk_bytes;
+        }
+        if (slot_bytes < CHUNK_BYTES)
+        {
+            slot_bytes = CHUNK_BYTES;
+        }
+        chunk_bytes = CHUNK_BYTES;
+    }
+    else
+    {
+        if (chunk_bytes > max_chunk_bytes)
+        {
+            fprintf(stderr, "--chunk-bytes=%zu is more than one transfer carries, at most %zu B (%u B source buffer, %u bit length register)\n",
+                    chunk_bytes, max_chunk_bytes, size_src_buf, length_width);
+            exit(1);
+        }
+        slot_bytes = chunk_bytes;
+    }
+
+    tx_slots = size_src_buf / slot_bytes;
+    if (tx_slots == 0)
+    {
+        fprintf(stderr, "Source buffer of %u B is smaller than one %zu B chunk\n", size_src_buf, slot_bytes);
+        exit(1);
+    }
+    if (ring_depth > tx_slots)
+    {
+        fprintf(stderr, "--ring-depth=%zu needs %zu B, the source buffer is %u B\n", ring_depth, ring_depth * slot_bytes, size_src_buf);
+        exit(1);
+    }
+    if (ring_depth > 0)
+    {
+        tx_slots = ring_depth;
+    }
+    if (tx_slots > EVENT_PARSER_MAX_DEPTH)
+    {
+        tx_slots = EVENT_PARSER_MAX_DEPTH;
+    }
+
+    // Has to happen before mapping, the caching attribute is fixed at mmap time
+    if (use_cached && (setDmaBufferCached(SRC_BUF_ID, true) != 0 || setDmaBufferCached(DEST_BUF_ID, true) != 0))
+    {
+        fprintf(stderr, "WARNING: could not make the buffers cacheable, keeping them uncached\n");
+        setDmaBufferCached(SRC_BUF_ID, false);
+        use_cached = false;
+    }
+
+    fd_buf0 = openDmaDevice(udmabuf0_dev, O_RDWR);
     if (fd_buf0 < 0)
     {
         fprintf(stderr, "Failed to open %s: %s\n", udmabuf0_dev, strerror(errno));
         exit(1);
     }
 
-    fd_buf1 = open(udmabuf1_dev, O_RDWR);
+    fd_buf1 = openDmaDevice(udmabuf1_dev, O_RDWR);
     if (fd_buf1 < 0)
     {
         fprintf(stderr, "Failed to open %s: %s\n", udmabuf1_dev, strerror(errno));
         exit(1);
     }
 
-    src_buf = (uint8_t *)mmap(NULL, (size_t)size_src_buf, PROT_READ | PROT_WRITE, MAP_SHARED, fd_buf0, 0);
+    src_buf = (uint8_t *)mapDmaDevice(fd_buf0, (size_t)size_src_buf);
     if (src_buf == MAP_FAILED)
     {
         perror("mmap(src)");
@@ -105,7 +378,7 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    dest_buf = (uint8_t *)mmap(NULL, (size_t)size_dest_buf, PROT_READ | PROT_WRITE, MAP_SHARED, fd_buf1, 0);
+    dest_buf = (uint8_t *)mapDmaDevice(fd_buf1, (size_t)size_dest_buf);
     if (dest_buf == MAP_FAILED)
     {
         perror("mmap(dst)");
@@ -115,7 +388,7 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    int fd_uio = open(uio_dev, O_RDWR | O_SYNC | O_CLOEXEC);
+    int fd_uio = openDmaDevice(uio_dev, O_RDWR | O_SYNC | O_CLOEXEC);
     if (fd_uio < 0)
     {
         perror("open(/dev/uio4)");
@@ -126,9 +399,7 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    reg_map = (volatile uint8_t *)mmap(NULL, REG_MAP_SIZE,
-                                       PROT_READ | PROT_WRITE,
-                                       MAP_SHARED, fd_uio, 0);
+    reg_map = (volatile uint8_t *)mapDmaDevice(fd_uio, REG_MAP_SIZE);
     if (reg_map == (void *)MAP_FAILED)
     {
         perror("mmap(regs)");
@@ -140,6 +411,51 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    initDmaRecovery(&recovery, reg_map);
+    if (trace_path != NULL)
+    {
+        if (initDmaTrace(&trace, DMA_TRACE_DEFAULT_DEPTH) != 0)
+        {
+            exit(1);
+        }
+        recovery.trace = &trace;
+    }
+
+    if (use_sg || use_cyclic)
+    {
+        // Descriptor rings live in their own udmabuf, TX in the first half and RX in the second
+        getPhyAddr(DESC_BUF_ID, &phy_desc_addr);
+        getBufSize(DESC_BUF_ID, &size_desc_buf);
+
+        fd_buf2 = openDmaDevice(udmabuf2_dev, O_RDWR);
+        if (fd_buf2 < 0)
+        {
+            fprintf(stderr, "Failed to open %s: %s\n", udmabuf2_dev, strerror(errno));
+            exit(1);
+        }
+
+        desc_buf = (uint8_t *)mapDmaDevice(fd_buf2, (size_t)size_desc_buf);
+        if (desc_buf == MAP_FAILED)
+        {
+            perror("mmap(desc)");
+            close(fd_buf2);
+            exit(1);
+        }
+
+        if (initDmaSgRing(&tx_ring, SRC_BUF_ID, desc_buf, phy_desc_addr, size_desc_buf / 2) != 0 ||
+            initDmaSgRing(&rx_ring, DEST_BUF_ID, desc_buf + size_desc_buf / 2, phy_desc_addr + size_desc_buf / 2, size_desc_buf / 2) != 0)
+        {
+            exit(1);
+        }
+        tx_ring.trace = recovery.trace;
+        rx_ring.trace = recovery.trace;
+        // Every queued slot holds a transmit descriptor
+        if (tx_slots > tx_ring.count)
+        {
+            tx_slots = tx_ring.count;
+        }
+    }
+
     // Prepare DMAs
     // Reset DMA channels
     resetDmaChannel(reg_map, SRC_BUF_ID);
@@ -147,89 +463,271 @@ int main(int argc, char *argv[])
     // Give it a moment
     sleep_ms(10);
     // Start receive channel not to fill the buffer
-    startDmaChannel(reg_map, DEST_BUF_ID);
+    if (use_sg && !use_cyclic)
+    {
+        // Interrupt once per received frame
+        if (startDmaSgChannel(reg_map, &rx_ring, 1) != 0)
+        {
+            exit(1);
+        }
+    }
+    else if (!use_cyclic)
+    {
+        startDmaChannel(reg_map, DEST_BUF_ID);
+    }
     // Start transmit channel
-    startDmaChannel(reg_map, SRC_BUF_ID);
-    // Write destination address
-    setDmaChannelAddress(reg_map, DEST_BUF_ID, phy_dest_addr);
-    // Set source address
-    setDmaChannelAddress(reg_map, SRC_BUF_ID, phy_src_addr);
+    if (use_sg)
+    {
+        if (startDmaSgChannel(reg_map, &tx_ring, 1) != 0)
+        {
+            exit(1);
+        }
+    }
+    else
+    {
+        startDmaChannel(reg_map, SRC_BUF_ID);
+    }
+    // Unmask the UIO interrupt before the first transfer can complete
+    if (wait_mode == DMA_WAIT_IRQ && enableDmaInterrupt(fd_uio) != 0)
+    {
+        fprintf(stderr, "WARNING: UIO interrupt unavailable, falling back to polling\n");
+        wait_mode = DMA_WAIT_POLL;
+    }
+    if (initDmaReactor(&reactor, reg_map, (wait_mode == DMA_WAIT_IRQ) ? fd_uio : -1) != 0)
+    {
+        exit(1);
+    }
+    initDmaWaitStrategy(&wait, wait_mode, spin_us, yield_us);
+    setDmaReactorWaitStrategy(&reactor, &wait);
     // Trigger receive DMA
+    if (use_cyclic)
+    {
+        // The channel keeps cycling over every frame slot, only the cursor moves from here on
+        if (startDmaCyclicReceive(reg_map, &rx_ring, phy_dest_addr, BYTES_PER_RECEIVE_TRANSMISSION, FRAMES_PER_RECEIVE_BUFFER) != 0)
+        {
+            exit(1);
+        }
+        attachDmaRecoveryRing(&recovery, &rx_ring, true);
+    }
+    else if (use_sg)
+    {
+        attachDmaRecoveryRing(&recovery, &rx_ring, false);
+        // Hand every frame slot to the receive channel at once
+        for (size_t i = 0; i < FRAMES_PER_RECEIVE_BUFFER; i++)
+        {
+            queueDmaSgTransfer(&rx_ring, phy_dest_addr + i * BYTES_PER_RECEIVE_TRANSMISSION, BYTES_PER_RECEIVE_TRANSMISSION);
+        }
+        submitDmaSgTransfers(reg_map, &rx_ring);
+    }
+    else
+    {
+        // Write destination address and length
+        issueDmaTransfer(&recovery, DEST_BUF_ID, phy_dest_addr, BYTES_PER_RECEIVE_TRANSMISSION);
+    }
+    if (use_sg)
+    {
+        attachDmaRecoveryRing(&recovery, &tx_ring, false);
+    }
     printf("Receive DMA channel triggered\n");
-    setDmaTransmissionLength(reg_map, DEST_BUF_ID, BYTES_PER_RECEIVE_TRANSMISSION);
 
-    while (!finished_operation)
+    if (dma_cpu >= 0)
     {
-        size_t lines_read = 0;
-        uint8_t bytes[BYTES_PER_LINE];
+        cpu_set_t set;
 
-        // Fill a chunk with up to 128 parsed lines
-        while (lines_read < LINES_PER_CHUNK && !finished_transmitting && transmit_slot_available)
+        CPU_ZERO(&set);
+        CPU_SET(dma_cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        {
+            fprintf(stderr, "WARNING: could not pin the DMA thread to CPU %d\n", dma_cpu);
+        }
+    }
+    if (pace_speed > 0)
+    {
+        initEventPacer(&pacer, pace_speed);
+        printf("INFO: Pacing EVT2.1 timestamps at %gx recorded speed\n", pace_speed);
+    }
+    // Resident chunks go out back to back, pacing needs the parser thread to hold them
+    if (loop_file && pace_speed == 0)
+    {
+        int r = loadResidentEvents(&playlist, src_buf, size_src_buf, &resident_bytes);
+        if (r < 0)
         {
-            int r = readNextLine(input_file_handle, line_buf, &lineno);
-            if (r == 0)
+            exit(1);
+        }
+        if (r == 0)
+        {
+            if (use_cached)
             {
-                if (loop_file)
-                {
-                    printf("INFO: Reached EOF, rewinding input and continuing\n");
-                    clearerr(input_file_handle);
-                    rewind(input_file_handle);
-                    lineno = 0; // optional
-                    continue;   // keep filling this chunk
-                }
-                else
+                syncDmaBufferForDevice(fd_buf0, 0, (uint32_t)resident_bytes, DMA_SYNC_TO_DEVICE);
+            }
+            printf("INFO: %zu B of events resident in udmabuf0, looping without parsing\n", resident_bytes);
+            // Nothing is parsed, so nothing waits on a chunk: the largest transfers keep MM2S busiest
+            if (adaptive_chunks)
+            {
+                chunk_bytes = max_chunk_bytes;
+                adaptive_chunks = false;
+            }
+        }
+        else
+        {
+            printf("INFO: Input does not fit in udmabuf0 (%u B), parsing it on every pass\n", size_src_buf);
+        }
+    }
+    initChunkSizer(&sizer, chunk_bytes, CHUNK_BYTES, slot_bytes, adaptive_chunks);
+    if (adaptive_chunks)
+    {
+        printf("INFO: Chunk size adapts between %d B and %zu B\n", CHUNK_BYTES, slot_bytes);
+    }
+    if (resident_bytes == 0)
+    {
+        if (startEventParser(&parser, &playlist, src_buf, fd_buf0, use_cached, tx_slots, slot_bytes, chunk_bytes, parser_cpu,
+                             (pace_speed > 0) ? &pacer : NULL) != 0)
+        {
+            exit(1);
+        }
+        if (watchDmaReactorFd(&reactor, parser.fd_data, EPOLLIN, drainParserEvent, &parser.fd_data) != 0)
+        {
+            exit(1);
+        }
+    }
+
+    while (!finished_operation && !stop_requested)
+    {
+        size_t published = (resident_bytes > 0) ? 0 : countParsedChunks(&parser);
+
+        if (resident_bytes > 0)
+        {
+            // The next pass starts once the last one is done, the segments of one pass are
+            // issued back to back by advanceDmaLargeTransfer()
+            if (tx_issued == 0)
+            {
+                // Segments are kept 64 B aligned, a smaller --chunk-bytes is rounded up to that
+                uint32_t segment = (uint32_t)((chunk_bytes < DMA_SEGMENT_ALIGN) ? DMA_SEGMENT_ALIGN : chunk_bytes);
+                if (startDmaLargeTransfer(&resident_xfer, &recovery, use_sg ? &tx_ring : NULL, SRC_BUF_ID, phy_src_addr, resident_bytes,
+                                          segment) != 0)
                 {
-                    finished_transmitting = true;
-                    printf("INFO: Finished sending events\n");
-                    break; // original behavior
+                    exit_code = 1;
+                    break;
                 }
+                tx_issued = 1;
+                startChunkSizer(&sizer);
             }
-
-            if (r < 0)
-            { // parse error
-                fprintf(stderr, "Parse error. result < 0, lineno: %d\n", lineno);
-                finished_transmitting = true;
-                break;
+        }
+        // Hand newly parsed slots to MM2S. Simple mode has one transfer in flight, the oldest
+        // slot goes out as soon as the channel is free. The SG ring takes every published slot.
+        else if (use_sg && tx_issued < published)
+        {
+            for (; tx_issued < published; tx_issued++)
+            {
+                size_t slot = getParsedChunk(&parser, tx_issued);
+                queueDmaSgTransfer(&tx_ring, phy_src_addr + slot * slot_bytes, parser.length[slot]);
             }
-            // printf("DEBUG: Read line %d, %s\n", lineno, line_buf);
-            if (parseLine(line_buf, bytes) != 0)
+            startChunkSizer(&sizer);
+            submitDmaSgTransfers(reg_map, &tx_ring);
+        }
+        else if (!use_sg && tx_issued == 0 && published > 0)
+        {
+            size_t slot = getParsedChunk(&parser, 0);
+            issueDmaTransfer(&recovery, SRC_BUF_ID, phy_src_addr + slot * slot_bytes, parser.length[slot]);
+            tx_issued = 1;
+            startChunkSizer(&sizer);
+        }
+        if (!finished_transmitting && resident_bytes == 0 && tx_issued == 0 && isEventParserDone(&parser))
+        {
+            // The receive side keeps running, report the transmit side now that it is done
+            finished_transmitting = true;
+            print_tx_stats(&tx_stats, &parser, slot_bytes);
+            printChunkSizerStats(&sizer);
+            if (pace_speed > 0)
             {
-                fprintf(stderr, "Line %d: invalid hex digit\n", lineno);
-                finished_transmitting = true;
-                break;
+                printEventPacerStats(&pacer);
             }
-            // printf("DEBUG: Line %d parsed,", lineno);
-            // for (size_t i = 0; i < BYTES_PER_LINE - 1; i++)
-            // {
-            //     printf(" %02x", bytes[i]);
-            // }
-            // printf(" %02x\n", bytes[BYTES_PER_LINE - 1]);
+        }
 
-            memcpy(&src_buf[lines_read * BYTES_PER_LINE], bytes, BYTES_PER_LINE);
-            lines_read++;
+        // Wait on both channels and the parser at once, whichever is ready first is handled first
+        rx_result = DMA_TIMEOUT;
+        tx_result = DMA_TIMEOUT;
+        awaitDmaReactorTransfer(&reactor, DEST_BUF_ID, (use_sg || use_cyclic) ? &rx_ring.desc[rx_ring.tail] : NULL,
+                                storeDmaResult, &rx_result);
+        if (tx_issued > 0)
+        {
+            awaitDmaReactorTransfer(&reactor, SRC_BUF_ID, use_sg ? &tx_ring.desc[tx_ring.tail] : NULL,
+                                    storeDmaResult, &tx_result);
         }
-        // Copy into the DMA source buffer
-        if (lines_read > 0)
+        runDmaReactorOnce(&reactor, 10);
+
+        // A bus error halts the engine, reset it and re-issue whatever was in flight
+        if (rx_result == DMA_FAILED || tx_result == DMA_FAILED)
         {
-            // printf("DEBUG: Line %d copied\n", lineno);
-            transmit_slot_available = false;
-            setDmaTransmissionLength(reg_map, SRC_BUF_ID, lines_read * BYTES_PER_LINE);
-            // printf("DEBUG: Transmit DMA channel triggered\n");
+            if (recoverDma(&recovery) != 0)
+            {
+                fprintf(stderr, "DMA recovery failed, stopping\n");
+                exit_code = 1;
+                break;
+            }
+            if (use_cyclic)
+            {
+                // The cyclic ring starts over at slot 0
+                frame_index = 0;
+            }
+            continue;
         }
 
-        // if (lines_read == 0 && !finished_transmitting)
-        // {
-        //     // No more data (EOF reached before any new lines for this chunk)
-        //     finished_transmitting = true;
-        //     break;
-        // }
+        size_t frames_done = 0;
+        // Frame slots filled since the last pass, in the order the hardware completed them
+        size_t filled[FRAMES_PER_RECEIVE_BUFFER];
+        if (rx_result == DMA_RECEIVED)
+        {
+            if (use_cyclic)
+            {
+                // Consume every slot the hardware filled since the last pass
+                int slot;
+                while (frames_done < FRAMES_PER_RECEIVE_BUFFER && (slot = nextDmaCyclicSlot(&rx_ring, NULL)) != -1)
+                {
+                    // -2 is a slot that completed with an error, it holds no frame
+                    if (slot >= 0)
+                    {
+                        filled[frames_done++] = (size_t)slot;
+                    }
+                }
+            }
+            else if (use_sg)
+            {
+                // Reap every frame the ring completed since the last pass
+                size_t first = rx_ring.tail;
+                int reaped = reapDmaSgTransfers(&rx_ring, NULL, FRAMES_PER_RECEIVE_BUFFER);
+                frames_done = (reaped > 0) ? (size_t)reaped : 0;
+                // Descriptors and frame slots drift apart after a re-arm, the buffer says which slot it was
+                for (size_t f = 0; f < frames_done; f++)
+                {
+                    uint64_t address = getDmaSgBufferAddress(&rx_ring, (first + f) % rx_ring.count);
+                    filled[f] = (size_t)((address - phy_dest_addr) / BYTES_PER_RECEIVE_TRANSMISSION);
+                }
+            }
+            else
+            {
+                filled[0] = frame_index;
+                frames_done = 1;
+            }
+        }
 
-        // Poll DMA channels
-        if (waitDmaTransmissionDone(reg_map, DEST_BUF_ID, 10) == DMA_RECEIVED)
+        for (size_t f = 0; f < frames_done; f++)
         {
-            // Update destination address
-            frame_index++;
-            frame_index %= 8;
+            size_t slot = filled[f];
+
+            // The slot just filled goes to the back of the descriptor ring
+            if (use_sg && !use_cyclic)
+            {
+                queueDmaSgTransfer(&rx_ring, phy_dest_addr + slot * BYTES_PER_RECEIVE_TRANSMISSION, BYTES_PER_RECEIVE_TRANSMISSION);
+            }
+            if (use_cached)
+            {
+                // Drop stale lines of the slot S2MM just wrote, before anyone reads it. Nothing on
+                // the CPU side writes the receive ring, so re-arming the slot needs no clean.
+                syncDmaBufferForCpu(fd_buf1, slot * BYTES_PER_RECEIVE_TRANSMISSION, BYTES_PER_RECEIVE_TRANSMISSION, DMA_SYNC_FROM_DEVICE);
+            }
+            // Next slot the hardware fills, also the next destination address in simple mode
+            frame_index = (slot + 1) % FRAMES_PER_RECEIVE_BUFFER;
             frames_received++;
             printf("Receive DMA channel finished, frame index, total frames: %u, %" PRIu64 "\n", frame_index, frames_received);
 
@@ -237,8 +735,11 @@ int main(int argc, char *argv[])
             {
                 if (kill(pid, SIGUSR1) != 0)
                 {
+                    // Stop through the statistics and cleanup below
                     perror("kill");
-                    return 1;
+                    exit_code = 1;
+                    finished_operation = true;
+                    break;
                 }
             }
 
@@ -247,18 +748,82 @@ int main(int argc, char *argv[])
             {
                 network_trigger_counter++;
             }
-            // Update destination address
-            setDmaChannelAddress(reg_map, DEST_BUF_ID, (phy_dest_addr + frame_index * BYTES_PER_RECEIVE_TRANSMISSION));
-            setDmaTransmissionLength(reg_map, DEST_BUF_ID, BYTES_PER_RECEIVE_TRANSMISSION);
+            if (!use_sg && !use_cyclic)
+            {
+                // Update destination address
+                completeDmaTransfer(&recovery, DEST_BUF_ID);
+                issueDmaTransfer(&recovery, DEST_BUF_ID, phy_dest_addr + frame_index * BYTES_PER_RECEIVE_TRANSMISSION, BYTES_PER_RECEIVE_TRANSMISSION);
+            }
+        }
+        if (use_sg && !use_cyclic && frames_done > 0)
+        {
+            submitDmaSgTransfers(reg_map, &rx_ring);
         }
 
-        if (!transmit_slot_available)
+        if (tx_result == DMA_RECEIVED && resident_bytes > 0)
+        {
+            uint32_t segments = resident_xfer.segments;
+            int r = advanceDmaLargeTransfer(&resident_xfer);
+
+            if (r == DMA_FAILED && recoverDma(&recovery) != 0)
+            {
+                fprintf(stderr, "DMA recovery failed, stopping\n");
+                exit_code = 1;
+                break;
+            }
+            // Segments are max_segment long, the last one of a pass takes the rest
+            for (; segments < resident_xfer.segments; segments++)
+            {
+                uint64_t offset = (uint64_t)segments * resident_xfer.max_segment;
+                uint64_t left = resident_bytes - offset;
+                recordChunkSent(&sizer, (uint32_t)((left < resident_xfer.max_segment) ? left : resident_xfer.max_segment), false);
+                tx_stats.chunks++;
+            }
+            if (r == DMA_RECEIVED)
+            {
+                tx_issued = 0;
+                printf("INFO: Resident pass %" PRIu64 " sent\n", ++resident_passes);
+            }
+        }
+        else if (tx_result == DMA_RECEIVED)
         {
-            if (waitDmaTransmissionDone(reg_map, SRC_BUF_ID, 10) == DMA_RECEIVED)
+            size_t done = 0;
+
+            if (use_sg)
+            {
+                int reaped = reapDmaSgTransfers(&tx_ring, NULL, tx_issued);
+                done = (reaped > 0) ? (size_t)reaped : 0;
+            }
+            else
             {
-                // One more transmission
                 // printf("DEBUG: Transmit DMA channel finished\n");
-                transmit_slot_available = true;
+                completeDmaTransfer(&recovery, SRC_BUF_ID);
+                done = 1;
+            }
+            size_t queued = countParsedChunks(&parser);
+            // Every slot was queued, per-transfer overhead is what holds the stream back
+            bool backlog = (queued == parser.depth);
+            uint32_t sent[EVENT_PARSER_MAX_DEPTH];
+            for (size_t i = 0; i < done; i++)
+            {
+                sent[i] = parser.length[getParsedChunk(&parser, 0)];
+                tx_stats.depth[queued--]++;
+                releaseParsedChunk(&parser);
+                tx_issued--;
+                tx_stats.chunks++;
+            }
+            // MM2S ran dry while there is still input, parsing is what limits the stream
+            bool underrun = (done > 0 && countParsedChunks(&parser) == 0 && !atomic_load(&parser.finished));
+            if (underrun)
+            {
+                tx_stats.underruns++;
+            }
+            for (size_t i = 0; i < done; i++)
+            {
+                if (recordChunkSent(&sizer, sent[i], (underrun || backlog) && i + 1 == done))
+                {
+                    setEventParserChunkBytes(&parser, sizer.chunk_bytes);
+                }
             }
         }
     }
@@ -266,13 +831,55 @@ int main(int argc, char *argv[])
     // Trigger DMA channels
     // Wait for finished transaction
 
+    // Stop the engine before its buffers are let go, the reset halts both channels
+    resetDmaChannel(reg_map, SRC_BUF_ID);
+
+    if (resident_bytes > 0)
+    {
+        printf("TX: %" PRIu64 " resident passes, %" PRIu64 " segments of up to %u B sent\n", resident_passes, tx_stats.chunks,
+               resident_xfer.max_segment);
+        printChunkSizerStats(&sizer);
+    }
+    else
+    {
+        stopEventParser(&parser);
+        if (!finished_transmitting)
+        {
+            print_tx_stats(&tx_stats, &parser, slot_bytes);
+            printChunkSizerStats(&sizer);
+            if (pace_speed > 0)
+            {
+                printEventPacerStats(&pacer);
+            }
+        }
+    }
+    printDmaRecoveryStats(&recovery);
+    printDmaWaitStats(&wait);
+    if (trace_path != NULL)
+    {
+        dumpDmaTrace(&trace, trace_path);
+        freeDmaTrace(&trace);
+    }
+
     //  Close on exit
-    fclose(input_file_handle);
+    closeEventPlaylist(&playlist);
+    closeDmaReactor(&reactor);
     munmap((void *)reg_map, REG_MAP_SIZE);
     close(fd_uio);
     munmap(src_buf, (size_t)size_src_buf);
     close(fd_buf0);
     munmap(dest_buf, (size_t)size_dest_buf);
     close(fd_buf1);
-    return 0;
+    if (use_cached)
+    {
+        // Back to the overlay's sync-always for the next user
+        setDmaBufferCached(SRC_BUF_ID, false);
+        setDmaBufferCached(DEST_BUF_ID, false);
+    }
+    if (desc_buf != NULL)
+    {
+        munmap(desc_buf, (size_t)size_desc_buf);
+        close(fd_buf2);
+    }
+    return exit_code;
 }
\ No newline at end of file
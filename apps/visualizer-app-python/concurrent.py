@@ -3,6 +3,7 @@ import mmap
 import numpy as np
 import cv2
 import signal
+import sys
 
 W, H = 128, 128
 CH_BYTES = (W * H) // 8
@@ -112,7 +113,7 @@ def _request_refresh(_signum, _frame):
     _refresh_requested = True
 
 
-def main(dev_path="/dev/udmabuf1"):
+def main(dev_path="/dev/udmabuf1", cached=False):
     global bitorder, _refresh_requested
 
     signal.signal(REFRESH_SIG, _request_refresh)
@@ -123,7 +124,10 @@ def main(dev_path="/dev/udmabuf1"):
     if n_frames < 8:
         raise RuntimeError(f"{dev_path} has {n_frames} frames; need at least 8.")
 
-    fd = os.open(dev_path, os.O_RDONLY | os.O_SYNC)
+    # A streaming app run with --cached invalidates every slot before it signals, so the
+    # mapping can be cacheable too. Without it, sync-always keeps it uncached anyway.
+    flags = os.O_RDONLY if cached else os.O_RDONLY | os.O_SYNC
+    fd = os.open(dev_path, flags)
     try:
         mm = mmap.mmap(fd, size, access=mmap.ACCESS_READ)
         try:
@@ -157,4 +161,4 @@ def main(dev_path="/dev/udmabuf1"):
 
 
 if __name__ == "__main__":
-    main()
+    main(cached="--cached" in sys.argv[1:])
@@ -0,0 +1,663 @@
+/*
+ * AXI DMA proxy
+ *
+ * Claims the MM2S and S2MM channels of an AXI DMA through the dmaengine API,
+ * so the DMA stays bound to its own driver instead of uio_pdrv_genirq, and
+ * lets user space queue transfers on udmabuf or dma-buf regions. Completions
+ * are posted to a ring mapped into the caller and the device is poll()-able,
+ * so a stream costs one ioctl per batch of transfers and no syscall per frame.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/version.h>
+#include <linux/platform_device.h>
+#include <linux/of.h>
+#include <linux/miscdevice.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/idr.h>
+#include <linux/kref.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/uaccess.h>
+#include <linux/capability.h>
+#include <linux/timekeeping.h>
+#include <linux/dmaengine.h>
+#include <linux/dma-mapping.h>
+#include <linux/dma-buf.h>
+#include <linux/scatterlist.h>
+
+#include "dma_proxy_ioctl.h"
+
+MODULE_LICENSE("GPL v2");
+MODULE_DESCRIPTION("AXI DMA dmaengine proxy with a mapped completion ring");
+MODULE_VERSION("0.1.0");
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+MODULE_IMPORT_NS("DMA_BUF");
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(5, 16, 0)
+MODULE_IMPORT_NS(DMA_BUF);
+#endif
+
+#define DRIVER_NAME "dma_proxy"
+#define QUEUE_BATCH 16
+
+static DEFINE_IDA(dma_proxy_ida);
+
+struct dma_proxy_region_priv {
+	bool used;
+	u32 type;
+	dma_addr_t dma_addr;
+	u64 size;
+	struct dma_buf *dmabuf;
+	struct dma_buf_attachment *attach;
+	struct sg_table *sgt;
+};
+
+struct dma_proxy_xfer {
+	struct list_head node;
+	struct dma_proxy_dev *proxy;
+	u32 channel;
+	u32 length;
+	u64 user_data;
+};
+
+struct dma_proxy_dev {
+	struct device *dev;
+	struct dma_chan *chan[2];
+	struct miscdevice misc;
+	char name[32];
+	int id;
+	atomic_t opened;
+	struct kref ref;           // Held by the platform device and by an open file
+
+	struct mutex lock;         // Regions and queueing
+	bool gone;                 // Removed, the channels are released and ioctls fail
+	spinlock_t ring_lock;      // Ring head, in_flight and the xfer list
+	struct dma_proxy_ring *ring;
+	size_t ring_bytes;
+	wait_queue_head_t wait;
+	u32 in_flight;
+	struct list_head xfers;
+	struct dma_proxy_region_priv region[DMA_PROXY_MAX_REGIONS];
+};
+
+static struct device *dma_proxy_dma_dev(struct dma_proxy_dev *proxy)
+{
+	struct dma_chan *chan = proxy->chan[DMA_PROXY_TX] ? proxy->chan[DMA_PROXY_TX] : proxy->chan[DMA_PROXY_RX];
+
+	return chan->device->dev;
+}
+
+static void dma_proxy_complete(void *param, const struct dmaengine_result *result)
+{
+	struct dma_proxy_xfer *xfer = param;
+	struct dma_proxy_dev *proxy = xfer->proxy;
+	struct dma_proxy_ring *ring = proxy->ring;
+	unsigned long flags;
+	u32 head;
+
+	spin_lock_irqsave(&proxy->ring_lock, flags);
+	head = ring->head;
+	// Queueing keeps head - tail + in_flight within the ring, this only trips on a bogus tail
+	if (head - READ_ONCE(ring->tail) < DMA_PROXY_RING_ENTRIES) {
+		struct dma_proxy_completion *c = &ring->entry[head % DMA_PROXY_RING_ENTRIES];
+
+		c->user_data = xfer->user_data;
+		c->timestamp_ns = ktime_get_raw_ns();
+		c->channel = xfer->channel;
+		c->length = xfer->length - (result ? min(result->residue, xfer->length) : 0);
+		if (!result || result->result == DMA_TRANS_NOERROR)
+			c->status = 0;
+		else if (result->result == DMA_TRANS_ABORTED)
+			c->status = -ECANCELED;
+		else
+			c->status = -EIO;
+		// The entry must be visible before the new head
+		smp_store_release(&ring->head, head + 1);
+	} else {
+		ring->dropped++;
+	}
+	proxy->in_flight--;
+	list_del(&xfer->node);
+	spin_unlock_irqrestore(&proxy->ring_lock, flags);
+
+	wake_up_interruptible(&proxy->wait);
+	kfree(xfer);
+}
+
+// Stop both channels and forget what was in flight. Terminated descriptors
+// never see their callback, so their contexts are freed here.
+static void dma_proxy_stop(struct dma_proxy_dev *proxy)
+{
+	struct dma_proxy_xfer *xfer, *next;
+	unsigned long flags;
+	LIST_HEAD(orphans);
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (proxy->chan[i])
+			dmaengine_terminate_sync(proxy->chan[i]);
+	}
+
+	spin_lock_irqsave(&proxy->ring_lock, flags);
+	list_splice_init(&proxy->xfers, &orphans);
+	proxy->in_flight = 0;
+	spin_unlock_irqrestore(&proxy->ring_lock, flags);
+
+	list_for_each_entry_safe(xfer, next, &orphans, node)
+		kfree(xfer);
+}
+
+static void dma_proxy_release_region(struct dma_proxy_dev *proxy, struct dma_proxy_region_priv *region)
+{
+	if (!region->used)
+		return;
+
+	if (region->type == DMA_PROXY_REGION_DMABUF) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 2, 0)
+		dma_buf_unmap_attachment_unlocked(region->attach, region->sgt, DMA_BIDIRECTIONAL);
+#else
+		dma_buf_unmap_attachment(region->attach, region->sgt, DMA_BIDIRECTIONAL);
+#endif
+		dma_buf_detach(region->dmabuf, region->attach);
+		dma_buf_put(region->dmabuf);
+	} else {
+		dma_unmap_resource(dma_proxy_dma_dev(proxy), region->dma_addr, region->size, DMA_BIDIRECTIONAL, 0);
+	}
+	memset(region, 0, sizeof(*region));
+}
+
+static int dma_proxy_attach_dmabuf(struct dma_proxy_dev *proxy, struct dma_proxy_region_priv *region, int fd)
+{
+	struct device *dma_dev = dma_proxy_dma_dev(proxy);
+	struct scatterlist *sg;
+	dma_addr_t next = 0;
+	u64 size = 0;
+	int ret;
+	int i;
+
+	region->dmabuf = dma_buf_get(fd);
+	if (IS_ERR(region->dmabuf))
+		return PTR_ERR(region->dmabuf);
+
+	region->attach = dma_buf_attach(region->dmabuf, dma_dev);
+	if (IS_ERR(region->attach)) {
+		ret = PTR_ERR(region->attach);
+		goto err_put;
+	}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 2, 0)
+	region->sgt = dma_buf_map_attachment_unlocked(region->attach, DMA_BIDIRECTIONAL);
+#else
+	region->sgt = dma_buf_map_attachment(region->attach, DMA_BIDIRECTIONAL);
+#endif
+	if (IS_ERR(region->sgt)) {
+		ret = PTR_ERR(region->sgt);
+		goto err_detach;
+	}
+
+	// Transfers are addressed as base + offset, so the buffer has to be one DMA range
+	for_each_sgtable_dma_sg(region->sgt, sg, i) {
+		if (i > 0 && sg_dma_address(sg) != next) {
+			dev_err(proxy->dev, "dma-buf %d is not contiguous for the DMA\n", fd);
+			ret = -EINVAL;
+			goto err_unmap;
+		}
+		next = sg_dma_address(sg) + sg_dma_len(sg);
+		size += sg_dma_len(sg);
+	}
+	if (size == 0) {
+		ret = -EINVAL;
+		goto err_unmap;
+	}
+
+	region->dma_addr = sg_dma_address(region->sgt->sgl);
+	region->size = size;
+	return 0;
+
+err_unmap:
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 2, 0)
+	dma_buf_unmap_attachment_unlocked(region->attach, region->sgt, DMA_BIDIRECTIONAL);
+#else
+	dma_buf_unmap_attachment(region->attach, region->sgt, DMA_BIDIRECTIONAL);
+#endif
+err_detach:
+	dma_buf_detach(region->dmabuf, region->attach);
+err_put:
+	dma_buf_put(region->dmabuf);
+	return ret;
+}
+
+static long dma_proxy_add_region(struct dma_proxy_dev *proxy, void __user *arg)
+{
+	struct dma_proxy_region req;
+	struct dma_proxy_region_priv *region = NULL;
+	int ret;
+	int i;
+
+	if (copy_from_user(&req, arg, sizeof(req)))
+		return -EFAULT;
+
+	for (i = 0; i < DMA_PROXY_MAX_REGIONS; i++) {
+		if (!proxy->region[i].used) {
+			region = &proxy->region[i];
+			break;
+		}
+	}
+	if (!region)
+		return -ENOSPC;
+
+	switch (req.type) {
+	case DMA_PROXY_REGION_DMABUF:
+		ret = dma_proxy_attach_dmabuf(proxy, region, req.fd);
+		if (ret)
+			return ret;
+		break;
+	case DMA_PROXY_REGION_PHYS:
+		// A raw physical range is only safe for buffers the caller knows are reserved, like a udmabuf
+		if (!capable(CAP_SYS_RAWIO))
+			return -EPERM;
+		if (req.size == 0)
+			return -EINVAL;
+		region->dma_addr = dma_map_resource(dma_proxy_dma_dev(proxy), req.phys_addr, req.size, DMA_BIDIRECTIONAL, 0);
+		if (dma_mapping_error(dma_proxy_dma_dev(proxy), region->dma_addr))
+			return -ENOMEM;
+		region->size = req.size;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	region->type = req.type;
+	region->used = true;
+	req.id = i;
+	req.size = region->size;
+	if (copy_to_user(arg, &req, sizeof(req))) {
+		dma_proxy_release_region(proxy, region);
+		return -EFAULT;
+	}
+	return 0;
+}
+
+static int dma_proxy_queue_one(struct dma_proxy_dev *proxy, const struct dma_proxy_transfer *t)
+{
+	struct dma_proxy_region_priv *region;
+	struct dma_async_tx_descriptor *desc;
+	struct dma_proxy_xfer *xfer;
+	struct dma_chan *chan;
+	unsigned long flags;
+	dma_cookie_t cookie;
+	int ret = 0;
+
+	if (t->channel > DMA_PROXY_RX || !proxy->chan[t->channel])
+		return -EINVAL;
+	if (t->region >= DMA_PROXY_MAX_REGIONS || !proxy->region[t->region].used)
+		return -EINVAL;
+	region = &proxy->region[t->region];
+	if (t->length == 0 || t->offset > region->size || t->length > region->size - t->offset)
+		return -EINVAL;
+	chan = proxy->chan[t->channel];
+
+	xfer = kzalloc(sizeof(*xfer), GFP_KERNEL);
+	if (!xfer)
+		return -ENOMEM;
+	xfer->proxy = proxy;
+	xfer->channel = t->channel;
+	xfer->length = t->length;
+	xfer->user_data = t->user_data;
+
+	// Reserve the ring slot now, so a completion always has somewhere to go
+	spin_lock_irqsave(&proxy->ring_lock, flags);
+	if (proxy->ring->head - READ_ONCE(proxy->ring->tail) + proxy->in_flight >= DMA_PROXY_RING_ENTRIES) {
+		ret = -EAGAIN;
+	} else {
+		proxy->in_flight++;
+		list_add_tail(&xfer->node, &proxy->xfers);
+	}
+	spin_unlock_irqrestore(&proxy->ring_lock, flags);
+	if (ret) {
+		kfree(xfer);
+		return ret;
+	}
+
+	desc = dmaengine_prep_slave_single(chan, region->dma_addr + t->offset, t->length,
+					   (t->channel == DMA_PROXY_TX) ? DMA_MEM_TO_DEV : DMA_DEV_TO_MEM,
+					   DMA_PREP_INTERRUPT | DMA_CTRL_ACK);
+	if (!desc) {
+		ret = -EBUSY;
+		goto err_unreserve;
+	}
+	desc->callback_result = dma_proxy_complete;
+	desc->callback_param = xfer;
+
+	cookie = dmaengine_submit(desc);
+	if (dma_submit_error(cookie)) {
+		ret = -EIO;
+		goto err_unreserve;
+	}
+	return 0;
+
+err_unreserve:
+	spin_lock_irqsave(&proxy->ring_lock, flags);
+	proxy->in_flight--;
+	list_del(&xfer->node);
+	spin_unlock_irqrestore(&proxy->ring_lock, flags);
+	kfree(xfer);
+	return ret;
+}
+
+static long dma_proxy_queue(struct dma_proxy_dev *proxy, void __user *arg)
+{
+	struct dma_proxy_transfer batch[QUEUE_BATCH];
+	struct dma_proxy_queue req;
+	bool issue[2] = {false, false};
+	u32 queued = 0;
+	int ret = 0;
+	int i;
+
+	if (copy_from_user(&req, arg, sizeof(req)))
+		return -EFAULT;
+
+	while (queued < req.count && ret == 0) {
+		u32 n = min_t(u32, req.count - queued, QUEUE_BATCH);
+		u32 j;
+
+		if (copy_from_user(batch, u64_to_user_ptr(req.transfers + (u64)queued * sizeof(batch[0])), n * sizeof(batch[0]))) {
+			ret = -EFAULT;
+			break;
+		}
+		for (j = 0; j < n; j++) {
+			ret = dma_proxy_queue_one(proxy, &batch[j]);
+			if (ret)
+				break;
+			issue[batch[j].channel] = true;
+			queued++;
+		}
+	}
+
+	// One kick per channel for the whole batch
+	for (i = 0; i < 2; i++) {
+		if (issue[i])
+			dma_async_issue_pending(proxy->chan[i]);
+	}
+
+	req.queued = queued;
+	if (copy_to_user(arg, &req, sizeof(req)))
+		return -EFAULT;
+	// A partly accepted batch is not an error, the caller retries the rest after reaping
+	return (queued > 0) ? 0 : ret;
+}
+
+// Last reference dropped, by remove or by the release of a file that outlived it
+static void dma_proxy_free(struct kref *ref)
+{
+	struct dma_proxy_dev *proxy = container_of(ref, struct dma_proxy_dev, ref);
+
+	vfree(proxy->ring);
+	kfree(proxy);
+}
+
+static long dma_proxy_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct dma_proxy_dev *proxy = container_of(file->private_data, struct dma_proxy_dev, misc);
+	long ret;
+
+	mutex_lock(&proxy->lock);
+	if (proxy->gone) {
+		mutex_unlock(&proxy->lock);
+		return -ENODEV;
+	}
+	switch (cmd) {
+	case DMA_PROXY_IOC_INFO: {
+		struct dma_proxy_info info = {
+			.channels = (proxy->chan[DMA_PROXY_TX] ? 1 : 0) | (proxy->chan[DMA_PROXY_RX] ? 2 : 0),
+			.ring_entries = DMA_PROXY_RING_ENTRIES,
+			.ring_bytes = proxy->ring_bytes,
+		};
+		ret = copy_to_user((void __user *)arg, &info, sizeof(info)) ? -EFAULT : 0;
+		break;
+	}
+	case DMA_PROXY_IOC_ADD_REGION:
+		ret = dma_proxy_add_region(proxy, (void __user *)arg);
+		break;
+	case DMA_PROXY_IOC_QUEUE:
+		ret = dma_proxy_queue(proxy, (void __user *)arg);
+		break;
+	case DMA_PROXY_IOC_STOP:
+		dma_proxy_stop(proxy);
+		ret = 0;
+		break;
+	default:
+		ret = -ENOTTY;
+		break;
+	}
+	mutex_unlock(&proxy->lock);
+	return ret;
+}
+
+static __poll_t dma_proxy_poll(struct file *file, poll_table *wait)
+{
+	struct dma_proxy_dev *proxy = container_of(file->private_data, struct dma_proxy_dev, misc);
+
+	poll_wait(file, &proxy->wait, wait);
+	if (READ_ONCE(proxy->gone))
+		return EPOLLHUP | EPOLLERR;
+	if (smp_load_acquire(&proxy->ring->head) != READ_ONCE(proxy->ring->tail))
+		return EPOLLIN | EPOLLRDNORM;
+	return 0;
+}
+
+static int dma_proxy_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct dma_proxy_dev *proxy = container_of(file->private_data, struct dma_proxy_dev, misc);
+
+	if (READ_ONCE(proxy->gone))
+		return -ENODEV;
+	if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start > proxy->ring_bytes)
+		return -EINVAL;
+	// The mapping pins the file, so the ring outlives it
+	return remap_vmalloc_range(vma, proxy->ring, 0);
+}
+
+static int dma_proxy_open(struct inode *inode, struct file *file)
+{
+	struct dma_proxy_dev *proxy = container_of(file->private_data, struct dma_proxy_dev, misc);
+
+	// The channels and the ring belong to a single stream
+	if (atomic_cmpxchg(&proxy->opened, 0, 1) != 0)
+		return -EBUSY;
+
+	proxy->ring->head = 0;
+	proxy->ring->tail = 0;
+	proxy->ring->dropped = 0;
+	// misc_open() runs this under misc_mtx, so remove cannot have dropped its reference yet
+	kref_get(&proxy->ref);
+	return 0;
+}
+
+static int dma_proxy_release(struct inode *inode, struct file *file)
+{
+	struct dma_proxy_dev *proxy = container_of(file->private_data, struct dma_proxy_dev, misc);
+	int i;
+
+	// After remove the channels and regions are already gone
+	mutex_lock(&proxy->lock);
+	if (!proxy->gone) {
+		dma_proxy_stop(proxy);
+		for (i = 0; i < DMA_PROXY_MAX_REGIONS; i++)
+			dma_proxy_release_region(proxy, &proxy->region[i]);
+	}
+	mutex_unlock(&proxy->lock);
+
+	atomic_set(&proxy->opened, 0);
+	kref_put(&proxy->ref, dma_proxy_free);
+	return 0;
+}
+
+static const struct file_operations dma_proxy_fops = {
+	.owner = THIS_MODULE,
+	.open = dma_proxy_open,
+	.release = dma_proxy_release,
+	.unlocked_ioctl = dma_proxy_ioctl,
+	.poll = dma_proxy_poll,
+	.mmap = dma_proxy_mmap,
+};
+
+static struct dma_chan *dma_proxy_request(struct platform_device *pdev, const char *name)
+{
+	struct dma_chan *chan = dma_request_chan(&pdev->dev, name);
+
+	if (IS_ERR(chan)) {
+		if (PTR_ERR(chan) != -EPROBE_DEFER)
+			dev_info(&pdev->dev, "no %s channel (%ld)\n", name, PTR_ERR(chan));
+	}
+	return chan;
+}
+
+static int dma_proxy_probe(struct platform_device *pdev)
+{
+	struct dma_proxy_dev *proxy;
+	struct dma_chan *chan;
+	int ret;
+	int i;
+
+	// Not devm, an open file may keep it past remove
+	proxy = kzalloc(sizeof(*proxy), GFP_KERNEL);
+	if (!proxy)
+		return -ENOMEM;
+	kref_init(&proxy->ref);
+	proxy->dev = &pdev->dev;
+	mutex_init(&proxy->lock);
+	spin_lock_init(&proxy->ring_lock);
+	init_waitqueue_head(&proxy->wait);
+	INIT_LIST_HEAD(&proxy->xfers);
+	atomic_set(&proxy->opened, 0);
+
+	// Either direction may be left out of the node, but not both
+	chan = dma_proxy_request(pdev, "dma_proxy_tx");
+	if (IS_ERR(chan) && PTR_ERR(chan) == -EPROBE_DEFER) {
+		ret = -EPROBE_DEFER;
+		goto err_release;
+	}
+	proxy->chan[DMA_PROXY_TX] = IS_ERR(chan) ? NULL : chan;
+
+	chan = dma_proxy_request(pdev, "dma_proxy_rx");
+	if (IS_ERR(chan) && PTR_ERR(chan) == -EPROBE_DEFER) {
+		ret = -EPROBE_DEFER;
+		goto err_release;
+	}
+	proxy->chan[DMA_PROXY_RX] = IS_ERR(chan) ? NULL : chan;
+
+	if (!proxy->chan[DMA_PROXY_TX] && !proxy->chan[DMA_PROXY_RX]) {
+		dev_err(&pdev->dev, "neither dma_proxy_tx nor dma_proxy_rx could be claimed\n");
+		ret = -ENODEV;
+		goto err_release;
+	}
+
+	proxy->ring_bytes = PAGE_ALIGN(sizeof(struct dma_proxy_ring));
+	proxy->ring = vmalloc_user(proxy->ring_bytes);
+	if (!proxy->ring) {
+		ret = -ENOMEM;
+		goto err_release;
+	}
+	proxy->ring->entries = DMA_PROXY_RING_ENTRIES;
+
+	proxy->id = ida_alloc(&dma_proxy_ida, GFP_KERNEL);
+	if (proxy->id < 0) {
+		ret = proxy->id;
+		goto err_ring;
+	}
+	// The first instance keeps the plain name, the example apps open /dev/dma_proxy
+	if (proxy->id == 0)
+		snprintf(proxy->name, sizeof(proxy->name), DRIVER_NAME);
+	else
+		snprintf(proxy->name, sizeof(proxy->name), DRIVER_NAME "%d", proxy->id);
+
+	proxy->misc.minor = MISC_DYNAMIC_MINOR;
+	proxy->misc.name = proxy->name;
+	proxy->misc.fops = &dma_proxy_fops;
+	proxy->misc.parent = &pdev->dev;
+	ret = misc_register(&proxy->misc);
+	if (ret)
+		goto err_ida;
+
+	platform_set_drvdata(pdev, proxy);
+	dev_info(&pdev->dev, "/dev/%s ready, tx %s, rx %s\n", proxy->name,
+		 proxy->chan[DMA_PROXY_TX] ? dma_chan_name(proxy->chan[DMA_PROXY_TX]) : "none",
+		 proxy->chan[DMA_PROXY_RX] ? dma_chan_name(proxy->chan[DMA_PROXY_RX]) : "none");
+	return 0;
+
+err_ida:
+	ida_free(&dma_proxy_ida, proxy->id);
+err_ring:
+	vfree(proxy->ring);
+err_release:
+	for (i = 0; i < 2; i++) {
+		if (proxy->chan[i])
+			dma_release_channel(proxy->chan[i]);
+	}
+	kfree(proxy);
+	return ret;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 11, 0)
+static int dma_proxy_remove(struct platform_device *pdev)
+#else
+static void dma_proxy_remove(struct platform_device *pdev)
+#endif
+{
+	struct dma_proxy_dev *proxy = platform_get_drvdata(pdev);
+	int i;
+
+	// No new opens after this. A file still open keeps the proxy and its ring, but
+	// everything tied to the device is released now and its ioctls fail.
+	misc_deregister(&proxy->misc);
+	mutex_lock(&proxy->lock);
+	WRITE_ONCE(proxy->gone, true);
+	dma_proxy_stop(proxy);
+	for (i = 0; i < DMA_PROXY_MAX_REGIONS; i++)
+		dma_proxy_release_region(proxy, &proxy->region[i]);
+	for (i = 0; i < 2; i++) {
+		if (proxy->chan[i])
+			dma_release_channel(proxy->chan[i]);
+		proxy->chan[i] = NULL;
+	}
+	mutex_unlock(&proxy->lock);
+	wake_up_interruptible(&proxy->wait);
+	ida_free(&dma_proxy_ida, proxy->id);
+	kref_put(&proxy->ref, dma_proxy_free);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 11, 0)
+	return 0;
+#endif
+}
+
+static const struct of_device_id dma_proxy_of_ids[] = {
+	{ .compatible = "xlnx,dma_proxy" },
+	{}
+};
+MODULE_DEVICE_TABLE(of, dma_proxy_of_ids);
+
+static struct platform_driver dma_proxy_driver = {
+	.driver = {
+		.name = DRIVER_NAME,
+		.of_match_table = dma_proxy_of_ids,
+	},
+	.probe = dma_proxy_probe,
+	.remove = dma_proxy_remove,
+};
+
+module_platform_driver(dma_proxy_driver);
@@ -0,0 +1,84 @@
+/*
+ * AXI DMA proxy, user space interface
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+
+#ifndef _DMA_PROXY_IOCTL_H
+#define _DMA_PROXY_IOCTL_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define DMA_PROXY_MAGIC 0xDA
+
+#define DMA_PROXY_TX 0 // MM2S, memory to stream
+#define DMA_PROXY_RX 1 // S2MM, stream to memory
+
+#define DMA_PROXY_MAX_REGIONS 8
+#define DMA_PROXY_RING_ENTRIES 256 // Power of two, also the limit of transfers in flight
+
+// Where a region comes from
+#define DMA_PROXY_REGION_DMABUF 0 // fd is a dma-buf, e.g. exported by u-dma-buf
+#define DMA_PROXY_REGION_PHYS 1   // phys_addr/size of a udmabuf as read from sysfs, needs CAP_SYS_RAWIO
+
+struct dma_proxy_info {
+	__u32 channels;     // Bit 0 set if TX was claimed, bit 1 if RX was claimed
+	__u32 ring_entries;
+	__u32 ring_bytes;   // Length to pass to mmap()
+	__u32 reserved;
+};
+
+struct dma_proxy_region {
+	__u32 type;
+	__s32 fd;
+	__u64 phys_addr;
+	__u64 size; // In for DMA_PROXY_REGION_PHYS, out for DMA_PROXY_REGION_DMABUF
+	__u32 id;   // Out, used in struct dma_proxy_transfer
+	__u32 reserved;
+};
+
+struct dma_proxy_transfer {
+	__u32 channel;
+	__u32 region;
+	__u64 offset;
+	__u32 length;
+	__u32 reserved;
+	__u64 user_data; // Handed back untouched in the completion
+};
+
+struct dma_proxy_queue {
+	__u64 transfers; // User pointer to an array of struct dma_proxy_transfer
+	__u32 count;
+	__u32 queued;    // Out, how many from the front of the array were accepted
+};
+
+struct dma_proxy_completion {
+	__u64 user_data;
+	__u64 timestamp_ns; // ktime_get_raw_ns(), same clock as CLOCK_MONOTONIC_RAW
+	__u32 channel;
+	__u32 length;       // Bytes actually moved
+	__s32 status;       // 0, or a negative errno
+	__u32 reserved;
+};
+
+// Mapped read-write at offset 0 of the device. The driver advances head after
+// filling an entry, user space advances tail after consuming one. Both only
+// ever increase, the slot is the counter modulo entries.
+struct dma_proxy_ring {
+	__u32 head;
+	__u32 tail;
+	__u32 entries;
+	__u32 dropped;
+	struct dma_proxy_completion entry[DMA_PROXY_RING_ENTRIES];
+};
+
+#define DMA_PROXY_IOC_INFO _IOR(DMA_PROXY_MAGIC, 0, struct dma_proxy_info)
+#define DMA_PROXY_IOC_ADD_REGION _IOWR(DMA_PROXY_MAGIC, 1, struct dma_proxy_region)
+#define DMA_PROXY_IOC_QUEUE _IOWR(DMA_PROXY_MAGIC, 2, struct dma_proxy_queue)
+#define DMA_PROXY_IOC_STOP _IO(DMA_PROXY_MAGIC, 3)
+
+#endif /* _DMA_PROXY_IOCTL_H */